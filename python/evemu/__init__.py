@@ -19,15 +19,19 @@ raw events.
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 import ctypes
-import glob
+import errno
+import fcntl
+import hashlib
 import os
-import re
 import stat
 import tempfile
 
 import evemu.base
 
 __all__ = ["Device",
+           "DevicePool",
+           "EventArray",
+           "create_devices",
            "InputEvent",
            "event_get_value",
            "event_get_name",
@@ -36,6 +40,9 @@ __all__ = ["Device",
 
 _libevdev = evemu.base.LibEvdev()
 
+# how long the device nodes of new devices may take to show up
+_DEVNODE_TIMEOUT_MS = 5000
+
 def event_get_value(event_type, event_code = None):
     """
     Return the integer-value for the given event type and/or code string
@@ -166,6 +173,70 @@ class InputEvent(object):
         f.seek(0)
         return f.readline().rstrip()
 
+def _bit_is_set(mask, bit):
+    if bit is None or not 0 <= bit < len(mask) * 8:
+        return False
+    return bool(mask[bit // 8] & (1 << (bit % 8)))
+
+class _EventBuffer(object):
+    """
+    Owns the C array returned by evemu_read_events() and frees it when the
+    last view of it is gone.
+    """
+
+    def __init__(self, address):
+        self._address = address
+        self._libc = evemu.base.LibC()
+
+    def __del__(self):
+        if self._address:
+            self._libc.free(self._address)
+
+class EventArray(object):
+    """
+    The events of a recording in one contiguous C array, as returned by
+    Device.event_array(). Indexing and iterating give InputEvent objects.
+    memoryview() exposes the array itself through the buffer protocol,
+    with one structured element (sec, usec, type, code, value) per event,
+    so it can be sliced or passed to numpy without a Python object per
+    event, e.g. numpy.asarray(events.memoryview()).
+    """
+
+    def __init__(self, address, count):
+        array_type = evemu.base.InputEvent * count
+        if count:
+            self._array = array_type.from_address(address)
+            # every view of the array keeps the C memory alive
+            self._array._buffer = _EventBuffer(address)
+        else:
+            self._array = array_type()
+
+    def memoryview(self):
+        """
+        Return a memoryview of the events, without copying them.
+        """
+        return memoryview(self._array)
+
+    @property
+    def array(self):
+        """
+        The ctypes array of evemu.base.InputEvent structures.
+        """
+        return self._array
+
+    def __len__(self):
+        return len(self._array)
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(self)))]
+        e = self._array[index]
+        return InputEvent(e.sec, e.usec, e.type, e.code, e.value)
+
+    def __iter__(self):
+        for e in self._array:
+            yield InputEvent(e.sec, e.usec, e.type, e.code, e.value)
+
 class Device(object):
     """
     Encapsulates a raw kernel input event device, either an existing one as
@@ -196,8 +267,15 @@ class Device(object):
         self._libevemu = evemu.base.LibEvemu()
 
         self._evemu_device = self._libevemu.evemu_new(b"")
+        self._caps = None
 
-        if self._is_propfile:
+        if self._is_propfile and type(f) == str and os.path.isfile(f):
+            # a prop file of its own, compiled once into f + ".cache"
+            self._libevemu.evemu_read_cached(self._evemu_device,
+                                             f.encode("utf-8"))
+            if create:
+                self._file = self._create_devnode()
+        elif self._is_propfile:
             fs = self._libc.fdopen(self._file.fileno(), b"r")
             self._libevemu.evemu_read(self._evemu_device, fs)
             if create:
@@ -212,22 +290,21 @@ class Device(object):
             self._libevemu.evemu_destroy(self._evemu_device)
 
     def _create_devnode(self):
-        self._libevemu.evemu_create_managed(self._evemu_device)
-        return open(self._find_newest_devnode(self.name), 'r+b', buffering=0)
-
-    def _find_newest_devnode(self, target_name):
-        newest_node = (None, float(0))
-        for sysname in glob.glob("/sys/class/input/event*/device/name"):
-            with open(sysname) as f:
-                name = f.read().rstrip()
-                if name == target_name:
-                    ev = re.search("(event\d+)", sysname)
-                    if ev:
-                       devname = os.path.join("/dev/input", ev.group(1))
-                       ctime = os.stat(devname).st_ctime
-                       if ctime > newest_node[1]:
-                           newest_node = (devname, ctime)
-        return newest_node[0]
+        return Device._create_devnodes([self])[0]
+
+    @staticmethod
+    def _create_devnodes(devices):
+        """
+        Create the uinput devices of several prop file Devices at once and
+        return their opened device nodes, waiting for all of them together.
+        """
+        libevemu = evemu.base.LibEvemu()
+        devs = (ctypes.c_void_p * len(devices))(
+            *[d._evemu_device for d in devices])
+        libevemu.evemu_create_all(devs, len(devices), 0)
+        libevemu.evemu_wait_devnodes(devs, len(devices), _DEVNODE_TIMEOUT_MS)
+        return [open(libevemu.evemu_get_devnode(d._evemu_device).decode(),
+                     'r+b', buffering=0) for d in devices]
 
     def _check_is_propfile(self, f):
         if stat.S_ISCHR(os.fstat(f.fileno()).st_mode):
@@ -265,6 +342,34 @@ class Device(object):
         self._libevemu.evemu_write(self._evemu_device, fs)
         self._libc.fflush(fs)
 
+    def reset_state(self):
+        """
+        Brings the created pseudo-device back to rest: lifts all touches,
+        releases all keys and moves the axes back to their rest position,
+        so it can be reused instead of creating a new one. Nothing is left
+        to read from the device node afterwards.
+        """
+        self._libevemu.evemu_reset_state(self._evemu_device,
+                                         self._file.fileno())
+        self._drain()
+
+    def _drain(self):
+        """
+        Throws away the events queued for reading from the device node,
+        those of earlier use and of a reset alike.
+        """
+        fd = self._file.fileno()
+        flags = fcntl.fcntl(fd, fcntl.F_GETFL)
+        fcntl.fcntl(fd, fcntl.F_SETFL, flags | os.O_NONBLOCK)
+        try:
+            while os.read(fd, 4096):
+                pass
+        except OSError as e:
+            if e.errno != errno.EAGAIN:
+                raise
+        finally:
+            fcntl.fcntl(fd, fcntl.F_SETFL, flags)
+
     def events(self, events_file=None):
         """
         Reads the events from the given file and returns them as a list of
@@ -284,6 +389,79 @@ class Device(object):
         while self._libevemu.evemu_read_event(fs, ctypes.byref(event)) > 0:
             yield InputEvent(event.sec, event.usec, event.type, event.code, event.value)
 
+    def event_array(self, events_file=None):
+        """
+        Reads all events from the given file with a single library call
+        and returns them as an EventArray backed by one contiguous C
+        array.
+
+        If not None, events_file must be a real file with fileno(), not
+        file-like. If None, the file used for creating this device is used.
+        """
+        if events_file:
+            if not hasattr(events_file, "fileno"):
+                raise TypeError("expected file")
+        else:
+            events_file = self._file
+
+        fs = self._libc.fdopen(events_file.fileno(), b"r")
+        address = ctypes.c_void_p()
+        count = self._libevemu.evemu_read_events(fs, ctypes.byref(address))
+        return EventArray(address.value, count)
+
+    def _capabilities(self):
+        """
+        Fetches the event masks, the properties and all absinfo of the
+        device with a few library calls, on first use.
+        """
+        if self._caps is not None:
+            return self._caps
+
+        def get_mask(getter, *args):
+            mask = (ctypes.c_ubyte * 128)()
+            size = getter(*(args + (mask, len(mask))))
+            if size > len(mask):
+                mask = (ctypes.c_ubyte * size)()
+                getter(*(args + (mask, size)))
+            return bytearray(mask[:size])
+
+        dev = self._evemu_device
+        types = get_mask(self._libevemu.evemu_get_event_mask, dev, 0)
+        codes = {}
+        for t in range(1, len(types) * 8):
+            if _bit_is_set(types, t):
+                codes[t] = get_mask(self._libevemu.evemu_get_event_mask,
+                                    dev, t)
+        props = get_mask(self._libevemu.evemu_get_prop_mask, dev)
+        absinfo = (evemu.base.InputAbsinfo * 64)()
+        count = self._libevemu.evemu_get_abs_table(dev, absinfo, len(absinfo))
+        if count > len(absinfo):
+            absinfo = (evemu.base.InputAbsinfo * count)()
+            self._libevemu.evemu_get_abs_table(dev, absinfo, count)
+
+        self._caps = (codes, props, absinfo)
+        return self._caps
+
+    @property
+    def capabilities(self):
+        """
+        Gets the supported event codes as a dict of event type to a list
+        of codes, e.g. {1: [272, 273], 2: [0, 1]}. EV_SYN is not
+        included.
+        """
+        codes = self._capabilities()[0]
+        return dict((t, [c for c in range(len(mask) * 8)
+                         if _bit_is_set(mask, c)])
+                    for (t, mask) in codes.items())
+
+    def _absinfo(self, event_code):
+        if not isinstance(event_code, int):
+            event_code = evemu.event_get_value("EV_ABS", event_code)
+        absinfo = self._capabilities()[2]
+        if event_code is None or not 0 <= event_code < len(absinfo):
+            return evemu.base.InputAbsinfo()
+        return absinfo[event_code]
+
     def play(self, events_file):
         """
         Replays an event sequence, as provided by the events_file,
@@ -376,10 +554,7 @@ class Device(object):
 
         event_code may be an int or string-like ("ABS_X").
         """
-        if not isinstance(event_code, int):
-            event_code = evemu.event_get_value("EV_ABS", event_code)
-        return self._libevemu.evemu_get_abs_minimum(self._evemu_device,
-                                                    event_code)
+        return self._absinfo(event_code).minimum
 
     def get_abs_maximum(self, event_code):
         """
@@ -387,10 +562,7 @@ class Device(object):
 
         event_code may be an int or string-like ("ABS_X").
         """
-        if not isinstance(event_code, int):
-            event_code = evemu.event_get_value("EV_ABS", event_code)
-        return self._libevemu.evemu_get_abs_maximum(self._evemu_device,
-                                                    event_code)
+        return self._absinfo(event_code).maximum
 
     def get_abs_fuzz(self, event_code):
         """
@@ -398,10 +570,7 @@ class Device(object):
 
         event_code may be an int or string-like ("ABS_X").
         """
-        if not isinstance(event_code, int):
-            event_code = evemu.event_get_value("EV_ABS", event_code)
-        return self._libevemu.evemu_get_abs_fuzz(self._evemu_device,
-                                                 event_code)
+        return self._absinfo(event_code).fuzz
 
     def get_abs_flat(self, event_code):
         """
@@ -409,10 +578,7 @@ class Device(object):
 
         event_code may be an int or string-like ("ABS_X").
         """
-        if not isinstance(event_code, int):
-            event_code = evemu.event_get_value("EV_ABS", event_code)
-        return self._libevemu.evemu_get_abs_flat(self._evemu_device,
-                                                 event_code)
+        return self._absinfo(event_code).flat
 
     def get_abs_resolution(self, event_code):
         """
@@ -420,10 +586,7 @@ class Device(object):
 
         event_code may be an int or string-like ("ABS_X").
         """
-        if not isinstance(event_code, int):
-            event_code = evemu.event_get_value("EV_ABS", event_code)
-        return self._libevemu.evemu_get_abs_resolution(self._evemu_device,
-                                                       event_code)
+        return self._absinfo(event_code).resolution
 
     # don't change 'event_code' to prop, it breaks API
     def has_prop(self, event_code):
@@ -435,8 +598,7 @@ class Device(object):
         """
         if not isinstance(event_code, int):
             event_code = evemu.input_prop_get_value(event_code)
-        result = self._libevemu.evemu_has_prop(self._evemu_device, event_code)
-        return bool(result)
+        return _bit_is_set(self._capabilities()[1], event_code)
 
     def has_event(self, event_type, event_code):
         """
@@ -450,8 +612,72 @@ class Device(object):
             event_type = evemu.event_get_value(event_type)
         if not isinstance(event_code, int):
             event_code = evemu.event_get_value(event_type, event_code)
-        result = self._libevemu.evemu_has_event(self._evemu_device,
-                                                event_type,
-                                                event_code)
-        return bool(result)
+        if event_type == 0:
+            # the masks leave EV_SYN out, libevdev answers for it
+            result = self._libevemu.evemu_has_event(self._evemu_device,
+                                                    event_type,
+                                                    event_code)
+            return bool(result)
+        codes = self._capabilities()[0]
+        return event_type in codes and _bit_is_set(codes[event_type],
+                                                   event_code)
+
+
+
+def create_devices(files):
+    """
+    Create a pseudo-device for every evemu prop file, all at once.
+
+    Like calling Device(f) for each of files, but the uinput devices are
+    created together and their device nodes waited for in one go, so the
+    time taken stays about the same however many devices there are.
+    Returns the Devices in the order of files.
+    """
+    devices = [Device(f, create=False) for f in files]
+    for device in devices:
+        if not device._is_propfile:
+            raise TypeError("expected evemu prop files")
+    for (device, node) in zip(devices, Device._create_devnodes(devices)):
+        device._file = node
+    return devices
+
+
+class DevicePool(object):
+    """
+    Keeps created pseudo-devices for reuse, keyed by a hash of their prop
+    file. Leasing a device whose description was released before takes the
+    time of a state reset instead of a uinput device creation.
+    """
+
+    def __init__(self):
+        self._idle = {}
+
+    @staticmethod
+    def _key(prop_file):
+        with open(prop_file, "rb") as f:
+            return hashlib.sha1(f.read()).hexdigest()
+
+    def lease(self, prop_file):
+        """
+        Returns a created Device for the prop file name, at rest.
+        """
+        key = self._key(prop_file)
+        idle = self._idle.get(key)
+        if idle:
+            return idle.pop()
+        device = Device(prop_file)
+        device._pool_key = key
+        return device
 
+    def release(self, device):
+        """
+        Resets a leased Device and keeps it for the next lease.
+        """
+        device.reset_state()
+        self._idle.setdefault(device._pool_key, []).append(device)
+
+    def clear(self):
+        """
+        Drops all kept devices, destroying them once unreferenced.
+        """
+        self._idle = {}
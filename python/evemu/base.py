@@ -7,6 +7,7 @@ import os
 
 # Import types directly, so they don't have to be prefixed with "ctypes.".
 from ctypes import c_char_p, c_int, c_uint, c_void_p, c_long, c_int32, c_uint16
+from ctypes import c_ssize_t, c_size_t, POINTER
 
 import evemu.exception
 
@@ -156,6 +157,10 @@ class LibC(LibraryWrapper):
             "restype": c_int,
             "errcheck": expect_eq_zero
             },
+        "free": {
+            "argtypes": (c_void_p,),
+            "restype": None
+            },
         }
 
 class LibEvdev(LibraryWrapper):
@@ -368,6 +373,27 @@ class LibEvemu(LibraryWrapper):
             "restype": c_int,
             "errcheck": expect_ge_zero
             },
+        #int evemu_get_event_mask(const struct evemu_device *dev, int type,
+        #                         unsigned char *mask, size_t size);
+        "evemu_get_event_mask": {
+            "argtypes": (c_void_p, c_int, c_void_p, c_size_t),
+            "restype": c_int,
+            "errcheck": expect_ge_zero
+            },
+        #int evemu_get_prop_mask(const struct evemu_device *dev,
+        #                        unsigned char *mask, size_t size);
+        "evemu_get_prop_mask": {
+            "argtypes": (c_void_p, c_void_p, c_size_t),
+            "restype": c_int,
+            "errcheck": expect_ge_zero
+            },
+        #int evemu_get_abs_table(const struct evemu_device *dev,
+        #                        struct input_absinfo *abs, size_t count);
+        "evemu_get_abs_table": {
+            "argtypes": (c_void_p, c_void_p, c_size_t),
+            "restype": c_int,
+            "errcheck": expect_ge_zero
+            },
         #int evemu_extract(struct evemu_device *dev, int fd);
         "evemu_extract": {
             "argtypes": (c_void_p, c_int),
@@ -386,6 +412,12 @@ class LibEvemu(LibraryWrapper):
             "restype": c_int,
             "errcheck": expect_gt_zero
             },
+        #int evemu_read_cached(struct evemu_device *dev, const char *path);
+        "evemu_read_cached": {
+            "argtypes": (c_void_p, c_char_p),
+            "restype": c_int,
+            "errcheck": expect_gt_zero
+            },
         #int evemu_write_event(FILE *fp, const struct input_event *ev);
         "evemu_write_event": {
             "argtypes": (c_void_p, c_void_p),
@@ -404,6 +436,12 @@ class LibEvemu(LibraryWrapper):
             "argtypes": (c_void_p, c_void_p),
             "restype": c_int
             },
+        #ssize_t evemu_read_events(FILE *fp, struct input_event **events);
+        "evemu_read_events": {
+            "argtypes": (c_void_p, POINTER(c_void_p)),
+            "restype": c_ssize_t,
+            "errcheck": expect_ge_zero
+            },
         #int evemu_read_event_realtime(FILE *fp, struct input_event *ev,
         #			      struct timeval *evtime);
         "evemu_read_event_realtime": {
@@ -441,6 +479,32 @@ class LibEvemu(LibraryWrapper):
             "restype": c_int,
             "errcheck": expect_eq_zero
             },
+        #const char *evemu_get_devnode(struct evemu_device *dev);
+        "evemu_get_devnode": {
+            "argtypes": (c_void_p,),
+            "restype": c_char_p,
+            "errcheck": expect_not_none
+            },
+        #int evemu_create_all(struct evemu_device **devs, int count,
+        #                     int threads);
+        "evemu_create_all": {
+            "argtypes": (POINTER(c_void_p), c_int, c_int),
+            "restype": c_int,
+            "errcheck": expect_eq_zero
+            },
+        #int evemu_wait_devnodes(struct evemu_device **devs, int count,
+        #                        int ms);
+        "evemu_wait_devnodes": {
+            "argtypes": (POINTER(c_void_p), c_int, c_int),
+            "restype": c_int,
+            "errcheck": expect_eq_zero
+            },
+        #int evemu_reset_state(const struct evemu_device *dev, int fd);
+        "evemu_reset_state": {
+            "argtypes": (c_void_p, c_int),
+            "restype": c_int,
+            "errcheck": expect_eq_zero
+            },
         #void evemu_destroy(struct evemu_device *dev);
         "evemu_destroy": {
             "argtypes": (c_void_p,),
@@ -454,3 +518,11 @@ class InputEvent(ctypes.Structure):
 		("type", c_uint16),
 		("code", c_uint16),
 		("value", c_int32)]
+
+class InputAbsinfo(ctypes.Structure):
+    _fields_ = [("value", c_int32),
+		("minimum", c_int32),
+		("maximum", c_int32),
+		("fuzz", c_int32),
+		("flat", c_int32),
+		("resolution", c_int32)]
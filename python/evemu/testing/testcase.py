@@ -1,6 +1,7 @@
 import os
 import unittest
 
+import evemu
 import evemu.exception
 from evemu import event_get_name, event_get_value, input_prop_get_value, input_prop_get_name
 
@@ -42,6 +43,9 @@ class Non26BaseTestCase(unittest.TestCase):
 
 class BaseTestCase(unittest.TestCase):
 
+    # created devices outlive the test that leased them
+    device_pool = evemu.DevicePool()
+
     def setUp(self):
         super(BaseTestCase, self).setUp()
         basedir = get_top_directory()
@@ -53,6 +57,15 @@ class BaseTestCase(unittest.TestCase):
             self.device.destroy()
        super(BaseTestCase, self).tearDown()
 
+    def lease_device(self, prop_file=None):
+        """
+        Returns a created Device for the prop file, the default device file
+        if None, and gives it back to the pool after the test.
+        """
+        device = self.device_pool.lease(prop_file or self.get_device_file())
+        self.addCleanup(self.device_pool.release, device)
+        return device
+
     def get_device_file(self):
         return os.path.join(self.data_dir, "ntrig-dell-xt2.prop")
 
@@ -1,5 +1,8 @@
 from multiprocessing import Process, Queue, Event
 
+import fcntl
+import gc
+import os
 import re
 import tempfile
 import unittest
@@ -139,6 +142,24 @@ class DeviceActionTestCase(evemu.testing.testcase.BaseTestCase):
             self.assertTrue(rhs)
             self.assertEquals(lhs.group(1), rhs.group(1))
 
+    def test_device_pool(self):
+        """
+        Verifies that a released device is leased again rather than a new
+        one created.
+        """
+        device = self.device_pool.lease(self.get_device_file())
+        self.device_pool.release(device)
+        self.assertTrue(self.lease_device() is device)
+
+        # neither the reset frame nor older events are left to read
+        fd = device._file.fileno()
+        flags = fcntl.fcntl(fd, fcntl.F_GETFL)
+        fcntl.fcntl(fd, fcntl.F_SETFL, flags | os.O_NONBLOCK)
+        try:
+            self.assertRaises(OSError, os.read, fd, 4096)
+        finally:
+            fcntl.fcntl(fd, fcntl.F_SETFL, flags)
+
     def test_read_events(self):
         device = evemu.Device(self.get_device_file(), create=False)
         events_file = self.get_events_file()
@@ -146,6 +167,29 @@ class DeviceActionTestCase(evemu.testing.testcase.BaseTestCase):
             events = [e for e in device.events(e)]
             self.assertTrue(len(events) > 1)
 
+    def test_event_array(self):
+        device = evemu.Device(self.get_device_file(), create=False)
+        events_file = self.get_events_file()
+        with open(events_file) as e:
+            events = [e for e in device.events(e)]
+        with open(events_file) as e:
+            array = device.event_array(e)
+
+        self.assertEqual(len(array), len(events))
+        view = array.memoryview()
+        self.assertEqual(view.shape, (len(events),))
+        for i in (0, len(events) // 2, len(events) - 1):
+            self.assertEqual(array[i].type, events[i].type)
+            self.assertEqual(array[i].code, events[i].code)
+            self.assertEqual(array[i].value, events[i].value)
+            self.assertEqual(array.array[i].usec, events[i].usec)
+
+        # the view keeps the events alive without the array object
+        data = view.tobytes()
+        del array
+        gc.collect()
+        self.assertEqual(view.tobytes(), data)
+
 class DevicePropertiesTestCase(evemu.testing.testcase.BaseTestCase):
     """
     Verifies the workings of the various device property accessors.
@@ -153,7 +197,7 @@ class DevicePropertiesTestCase(evemu.testing.testcase.BaseTestCase):
 
     def setUp(self):
         super(DevicePropertiesTestCase, self).setUp()
-        self._device = evemu.Device(self.get_device_file())
+        self._device = self.lease_device()
 
     def tearDown(self):
         del self._device
@@ -219,6 +263,15 @@ class DevicePropertiesTestCase(evemu.testing.testcase.BaseTestCase):
 
         self.assertEqual(results, self.get_expected_propbits())
 
+    def test_capabilities(self):
+        capabilities = self._device.capabilities
+        absmax = evemu.event_get_value("EV_ABS", "ABS_MAX")
+        ev_abs = evemu.event_get_value("EV_ABS")
+        results = dict((x, x in capabilities.get(ev_abs, []))
+                       for x in range(0, absmax + 1))
+
+        self.assertEqual(results, self.get_expected_absbits())
+
     def test_has_event_ev_abs(self):
         absmax = evemu.event_get_value("EV_ABS", "ABS_MAX")
         keys = range(0, absmax + 1)
@@ -226,6 +279,10 @@ class DevicePropertiesTestCase(evemu.testing.testcase.BaseTestCase):
 
         self.assertEqual(results, self.get_expected_absbits())
 
+    def test_has_event_ev_syn(self):
+        self.assertTrue(self._device.has_event("EV_SYN", "SYN_REPORT"))
+        self.assertTrue(self._device.has_event(0, 0))
+
     def test_has_event_ev_key(self):
         keymax = evemu.event_get_value("EV_KEY", "KEY_MAX")
         keys = range(0, keymax + 1)
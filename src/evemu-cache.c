@@ -0,0 +1,263 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Binary description cache. A parsed description is stored as its
+ * struct evemu_desc, verbatim, behind a small header:
+ *
+ *   magic | version | description size | layout | text hash | text size
+ *
+ * The hash and size are those of the description text, so a cache file
+ * stays valid exactly as long as the text it was compiled from does, and
+ * the layout catches a libevdev that would clamp codes differently.
+ * Loading is one readv() straight into the caller's struct, in native
+ * byte order; anything that does not match is parsed and written again.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define CACHE_MAGIC "EVEMUDC"
+#define CACHE_VERSION 2
+#define CACHE_SUFFIX ".cache"
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t desc_size;
+	uint64_t layout;	/* the code maxima descriptions are clamped to */
+	uint64_t hash;
+	uint64_t text_size;
+};
+
+/* not cryptographic, a cache key checked together with the text size */
+static uint64_t mix(uint64_t h, uint64_t w)
+{
+	h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	return h ^ (h >> 29);
+}
+
+static uint64_t text_hash(const char *buf, size_t size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL, w;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&w, buf + i, 8);
+		h = mix(h, w);
+	}
+	w = 0;
+	memcpy(&w, buf + i, size - i);
+	return mix(mix(h, w), size);
+}
+
+static uint64_t layout_hash(void)
+{
+	uint64_t h = 0;
+	int type;
+
+	for (type = 0; type < EV_CNT; type++)
+		h = mix(h, (uint32_t)libevdev_event_type_get_max(type));
+	return h;
+}
+
+static void fill_header(struct cache_header *h, const char *buf, size_t size)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	h->version = CACHE_VERSION;
+	h->desc_size = sizeof(struct evemu_desc);
+	h->layout = layout_hash();
+	h->hash = text_hash(buf, size);
+	h->text_size = size;
+}
+
+static int load(struct evemu_desc *desc, const struct cache_header *want,
+		const char *path)
+{
+	struct cache_header header;
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ desc, sizeof(*desc) },
+	};
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	do {
+		n = readv(fd, iov, 2);
+	} while (n < 0 && errno == EINTR);
+	close(fd);
+
+	if (n != (ssize_t)(sizeof(header) + sizeof(*desc)) ||
+	    memcmp(&header, want, sizeof(header)) != 0)
+		return -EINVAL;
+
+	/* the name is the only string, never trust its terminator */
+	desc->name[sizeof(desc->name) - 1] = '\0';
+	return 0;
+}
+
+static int save(const struct evemu_desc *desc, const struct cache_header *header,
+		const char *path)
+{
+	struct iovec iov[2] = {
+		{ (void *)header, sizeof(*header) },
+		{ (void *)desc, sizeof(*desc) },
+	};
+	char *tmp;
+	ssize_t n;
+	int fd, rc = 0;
+
+	/* concurrent readers see the old file or the new one */
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		return -ENOMEM;
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	do {
+		n = writev(fd, iov, 2);
+	} while (n < 0 && errno == EINTR);
+	if (n != (ssize_t)(sizeof(*header) + sizeof(*desc)))
+		rc = n < 0 ? -errno : -EIO;
+	if (close(fd) < 0 && rc == 0)
+		rc = -errno;
+	if (rc == 0 && (chmod(tmp, 0644) < 0 || rename(tmp, path) < 0))
+		rc = -errno;
+	if (rc < 0)
+		unlink(tmp);
+
+out:
+	free(tmp);
+	return rc;
+}
+
+/* $XDG_CACHE_HOME/evemu/<hash>.desc, for text that has no file of its own */
+static char *default_path(uint64_t hash)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	char *dir = NULL, *path = NULL;
+
+	if (base && *base == '/') {
+		dir = strdup(base);
+	} else {
+		base = getenv("HOME");
+		if (!base || *base != '/' || asprintf(&dir, "%s/.cache", base) < 0)
+			return NULL;
+	}
+	if (!dir)
+		return NULL;
+
+	mkdir(dir, 0755);
+	if (asprintf(&path, "%s/evemu", dir) >= 0) {
+		mkdir(path, 0755);
+		free(path);
+		if (asprintf(&path, "%s/evemu/%016llx.desc", dir,
+			     (unsigned long long)hash) < 0)
+			path = NULL;
+	} else {
+		path = NULL;
+	}
+
+	free(dir);
+	return path;
+}
+
+int evemu_desc_read_cached(struct evemu_desc *desc, const char *buf,
+			   size_t size, const char *cache)
+{
+	struct cache_header header;
+	char *path = NULL;
+	int rc;
+
+	fill_header(&header, buf, size);
+	if (!cache) {
+		path = default_path(header.hash);
+		cache = path;
+	}
+
+	if (cache && load(desc, &header, cache) == 0) {
+		free(path);
+		return 1;
+	}
+
+	/* a cache that cannot be written, e.g. next to a read-only file,
+	 * only means parsing again next time, nothing to tell anyone */
+	rc = evemu_desc_read_buffer(desc, buf, size);
+	if (rc > 0 && cache)
+		save(desc, &header, cache);
+
+	free(path);
+	return rc;
+}
+
+int evemu_read_cached(struct evemu_device *dev, const char *path)
+{
+	struct evemu_desc desc;
+	struct stat st;
+	char *buf = NULL, *cache = NULL;
+	size_t len = 0;
+	int fd, rc = -ENOMEM;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		rc = -EINVAL;
+		goto out;
+	}
+	buf = malloc(st.st_size + 1);
+	if (!buf || asprintf(&cache, "%s%s", path, CACHE_SUFFIX) < 0) {
+		cache = NULL;
+		goto out;
+	}
+
+	while (len < (size_t)st.st_size) {
+		ssize_t n = read(fd, buf + len, st.st_size - len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+
+	dev->version = EVEMU_VERSION;
+	rc = evemu_desc_read_cached(&desc, buf, len, cache);
+	if (rc > 0)
+		evemu_desc_to_device(&desc, dev);
+
+out:
+	close(fd);
+	free(cache);
+	free(buf);
+	return rc;
+}
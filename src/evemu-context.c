@@ -0,0 +1,161 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+
+/*
+ * Library contexts. Everything the library keeps between calls lives in a
+ * context: the log handler, rate limits and statistics. A thread works in
+ * the default context until it selects another one, a device stays in the
+ * context it was allocated in. Nothing here takes a lock, the hot paths
+ * only touch their context with relaxed atomics.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_BURST 3
+
+static void log_stderr(struct evemu_context *ctx __attribute__((unused)),
+		       enum evemu_log_priority priority,
+		       void *data __attribute__((unused)),
+		       const char *format, va_list args)
+{
+	const char *strlevel;
+
+	switch (priority) {
+		case EVEMU_LOG_ERROR: strlevel = "FATAL"; break;
+		case EVEMU_LOG_WARNING: strlevel = "WARNING"; break;
+		default: strlevel = "INFO"; break;
+	}
+
+	fprintf(stderr, "%s: ", strlevel);
+	vfprintf(stderr, format, args);
+}
+
+struct evemu_context evemu_default_context = {
+	.log_func = log_stderr,
+	.log_priority = EVEMU_LOG_INFO,
+	.incompatible = { .burst = DEFAULT_BURST },
+};
+
+__thread struct evemu_context *evemu_thread_context;
+
+static struct evemu_context *context_or_default(struct evemu_context *ctx)
+{
+	return ctx ? ctx : &evemu_default_context;
+}
+
+struct evemu_context *evemu_context_new(void)
+{
+	struct evemu_context *ctx = calloc(1, sizeof(*ctx));
+
+	if (ctx) {
+		ctx->log_func = log_stderr;
+		ctx->log_priority = EVEMU_LOG_INFO;
+		ctx->incompatible.burst = DEFAULT_BURST;
+	}
+
+	return ctx;
+}
+
+void evemu_context_delete(struct evemu_context *ctx)
+{
+	if (ctx == &evemu_default_context)
+		return;
+	free(ctx);
+}
+
+struct evemu_context *evemu_context_use(struct evemu_context *ctx)
+{
+	struct evemu_context *prev = evemu_thread_context;
+
+	evemu_thread_context = ctx;
+	return prev;
+}
+
+void evemu_context_set_log_func(struct evemu_context *ctx,
+				evemu_log_func_t func, void *data)
+{
+	ctx = context_or_default(ctx);
+	ctx->log_func = func;
+	ctx->log_data = data;
+}
+
+void evemu_context_set_log_priority(struct evemu_context *ctx,
+				    enum evemu_log_priority priority)
+{
+	context_or_default(ctx)->log_priority = priority;
+}
+
+enum evemu_log_priority evemu_context_get_log_priority(struct evemu_context *ctx)
+{
+	return context_or_default(ctx)->log_priority;
+}
+
+void evemu_context_set_ratelimit(struct evemu_context *ctx,
+				 unsigned int interval_ms, unsigned int burst)
+{
+	struct ratelimit *rl = &context_or_default(ctx)->incompatible;
+
+	rl->interval_ns = interval_ms * 1000000ULL;
+	rl->burst = burst;
+	__atomic_store_n(&rl->num, 0, __ATOMIC_RELAXED);
+}
+
+void evemu_log(struct evemu_context *ctx, enum evemu_log_priority priority,
+	       const char *format, ...)
+{
+	va_list args;
+
+	if (!ctx->log_func || priority > ctx->log_priority)
+		return;
+
+	va_start(args, format);
+	ctx->log_func(ctx, priority, ctx->log_data, format, args);
+	va_end(args);
+}
+
+unsigned int ratelimit_test(struct ratelimit *rl)
+{
+	unsigned int num;
+
+	if (rl->interval_ns) {
+		struct timespec ts;
+		uint64_t now, begin;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		begin = __atomic_load_n(&rl->begin, __ATOMIC_RELAXED);
+		/* one of the racing threads starts the new interval */
+		if (now - begin >= rl->interval_ns &&
+		    __atomic_compare_exchange_n(&rl->begin, &begin, now, 0,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			__atomic_store_n(&rl->num, 0, __ATOMIC_RELAXED);
+	}
+
+	/* stop counting once past the limit, so it never wraps */
+	num = __atomic_load_n(&rl->num, __ATOMIC_RELAXED);
+	if (num > rl->burst)
+		return rl->burst + 2;
+
+	return __atomic_add_fetch(&rl->num, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,224 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Creating many uinput devices at once. The uinput setup of a device is
+ * a few hundred ioctls on its own file descriptor, so devices are set up
+ * by a pool of threads. Waiting for the devnodes is left to one inotify
+ * watch on /dev/input, and on the udev database when udev runs, so the
+ * wait costs one wakeup per batch of nodes rather than a sysfs scan per
+ * device.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEVNODE_DIR "/dev/input"
+#define UDEV_DATA_DIR "/run/udev/data"
+/* without inotify, look again this often */
+#define POLL_INTERVAL_MS 10
+
+struct create_batch {
+	struct evemu_device **devs;
+	int count;
+	int *rc;
+
+	pthread_mutex_t lock;
+	int next;			/* next device to create */
+};
+
+static void *create_thread(void *data)
+{
+	struct create_batch *b = data;
+
+	while (1) {
+		int i;
+
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->count)
+			break;
+
+		b->rc[i] = evemu_create_managed(b->devs[i]);
+	}
+
+	return NULL;
+}
+
+int evemu_create_all(struct evemu_device **devs, int count, int threads)
+{
+	struct create_batch b;
+	pthread_t *tids;
+	int i, started = 0, rc = 0;
+
+	if (count <= 0)
+		return 0;
+
+	memset(&b, 0, sizeof(b));
+	b.devs = devs;
+	b.count = count;
+	b.rc = calloc(count, sizeof(*b.rc));
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > count)
+		threads = count;
+	if (threads < 1)
+		threads = 1;
+
+	tids = calloc(threads, sizeof(*tids));
+	if (!b.rc || !tids) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_init(&b.lock, NULL);
+	/* the calling thread takes its share too */
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&tids[started], NULL, create_thread, &b) == 0)
+			started++;
+	create_thread(&b);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&b.lock);
+
+	for (i = 0; i < count && rc == 0; i++)
+		rc = b.rc[i];
+
+	/* all or nothing */
+	if (rc < 0)
+		for (i = 0; i < count; i++)
+			evemu_destroy(devs[i]);
+
+out:
+	free(tids);
+	free(b.rc);
+	return rc;
+}
+
+/* the devnode exists and, if udev runs, udev is done with it */
+static int devnode_ready(struct evemu_device *dev, int udev)
+{
+	const char *devnode = evemu_get_devnode(dev);
+	char path[64];
+	struct stat st;
+
+	if (!devnode)
+		return -ENODEV;
+	if (stat(devnode, &st) < 0 || !S_ISCHR(st.st_mode))
+		return 0;
+	if (!udev)
+		return 1;
+
+	snprintf(path, sizeof(path), UDEV_DATA_DIR "/c%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+	return access(path, F_OK) == 0;
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+int evemu_wait_devnodes(struct evemu_device **devs, int count, int ms)
+{
+	struct pollfd pfd = { .fd = -1, .events = POLLIN };
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	unsigned char *done;
+	long deadline = ms >= 0 ? now_ms() + ms : 0;
+	int udev, pending, i, rc = 0;
+
+	if (count <= 0)
+		return 0;
+	done = calloc(count, 1);
+	if (!done)
+		return -ENOMEM;
+
+	/* watch first, then look: nothing created in between is missed */
+	udev = access(UDEV_DATA_DIR, F_OK) == 0;
+	pfd.fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (pfd.fd >= 0 &&
+	    (inotify_add_watch(pfd.fd, DEVNODE_DIR, IN_CREATE | IN_ATTRIB) < 0 ||
+	     (udev && inotify_add_watch(pfd.fd, UDEV_DATA_DIR,
+					IN_CREATE | IN_MOVED_TO) < 0))) {
+		close(pfd.fd);
+		pfd.fd = -1;
+	}
+
+	while (1) {
+		int timeout;
+
+		pending = 0;
+		for (i = 0; i < count && rc == 0; i++) {
+			if (done[i])
+				continue;
+			rc = devnode_ready(devs[i], udev);
+			if (rc > 0) {
+				done[i] = 1;
+				rc = 0;
+			} else if (rc == 0) {
+				pending++;
+			}
+		}
+		if (rc < 0 || pending == 0)
+			break;
+
+		if (ms < 0) {
+			timeout = -1;
+		} else {
+			long left = deadline - now_ms();
+
+			if (left <= 0) {
+				rc = -ETIMEDOUT;
+				break;
+			}
+			timeout = left;
+		}
+		/* a negative fd is ignored, poll() then only sleeps */
+		if (pfd.fd < 0 && (timeout < 0 || timeout > POLL_INTERVAL_MS))
+			timeout = POLL_INTERVAL_MS;
+
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+			rc = -errno;
+			break;
+		}
+		/* the events only wake us up, the nodes are looked at again */
+		while (pfd.fd >= 0 && read(pfd.fd, events, sizeof(events)) > 0)
+			;
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+	free(done);
+	return rc;
+}
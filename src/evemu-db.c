@@ -0,0 +1,740 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Device description database. An index file holds, for every device, a
+ * fixed-size capability bitset and the absinfo of its axes:
+ *
+ *   header | device table | bitsets | absinfo table | string table
+ *
+ * The bitset packs the supported event types (in the place of EV_SYN, as
+ * EVIOCGBIT(0) does), the input properties and the codes of every type
+ * one after the other. A query compiles to a "must have" and a "must not
+ * have" bitset in the same layout, so matching a device is a branch-free
+ * loop over a few 64 bit words. The file is used in place with mmap(),
+ * in native byte order.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DB_MAGIC "EVEMUDB"
+#define DB_VERSION 1
+#define DB_WORD_BITS 64
+
+#ifdef INPUT_PROP_MAX
+#define DB_PROP_COUNT (INPUT_PROP_MAX + 1)
+#else
+#define DB_PROP_COUNT 0
+#endif
+
+struct db_layout {
+	uint32_t offset[EV_CNT];	/* first bit of each type's codes */
+	uint32_t count[EV_CNT];		/* type 0 holds the types */
+	uint32_t prop_offset;
+	uint32_t prop_count;
+	uint32_t words;			/* 64 bit words per bitset */
+};
+
+struct db_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;			/* devices */
+	uint32_t abs_count;		/* entries of the absinfo table */
+	uint32_t strings_size;
+	struct db_layout layout;
+	uint64_t devices_start;		/* file offsets of the sections */
+	uint64_t bits_start;
+	uint64_t abs_start;
+	uint64_t strings_start;
+};
+
+struct db_device {
+	uint32_t path;			/* string table offsets */
+	uint32_t name;
+	uint32_t abs_first;		/* slice of the absinfo table */
+	uint32_t abs_count;
+};
+
+struct db_abs {
+	uint32_t code;
+	int32_t value[EVEMU_DB_ABS_RESOLUTION + 1];	/* by enum evemu_db_abs_field */
+};
+
+struct evemu_db {
+	void *map;
+	size_t size;
+	const struct db_header *header;
+	const struct db_device *devices;
+	const uint64_t *bits;
+	const struct db_abs *abs;
+	const char *strings;
+};
+
+struct abs_range {
+	uint32_t code;
+	enum evemu_db_abs_field field;
+	int32_t min, max;
+};
+
+struct evemu_db_query {
+	struct db_layout layout;
+	struct abs_range *ranges;
+	size_t nranges;
+	uint64_t *want;			/* bits a device must have */
+	uint64_t *deny;			/* bits a device must not have */
+};
+
+static void db_layout_init(struct db_layout *layout)
+{
+	unsigned int type, nbits = EV_CNT;
+
+	memset(layout, 0, sizeof(*layout));
+
+	/* EV_SYN codes are never interesting, its place holds the types */
+	layout->count[EV_SYN] = EV_CNT;
+	layout->prop_offset = nbits;
+	layout->prop_count = DB_PROP_COUNT;
+	nbits += layout->prop_count;
+
+	for (type = 1; type < EV_CNT; type++) {
+		int max = libevdev_event_type_get_max(type);
+
+		layout->offset[type] = nbits;
+		layout->count[type] = max < 0 ? 0 : max + 1;
+		nbits += layout->count[type];
+	}
+
+	layout->words = (nbits + DB_WORD_BITS - 1) / DB_WORD_BITS;
+}
+
+static void set_bit(uint64_t *bits, unsigned int bit)
+{
+	bits[bit / DB_WORD_BITS] |= 1ULL << (bit % DB_WORD_BITS);
+}
+
+/* one parsed file, filled by the worker threads */
+struct db_entry {
+	char *path;
+	char *name;
+	struct db_abs *abs;
+	unsigned int abs_count;
+	int valid;
+};
+
+struct db_build {
+	struct evemu_context *ctx;	/* of the thread that builds */
+	const struct db_layout *layout;
+	int dirfd;
+	struct dirent **files;
+	struct db_entry *entries;
+	uint64_t *bits;			/* one bitset per file */
+	int count;
+
+	pthread_mutex_t lock;
+	int next;			/* next file to parse */
+};
+
+static char *read_file(int dirfd, const char *path, size_t *size)
+{
+	struct stat st;
+	char *buf = NULL;
+	size_t len = 0;
+	int fd;
+
+	fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		buf = malloc(st.st_size + 1);
+
+	while (buf && len < (size_t)st.st_size) {
+		ssize_t n = read(fd, buf + len, st.st_size - len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+
+	*size = len;
+	return buf;
+}
+
+static int mask_bit(const unsigned char *mask, unsigned int bit)
+{
+	return !!(mask[bit / 8] & (1 << (bit % 8)));
+}
+
+static void fill_entry(const struct db_layout *layout, struct db_entry *entry,
+		       uint64_t *bits, const struct evemu_desc *desc)
+{
+	unsigned int type, code;
+
+	for (type = 0; type < DESC_TYPE_CNT; type++) {
+		const unsigned char *mask = type ? desc->codes[type] : desc->types;
+		unsigned int room = type ? DESC_CODE_CNT : DESC_TYPE_CNT;
+
+		for (code = 0; code < layout->count[type] && code < room; code++)
+			if (mask_bit(mask, code))
+				set_bit(bits, layout->offset[type] + code);
+	}
+
+	for (code = 0; code < layout->prop_count; code++)
+		if (mask_bit(desc->props, code))
+			set_bit(bits, layout->prop_offset + code);
+
+	entry->abs = calloc(ABS_CNT, sizeof(*entry->abs));
+	for (code = 0; entry->abs && code < layout->count[EV_ABS] &&
+		       code < DESC_ABS_CNT; code++) {
+		const struct input_absinfo *abs = &desc->abs[code];
+		struct db_abs *a;
+
+		if (!mask_bit(desc->codes[EV_ABS], code))
+			continue;
+		a = &entry->abs[entry->abs_count++];
+		a->code = code;
+		a->value[EVEMU_DB_ABS_MINIMUM] = abs->minimum;
+		a->value[EVEMU_DB_ABS_MAXIMUM] = abs->maximum;
+		a->value[EVEMU_DB_ABS_FUZZ] = abs->fuzz;
+		a->value[EVEMU_DB_ABS_FLAT] = abs->flat;
+		a->value[EVEMU_DB_ABS_RESOLUTION] = abs->resolution;
+	}
+
+	entry->name = strdup(desc->name);
+	entry->valid = entry->name && entry->abs;
+}
+
+static void *build_thread(void *data)
+{
+	struct db_build *b = data;
+	struct evemu_desc desc;
+
+	evemu_context_use(b->ctx);
+
+	for (;;) {
+		struct db_entry *entry;
+		char *buf;
+		size_t size;
+		int i;
+
+		pthread_mutex_lock(&b->lock);
+		i = b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if (i >= b->count)
+			break;
+
+		entry = &b->entries[i];
+		entry->path = b->files[i]->d_name;
+		buf = read_file(b->dirfd, entry->path, &size);
+		if (!buf)
+			continue;
+
+		/* no device needed, only what the description says */
+		if (evemu_desc_read_buffer(&desc, buf, size) > 0)
+			fill_entry(b->layout, entry,
+				   &b->bits[(size_t)i * b->layout->words], &desc);
+		else
+			evemu_log(b->ctx, EVEMU_LOG_WARNING,
+				  "Skipping %s, not a device description\n",
+				  entry->path);
+		free(buf);
+	}
+
+	return NULL;
+}
+
+static int visible_file(const struct dirent *d)
+{
+	return d->d_name[0] != '.' &&
+	       (d->d_type == DT_REG || d->d_type == DT_LNK ||
+		d->d_type == DT_UNKNOWN);
+}
+
+static size_t align8(size_t n)
+{
+	return (n + 7) & ~(size_t)7;
+}
+
+static int write_index(const char *path, const struct db_build *b)
+{
+	const struct db_layout *layout = b->layout;
+	struct db_header header;
+	struct db_device *devices;
+	char *tmp;
+	FILE *fp;
+	uint32_t strings = 0, abs = 0;
+	int i, n = 0, rc = 0;
+	static const char pad[8];
+
+	devices = calloc(b->count ? b->count : 1, sizeof(*devices));
+	if (!devices)
+		return -ENOMEM;
+
+	for (i = 0; i < b->count; i++) {
+		const struct db_entry *e = &b->entries[i];
+
+		if (!e->valid)
+			continue;
+		devices[n].path = strings;
+		strings += strlen(e->path) + 1;
+		devices[n].name = strings;
+		strings += strlen(e->name) + 1;
+		devices[n].abs_first = abs;
+		devices[n].abs_count = e->abs_count;
+		abs += e->abs_count;
+		n++;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DB_MAGIC, sizeof(DB_MAGIC));
+	header.version = DB_VERSION;
+	header.count = n;
+	header.abs_count = abs;
+	header.strings_size = strings;
+	header.layout = *layout;
+	header.devices_start = align8(sizeof(header));
+	header.bits_start = align8(header.devices_start + n * sizeof(*devices));
+	header.abs_start = header.bits_start + (size_t)n * layout->words * 8;
+	header.strings_start = align8(header.abs_start + abs * sizeof(struct db_abs));
+
+	/* readers never see a half written index */
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+		free(devices);
+		return -ENOMEM;
+	}
+	i = mkstemp(tmp);
+	if (i < 0 || !(fp = fdopen(i, "w"))) {
+		rc = -errno;
+		if (i >= 0)
+			close(i);
+		goto out;
+	}
+
+	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(pad, header.devices_start - sizeof(header), 1, fp);
+	fwrite(devices, sizeof(*devices), n, fp);
+	fwrite(pad, header.bits_start - header.devices_start - n * sizeof(*devices), 1, fp);
+	for (i = 0; i < b->count; i++)
+		if (b->entries[i].valid)
+			fwrite(&b->bits[(size_t)i * layout->words], 8, layout->words, fp);
+	for (i = 0; i < b->count; i++)
+		if (b->entries[i].valid)
+			fwrite(b->entries[i].abs, sizeof(struct db_abs),
+			       b->entries[i].abs_count, fp);
+	fwrite(pad, header.strings_start - header.abs_start - abs * sizeof(struct db_abs), 1, fp);
+	for (i = 0; i < b->count; i++) {
+		const struct db_entry *e = &b->entries[i];
+
+		if (!e->valid)
+			continue;
+		fwrite(e->path, strlen(e->path) + 1, 1, fp);
+		fwrite(e->name, strlen(e->name) + 1, 1, fp);
+	}
+
+	if (ferror(fp))
+		rc = -EIO;
+	if (fclose(fp) && rc == 0)
+		rc = -errno;
+	if (rc == 0 && (chmod(tmp, 0644) < 0 || rename(tmp, path) < 0))
+		rc = -errno;
+	if (rc < 0)
+		unlink(tmp);
+	else
+		rc = n;
+
+out:
+	free(tmp);
+	free(devices);
+	return rc;
+}
+
+int evemu_db_build(const char *dir, const char *path, int threads)
+{
+	struct db_layout layout;
+	struct db_build b;
+	pthread_t *tids;
+	int i, started = 0, rc;
+
+	memset(&b, 0, sizeof(b));
+	db_layout_init(&layout);
+	b.ctx = current_context();
+	b.layout = &layout;
+
+	b.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (b.dirfd < 0)
+		return -errno;
+
+	/* sorted, so the same directory always gives the same index */
+	b.count = scandir(dir, &b.files, visible_file, alphasort);
+	if (b.count < 0) {
+		rc = -errno;
+		close(b.dirfd);
+		return rc;
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > b.count)
+		threads = b.count;
+	if (threads < 1)
+		threads = 1;
+
+	b.entries = calloc(b.count ? b.count : 1, sizeof(*b.entries));
+	b.bits = calloc(b.count ? (size_t)b.count * layout.words : 1, 8);
+	tids = calloc(threads, sizeof(*tids));
+	if (!b.entries || !b.bits || !tids) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_init(&b.lock, NULL);
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tids[i], NULL, build_thread, &b) == 0)
+			started++;
+	/* with no thread at all, parse everything ourselves */
+	if (started == 0)
+		build_thread(&b);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&b.lock);
+
+	rc = write_index(path, &b);
+
+out:
+	for (i = 0; b.entries && i < b.count; i++) {
+		free(b.entries[i].name);
+		free(b.entries[i].abs);
+	}
+	for (i = 0; i < b.count; i++)
+		free(b.files[i]);
+	free(b.files);
+	free(b.entries);
+	free(b.bits);
+	free(tids);
+	close(b.dirfd);
+	return rc;
+}
+
+/* every string offset and absinfo slice stays inside its section */
+static int db_devices_valid(const struct evemu_db *db)
+{
+	const struct db_header *h = db->header;
+	const struct db_device *devices;
+	uint32_t i;
+
+	devices = (const void *)((const char *)db->map + h->devices_start);
+	for (i = 0; i < h->count; i++) {
+		const struct db_device *d = &devices[i];
+
+		if (d->path >= h->strings_size || d->name >= h->strings_size ||
+		    (uint64_t)d->abs_first + d->abs_count > h->abs_count)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int db_valid(const struct evemu_db *db)
+{
+	const struct db_header *h = db->header;
+	const char *strings;
+	struct db_layout layout;
+	uint64_t bits_size;
+
+	if (db->size < sizeof(*h) || memcmp(h->magic, DB_MAGIC, sizeof(DB_MAGIC)) ||
+	    h->version != DB_VERSION)
+		return 0;
+
+	/* the bitsets are only meaningful to a library with the same codes */
+	db_layout_init(&layout);
+	if (memcmp(&layout, &h->layout, sizeof(layout)))
+		return 0;
+
+	/* the sections are in order, so no size below can wrap around */
+	if (h->devices_start % 8 != 0 || h->bits_start % 8 != 0 ||
+	    h->abs_start % 4 != 0 ||
+	    h->devices_start < sizeof(*h) ||
+	    h->bits_start < h->devices_start ||
+	    h->abs_start < h->bits_start ||
+	    h->strings_start < h->abs_start ||
+	    h->strings_start > db->size)
+		return 0;
+
+	bits_size = (uint64_t)h->count * layout.words * 8;
+	if (h->count > (h->bits_start - h->devices_start) / sizeof(struct db_device) ||
+	    bits_size > h->abs_start - h->bits_start ||
+	    h->abs_count > (h->strings_start - h->abs_start) / sizeof(struct db_abs) ||
+	    h->strings_size > db->size - h->strings_start)
+		return 0;
+
+	/* so the last string is terminated too */
+	strings = (const char *)db->map + h->strings_start;
+	if (h->strings_size > 0 && strings[h->strings_size - 1] != '\0')
+		return 0;
+
+	return db_devices_valid(db);
+}
+
+struct evemu_db *evemu_db_open(const char *path)
+{
+	struct evemu_db *db;
+	struct stat st;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	db = calloc(1, sizeof(*db));
+	if (!db || fstat(fd, &st) < 0)
+		goto fail;
+
+	db->size = st.st_size;
+	db->map = mmap(NULL, db->size ? db->size : 1, PROT_READ, MAP_SHARED, fd, 0);
+	if (db->map == MAP_FAILED) {
+		db->map = NULL;
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	db->header = db->map;
+	if (!db_valid(db)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	db->devices = (const void *)((const char *)db->map + db->header->devices_start);
+	db->bits = (const void *)((const char *)db->map + db->header->bits_start);
+	db->abs = (const void *)((const char *)db->map + db->header->abs_start);
+	db->strings = (const char *)db->map + db->header->strings_start;
+
+	return db;
+
+fail:
+	err = errno;
+	if (fd >= 0)
+		close(fd);
+	evemu_db_close(db);
+	errno = err;
+	return NULL;
+}
+
+void evemu_db_close(struct evemu_db *db)
+{
+	if (!db)
+		return;
+	if (db->map)
+		munmap(db->map, db->size ? db->size : 1);
+	free(db);
+}
+
+unsigned int evemu_db_get_count(const struct evemu_db *db)
+{
+	return db->header->count;
+}
+
+const char *evemu_db_get_path(const struct evemu_db *db, unsigned int index)
+{
+	if (index >= db->header->count)
+		return NULL;
+	return db->strings + db->devices[index].path;
+}
+
+const char *evemu_db_get_name(const struct evemu_db *db, unsigned int index)
+{
+	if (index >= db->header->count)
+		return NULL;
+	return db->strings + db->devices[index].name;
+}
+
+struct evemu_db_query *evemu_db_query_new(void)
+{
+	struct evemu_db_query *q = calloc(1, sizeof(*q));
+
+	if (!q)
+		return NULL;
+
+	db_layout_init(&q->layout);
+	q->want = calloc(q->layout.words, 8);
+	q->deny = calloc(q->layout.words, 8);
+	if (!q->want || !q->deny) {
+		evemu_db_query_delete(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+void evemu_db_query_delete(struct evemu_db_query *q)
+{
+	if (!q)
+		return;
+	free(q->want);
+	free(q->deny);
+	free(q->ranges);
+	free(q);
+}
+
+static void query_set(struct evemu_db_query *q, unsigned int bit, int present)
+{
+	uint64_t mask = 1ULL << (bit % DB_WORD_BITS);
+
+	if (present) {
+		q->want[bit / DB_WORD_BITS] |= mask;
+		q->deny[bit / DB_WORD_BITS] &= ~mask;
+	} else {
+		q->deny[bit / DB_WORD_BITS] |= mask;
+		q->want[bit / DB_WORD_BITS] &= ~mask;
+	}
+}
+
+int evemu_db_query_require_prop(struct evemu_db_query *q, unsigned int prop,
+				int present)
+{
+	if (prop >= q->layout.prop_count)
+		return -EINVAL;
+
+	query_set(q, q->layout.prop_offset + prop, present);
+	return 0;
+}
+
+int evemu_db_query_require_event(struct evemu_db_query *q, unsigned int type,
+				 int code, int present)
+{
+	if (type == EV_SYN || type >= EV_CNT ||
+	    code >= (int)q->layout.count[type])
+		return -EINVAL;
+
+	if (code < 0)
+		query_set(q, type, present);
+	else
+		query_set(q, q->layout.offset[type] + code, present);
+	return 0;
+}
+
+int evemu_db_query_require_abs(struct evemu_db_query *q, unsigned int code,
+			       enum evemu_db_abs_field field,
+			       int32_t min, int32_t max)
+{
+	struct abs_range *ranges;
+
+	if (code >= q->layout.count[EV_ABS] || field > EVEMU_DB_ABS_RANGE)
+		return -EINVAL;
+
+	ranges = realloc(q->ranges, (q->nranges + 1) * sizeof(*ranges));
+	if (!ranges)
+		return -ENOMEM;
+	q->ranges = ranges;
+	q->ranges[q->nranges].code = code;
+	q->ranges[q->nranges].field = field;
+	q->ranges[q->nranges].min = min;
+	q->ranges[q->nranges].max = max;
+	q->nranges++;
+
+	/* an axis the device lacks has no range to match */
+	query_set(q, EV_ABS, 1);
+	query_set(q, q->layout.offset[EV_ABS] + code, 1);
+	return 0;
+}
+
+static int abs_matches(const struct evemu_db *db, const struct db_device *d,
+		       const struct evemu_db_query *q)
+{
+	size_t i, j;
+
+	for (i = 0; i < q->nranges; i++) {
+		const struct abs_range *r = &q->ranges[i];
+		const struct db_abs *a = NULL;
+		int64_t value;
+
+		for (j = 0; j < d->abs_count; j++) {
+			if (db->abs[d->abs_first + j].code == r->code) {
+				a = &db->abs[d->abs_first + j];
+				break;
+			}
+		}
+		if (!a)
+			return 0;
+
+		if (r->field == EVEMU_DB_ABS_RANGE)
+			value = (int64_t)a->value[EVEMU_DB_ABS_MAXIMUM] -
+				a->value[EVEMU_DB_ABS_MINIMUM] + 1;
+		else
+			value = a->value[r->field];
+		if (value < r->min || value > r->max)
+			return 0;
+	}
+
+	return 1;
+}
+
+ssize_t evemu_db_match(const struct evemu_db *db,
+		       const struct evemu_db_query *q, unsigned int **matches)
+{
+	const unsigned int words = db->header->layout.words;
+	unsigned int count = db->header->count;
+	unsigned int first = words, last = 0;
+	unsigned int *result;
+	unsigned int i, w;
+	size_t n = 0;
+
+	result = malloc((count ? count : 1) * sizeof(*result));
+	if (!result)
+		return -ENOMEM;
+
+	/* only the words the query touches are compared */
+	for (w = 0; w < words; w++) {
+		if (q->want[w] | q->deny[w]) {
+			if (first == words)
+				first = w;
+			last = w + 1;
+		}
+	}
+	if (first == words)
+		first = last = 0;
+
+	for (i = 0; i < count; i++) {
+		const uint64_t *bits = &db->bits[(size_t)i * words];
+		uint64_t miss = 0;
+
+		/* no branches in here, the compiler vectorizes the loop */
+		for (w = first; w < last; w++)
+			miss |= (q->want[w] & ~bits[w]) | (q->deny[w] & bits[w]);
+
+		if (miss == 0 &&
+		    (q->nranges == 0 || abs_matches(db, &db->devices[i], q)))
+			result[n++] = i;
+	}
+
+	*matches = result;
+	return n;
+}
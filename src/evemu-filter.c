@@ -0,0 +1,198 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+
+/*
+ * Event code filters. All codes of all types share one flat bitmap, each
+ * type starts at its own offset, so a lookup is two array reads and a
+ * bit test.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+static void filter_set_bit(struct evemu_filter *filter, unsigned int type,
+			   unsigned int code, int accept)
+{
+	unsigned int bit = filter->offset[type] + code;
+	unsigned long mask = 1UL << (bit % FILTER_LONG_BITS);
+
+	if (accept)
+		filter->bits[bit / FILTER_LONG_BITS] |= mask;
+	else
+		filter->bits[bit / FILTER_LONG_BITS] &= ~mask;
+}
+
+struct evemu_filter *evemu_filter_new(const struct evemu_device *dev)
+{
+	struct evemu_filter filter;
+	struct evemu_filter *f;
+	unsigned int type, code, nbits = 0;
+
+	for (type = 0; type < EV_CNT; type++) {
+		int max = libevdev_event_type_get_max(type);
+
+		filter.offset[type] = nbits;
+		filter.count[type] = max < 0 ? 0 : max + 1;
+		nbits += filter.count[type];
+	}
+
+	f = calloc(1, sizeof(*f) + (nbits + FILTER_LONG_BITS - 1) /
+		   FILTER_LONG_BITS * sizeof(unsigned long));
+	if (!f)
+		return NULL;
+	*f = filter;
+
+	for (type = 0; type < EV_CNT; type++) {
+		for (code = 0; code < f->count[type]; code++) {
+			if (!dev || type == EV_SYN ||
+			    evemu_has_event(dev, type, code))
+				filter_set_bit(f, type, code, 1);
+		}
+	}
+
+	return f;
+}
+
+struct evemu_filter *evemu_filter_new_from_fd(int fd)
+{
+	struct evemu_filter *filter = NULL;
+	struct evemu_device *dev;
+
+	dev = evemu_new(NULL);
+	if (dev) {
+		if (evemu_extract(dev, fd) == 0)
+			filter = evemu_filter_new(dev);
+		evemu_delete(dev);
+	}
+
+	return filter;
+}
+
+void evemu_filter_delete(struct evemu_filter *filter)
+{
+	free(filter);
+}
+
+int evemu_filter_set(struct evemu_filter *filter, unsigned int type,
+		     int code, int accept)
+{
+	if (type >= EV_CNT || code < -1 || code >= (int)filter->count[type] ||
+	    filter->count[type] == 0)
+		return -EINVAL;
+
+	if (code >= 0) {
+		filter_set_bit(filter, type, code, accept);
+		return 0;
+	}
+
+	for (code = 0; code < (int)filter->count[type]; code++)
+		filter_set_bit(filter, type, code, accept);
+	return 0;
+}
+
+#ifdef EVIOCSMASK
+/* the types EVIOCSMASK takes a code mask for, see evdev_get_mask_cnt() */
+static const unsigned int maskable_types[] = {
+	EV_KEY, EV_REL, EV_ABS, EV_MSC, EV_SW, EV_LED, EV_SND, EV_FF,
+};
+
+static int set_mask(int fd, unsigned int type, unsigned long *codes,
+		    unsigned int count)
+{
+	struct input_mask mask;
+
+	mask.type = type;
+	mask.codes_size = (count + FILTER_LONG_BITS - 1) / FILTER_LONG_BITS *
+			  sizeof(unsigned long);
+	mask.codes_ptr = (uintptr_t)codes;
+
+	return ioctl(fd, EVIOCSMASK, &mask) < 0 ? -errno : 0;
+}
+#endif
+
+int evemu_filter_apply(const struct evemu_filter *filter, int fd)
+{
+#ifdef EVIOCSMASK
+	unsigned long types[(EV_CNT + FILTER_LONG_BITS - 1) / FILTER_LONG_BITS];
+	unsigned long *codes;
+	unsigned int type, code, i, max = 0;
+	int ret = 0;
+
+	for (type = 0; type < EV_CNT; type++)
+		if (filter->count[type] > max)
+			max = filter->count[type];
+	codes = malloc((max + FILTER_LONG_BITS - 1) / FILTER_LONG_BITS *
+		       sizeof(unsigned long));
+	if (!codes)
+		return -ENOMEM;
+
+	for (i = 0; i < sizeof(maskable_types) / sizeof(maskable_types[0]); i++) {
+		unsigned int count;
+		int all = 1;
+
+		type = maskable_types[i];
+		count = filter->count[type];
+		if (count == 0)
+			continue;
+
+		memset(codes, 0, (count + FILTER_LONG_BITS - 1) /
+		       FILTER_LONG_BITS * sizeof(unsigned long));
+		for (code = 0; code < count; code++) {
+			if (filter_accepts(filter, type, code))
+				codes[code / FILTER_LONG_BITS] |=
+					1UL << (code % FILTER_LONG_BITS);
+			else
+				all = 0;
+		}
+		if (!all && (ret = set_mask(fd, type, codes, count)) < 0)
+			goto out;
+	}
+
+	/* a type goes if none of its codes are accepted, EV_SYN always stays */
+	memset(types, 0, sizeof(types));
+	for (type = 0; type < EV_CNT; type++) {
+		int any = type == EV_SYN || filter->count[type] == 0;
+
+		for (code = 0; !any && code < filter->count[type]; code++)
+			any = filter_accepts(filter, type, code);
+		if (any)
+			types[type / FILTER_LONG_BITS] |= 1UL << (type % FILTER_LONG_BITS);
+	}
+	ret = set_mask(fd, EV_SYN, types, EV_CNT);
+
+out:
+	free(codes);
+	return ret;
+#else
+	(void)filter;
+	(void)fd;
+	return -ENOSYS;
+#endif
+}
+
+int evemu_filter_accepts(const struct evemu_filter *filter,
+			 unsigned int type, unsigned int code)
+{
+	return filter_accepts(filter, type, code);
+}
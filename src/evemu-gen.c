@@ -0,0 +1,304 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Synthetic gesture streams. The generator reads the axis ranges and the
+ * slot count from the device description once, then produces one frame
+ * per call without allocating. Multitouch devices with ABS_MT_SLOT get
+ * protocol B streams, other absolute devices a single-touch stream.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_FINGERS 10
+
+struct axis {
+	int min, max;
+};
+
+struct evemu_generator {
+	enum evemu_gesture gesture;
+	int fingers;
+	int frames;		/* frames per gesture, including down and up */
+	long interval;		/* usec between two frames */
+
+	int frame;		/* current frame within the gesture */
+	long time;		/* usec timestamp of the current frame */
+	int tracking_id;
+	int current_slot;
+	uint32_t seed;
+
+	int slots;		/* 0 if the device has no ABS_MT_SLOT */
+	int has_abs_x;
+	int has_touch;
+	int has_major;
+	int has_pressure;
+	int has_mt_pressure;
+	int has_tool[5];
+	struct axis x, y, mt_x, mt_y, major, pressure, mt_pressure, tid;
+
+	double dir_x[MAX_FINGERS], dir_y[MAX_FINGERS];
+};
+
+static const unsigned int tool_codes[] = {
+	BTN_TOOL_FINGER,
+	BTN_TOOL_DOUBLETAP,
+	BTN_TOOL_TRIPLETAP,
+	BTN_TOOL_QUADTAP,
+	BTN_TOOL_QUINTTAP,
+};
+
+static void get_axis(const struct evemu_device *dev, int code, struct axis *axis)
+{
+	axis->min = evemu_get_abs_minimum(dev, code);
+	axis->max = evemu_get_abs_maximum(dev, code);
+}
+
+struct evemu_generator *evemu_generator_new(const struct evemu_device *dev,
+					    enum evemu_gesture gesture,
+					    int fingers, int rate, int frames)
+{
+	struct evemu_generator *gen;
+	int i;
+
+	if (rate <= 0 || gesture < EVEMU_GESTURE_TAP || gesture > EVEMU_GESTURE_PALM)
+		return NULL;
+
+	if (!evemu_has_event(dev, EV_ABS, ABS_X) &&
+	    !evemu_has_event(dev, EV_ABS, ABS_MT_POSITION_X))
+		return NULL;
+
+	gen = calloc(1, sizeof(*gen));
+	if (!gen)
+		return NULL;
+
+	gen->gesture = gesture;
+	gen->frames = frames < 2 ? 2 : frames;
+	gen->interval = 1000000L / rate;
+	gen->current_slot = -1;
+	gen->seed = 0x2545f491;
+
+	gen->has_abs_x = evemu_has_event(dev, EV_ABS, ABS_X);
+	gen->has_touch = evemu_has_event(dev, EV_KEY, BTN_TOUCH);
+	gen->has_pressure = evemu_has_event(dev, EV_ABS, ABS_PRESSURE);
+	get_axis(dev, ABS_X, &gen->x);
+	get_axis(dev, ABS_Y, &gen->y);
+	get_axis(dev, ABS_PRESSURE, &gen->pressure);
+	for (i = 0; i < 5; i++)
+		gen->has_tool[i] = evemu_has_event(dev, EV_KEY, tool_codes[i]);
+
+	if (evemu_has_event(dev, EV_ABS, ABS_MT_SLOT) &&
+	    evemu_has_event(dev, EV_ABS, ABS_MT_POSITION_X) &&
+	    evemu_has_event(dev, EV_ABS, ABS_MT_TRACKING_ID)) {
+		gen->slots = evemu_get_abs_maximum(dev, ABS_MT_SLOT) + 1;
+		gen->has_major = evemu_has_event(dev, EV_ABS, ABS_MT_TOUCH_MAJOR);
+		gen->has_mt_pressure = evemu_has_event(dev, EV_ABS, ABS_MT_PRESSURE);
+		get_axis(dev, ABS_MT_POSITION_X, &gen->mt_x);
+		get_axis(dev, ABS_MT_POSITION_Y, &gen->mt_y);
+		get_axis(dev, ABS_MT_TOUCH_MAJOR, &gen->major);
+		get_axis(dev, ABS_MT_PRESSURE, &gen->mt_pressure);
+		get_axis(dev, ABS_MT_TRACKING_ID, &gen->tid);
+		if (gen->tid.max <= gen->tid.min)
+			gen->tid.max = gen->tid.min + 65535;
+		if (!gen->has_abs_x) {
+			gen->x = gen->mt_x;
+			gen->y = gen->mt_y;
+		}
+	} else {
+		gen->mt_x = gen->x;
+		gen->mt_y = gen->y;
+	}
+
+	if (gesture == EVEMU_GESTURE_PALM || gen->slots == 0)
+		fingers = 1;
+	if (fingers > MAX_FINGERS)
+		fingers = MAX_FINGERS;
+	if (gen->slots && fingers > gen->slots)
+		fingers = gen->slots;
+	gen->fingers = fingers < 1 ? 1 : fingers;
+
+	/* pinch fingers sit on a circle, evenly spaced */
+	for (i = 0; i < gen->fingers; i++) {
+		double angle = 2 * M_PI * i / gen->fingers;
+		gen->dir_x[i] = cos(angle);
+		gen->dir_y[i] = sin(angle);
+	}
+
+	return gen;
+}
+
+void evemu_generator_delete(struct evemu_generator *gen)
+{
+	free(gen);
+}
+
+int evemu_generator_get_frames(const struct evemu_generator *gen)
+{
+	/* see the end of evemu_generator_next_frame() */
+	return gen->gesture == EVEMU_GESTURE_TAP ? 2 : gen->frames;
+}
+
+static int scale(const struct axis *axis, int num, int den)
+{
+	return axis->min + (int)((long)(axis->max - axis->min) * num / den);
+}
+
+/* xorshift, good enough for jitter and reentrant */
+static int jitter(struct evemu_generator *gen, const struct axis *axis)
+{
+	int range = (axis->max - axis->min) / 100 + 1;
+
+	gen->seed ^= gen->seed << 13;
+	gen->seed ^= gen->seed >> 17;
+	gen->seed ^= gen->seed << 5;
+	return (int)(gen->seed % (2 * range + 1)) - range;
+}
+
+/* position of finger i on the given axes, at progress frame/last */
+static void position(struct evemu_generator *gen, int i,
+		     const struct axis *ax, const struct axis *ay,
+		     int *x, int *y)
+{
+	int last = gen->frames - 1;
+	int frame = gen->frame;
+
+	switch (gen->gesture) {
+	case EVEMU_GESTURE_TAP:
+		*x = scale(ax, 1, 2);
+		*y = scale(ay, i + 1, gen->fingers + 1);
+		break;
+	case EVEMU_GESTURE_SWIPE:
+		*x = scale(ax, 20 * last + 60 * frame, 100 * last);
+		*y = scale(ay, i + 1, gen->fingers + 1);
+		break;
+	case EVEMU_GESTURE_PINCH: {
+		int w = ax->max - ax->min, h = ay->max - ay->min;
+		double r = (w < h ? w : h) * 0.4 * (1.0 - 0.75 * frame / last);
+
+		*x = scale(ax, 1, 2) + (int)(r * gen->dir_x[i]);
+		*y = scale(ay, 1, 2) + (int)(r * gen->dir_y[i]);
+		break;
+	}
+	case EVEMU_GESTURE_PALM:
+		*x = scale(ax, 1, 2) + jitter(gen, ax);
+		*y = scale(ay, 1, 2) + jitter(gen, ay);
+		break;
+	}
+
+	if (*x < ax->min) *x = ax->min;
+	if (*x > ax->max) *x = ax->max;
+	if (*y < ay->min) *y = ay->min;
+	if (*y > ay->max) *y = ay->max;
+}
+
+#define EMIT(type_, code_, value_) \
+	do { \
+		if (n >= max) \
+			return -ENOSPC; \
+		frame[n].time = stamp; \
+		frame[n].type = (type_); \
+		frame[n].code = (code_); \
+		frame[n].value = (value_); \
+		n++; \
+	} while (0)
+
+int evemu_generator_next_frame(struct evemu_generator *gen,
+			       struct input_event *frame, int max)
+{
+	struct timeval stamp;
+	int down = (gen->frame == 0);
+	int up = (gen->frame == gen->frames - 1);
+	int tool = gen->fingers <= 5 ? gen->fingers - 1 : 4;
+	int i, n = 0;
+
+	stamp.tv_sec = gen->time / 1000000;
+	stamp.tv_usec = gen->time % 1000000;
+
+	for (i = 0; gen->slots && i < gen->fingers; i++) {
+		int x, y;
+
+		if (gen->current_slot != i) {
+			EMIT(EV_ABS, ABS_MT_SLOT, i);
+			gen->current_slot = i;
+		}
+
+		if (up) {
+			EMIT(EV_ABS, ABS_MT_TRACKING_ID, -1);
+			continue;
+		}
+
+		if (down) {
+			EMIT(EV_ABS, ABS_MT_TRACKING_ID,
+			     gen->tid.min + gen->tracking_id);
+			gen->tracking_id = (gen->tracking_id + 1) %
+					   (gen->tid.max - gen->tid.min + 1);
+		}
+
+		position(gen, i, &gen->mt_x, &gen->mt_y, &x, &y);
+		EMIT(EV_ABS, ABS_MT_POSITION_X, x);
+		EMIT(EV_ABS, ABS_MT_POSITION_Y, y);
+
+		if (down && gen->has_major)
+			EMIT(EV_ABS, ABS_MT_TOUCH_MAJOR,
+			     gen->gesture == EVEMU_GESTURE_PALM ?
+				gen->major.max : scale(&gen->major, 1, 10));
+		if (down && gen->has_mt_pressure)
+			EMIT(EV_ABS, ABS_MT_PRESSURE,
+			     scale(&gen->mt_pressure, 1, 2));
+	}
+
+	if (down || up) {
+		if (gen->has_touch)
+			EMIT(EV_KEY, BTN_TOUCH, down);
+		if (gen->has_tool[tool])
+			EMIT(EV_KEY, tool_codes[tool], down);
+		if (gen->has_pressure)
+			EMIT(EV_ABS, ABS_PRESSURE,
+			     down ? scale(&gen->pressure, 1, 2) : 0);
+	}
+
+	if (gen->has_abs_x && !up) {
+		int x, y;
+
+		position(gen, 0, &gen->x, &gen->y, &x, &y);
+		EMIT(EV_ABS, ABS_X, x);
+		EMIT(EV_ABS, ABS_Y, y);
+	}
+
+	EMIT(EV_SYN, SYN_REPORT, 0);
+
+	if (up) {
+		/* leave one empty frame between two gestures */
+		gen->frame = 0;
+		gen->time += 2 * gen->interval;
+	} else if (gen->gesture == EVEMU_GESTURE_TAP) {
+		/* taps have no motion, skip straight to the release */
+		gen->frame = gen->frames - 1;
+		gen->time += (gen->frames - 1) * gen->interval;
+	} else {
+		gen->frame++;
+		gen->time += gen->interval;
+	}
+
+	return n;
+}
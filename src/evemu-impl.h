@@ -17,19 +17,133 @@
 #ifndef EVEMU_IMPL_H
 #define EVEMU_IMPL_H
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <evemu.h>
 #include <linux/uinput.h>
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * USDT probes of the "evemu" provider, for perf and bpftrace. Without
+ * sys/sdt.h at configure time they compile to nothing; with it each one is
+ * a single nop until a tracer attaches. Timestamps are passed as seconds
+ * and microseconds:
+ *
+ *   record_event(dev_id, sec, usec, type, code, value)
+ *   parse_event(sec, usec, type, code, value)
+ *   sleep_begin(usec), sleep_end(usec)
+ *   play_begin(fd, sec, usec, type, code, value), play_end(fd, ret)
+ *   device_create(name, ret), device_destroy(name)
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(evemu, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(evemu, name, a, b)
+#define PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(evemu, name, a, b, c, d, e)
+#define PROBE6(name, a, b, c, d, e, f) DTRACE_PROBE6(evemu, name, a, b, c, d, e, f)
+#else
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE5(name, a, b, c, d, e) do { } while (0)
+#define PROBE6(name, a, b, c, d, e, f) do { } while (0)
+#endif
 
 struct evemu_device {
 	unsigned int version;
 	struct libevdev *evdev;
 	struct libevdev_uinput *uidev;
-	/* we read in properties and bits 8 at a time, but the file format
-	 * has no hint which byte we're up to. So we count what we've read
-	 * already to know where the next one tacks onto */
-	int pbytes, mbytes[EV_CNT];
+	struct evemu_context *ctx;
+};
+
+struct evemu_filter {
+	unsigned int offset[EV_CNT];	/* bit of code 0 of each type */
+	unsigned int count[EV_CNT];	/* codes of each type, 0 if unknown */
+	unsigned long bits[];
+};
+
+#define FILTER_LONG_BITS (8 * sizeof(unsigned long))
+
+/* what struct evemu_desc has room for, whatever the kernel headers say */
+#define DESC_TYPE_CNT (EV_CNT < EVEMU_DESC_TYPE_COUNT ? EV_CNT : EVEMU_DESC_TYPE_COUNT)
+#define DESC_CODE_CNT (KEY_CNT < EVEMU_DESC_CODE_COUNT ? KEY_CNT : EVEMU_DESC_CODE_COUNT)
+#define DESC_ABS_CNT (ABS_CNT < EVEMU_DESC_ABS_COUNT ? ABS_CNT : EVEMU_DESC_ABS_COUNT)
+
+static inline int filter_accepts(const struct evemu_filter *filter,
+				 unsigned int type, unsigned int code)
+{
+	unsigned int bit;
+
+	if (type >= EV_CNT || code >= filter->count[type])
+		return 0;
+	bit = filter->offset[type] + code;
+	return !!(filter->bits[bit / FILTER_LONG_BITS] &
+		  (1UL << (bit % FILTER_LONG_BITS)));
+}
+
+struct ratelimit {
+	uint64_t interval_ns;	/* 0: one burst for the lifetime */
+	unsigned int burst;
+	uint64_t begin;		/* CLOCK_MONOTONIC ns, start of the interval */
+	unsigned int num;	/* messages so far in the interval */
 };
 
+struct evemu_context {
+	evemu_log_func_t log_func;
+	void *log_data;
+	enum evemu_log_priority log_priority;
+	struct ratelimit incompatible;
+	int timers;
+	struct evemu_stats stats;
+};
+
+/* see evemu-context.c */
+extern struct evemu_context evemu_default_context;
+extern __thread struct evemu_context *evemu_thread_context;
+
+static inline struct evemu_context *current_context(void)
+{
+	struct evemu_context *ctx = evemu_thread_context;
+
+	return ctx ? ctx : &evemu_default_context;
+}
+
+void evemu_log(struct evemu_context *ctx, enum evemu_log_priority priority,
+	       const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * ratelimit_test() - count a message against a rate limit
+ *
+ * Returns how many messages the current interval has seen, this one
+ * included, saturated at burst + 2. Lock free.
+ */
+unsigned int ratelimit_test(struct ratelimit *rl);
+
+#define STATS_ADD(ctx, field, n) \
+	__atomic_fetch_add(&(ctx)->stats.field, (n), __ATOMIC_RELAXED)
+
+/* 0 while the timers are off, so STATS_ELAPSED() skips the second read */
+static inline uint64_t stats_clock(struct evemu_context *ctx)
+{
+	struct timespec ts;
+
+	if (!__atomic_load_n(&ctx->timers, __ATOMIC_RELAXED))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* read() from a kernel device, counted in the stats */
+ssize_t read_device(struct evemu_context *ctx, int fd, void *buf, size_t size);
+
+#define STATS_ELAPSED(ctx, field, start) do { \
+	uint64_t _start = (start); \
+	if (_start) \
+		STATS_ADD(ctx, field, stats_clock(ctx) - _start); \
+} while (0)
+
 #endif
@@ -0,0 +1,111 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+
+/*
+ * Per-context counters of the record, play and parse paths. Counters are
+ * bumped with relaxed atomic adds, so recording and writer threads never
+ * take a lock for them; a snapshot is not one consistent instant, each
+ * field is only read atomically on its own.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <stdio.h>
+
+#define NFIELDS (sizeof(struct evemu_stats) / sizeof(uint64_t))
+
+void evemu_context_get_stats(struct evemu_context *ctx,
+			     struct evemu_stats *stats)
+{
+	const uint64_t *src;
+	uint64_t *dst = (uint64_t *)stats;
+	size_t i;
+
+	src = (const uint64_t *)&(ctx ? ctx : &evemu_default_context)->stats;
+	for (i = 0; i < NFIELDS; i++)
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+void evemu_context_reset_stats(struct evemu_context *ctx)
+{
+	uint64_t *counters;
+	size_t i;
+
+	counters = (uint64_t *)&(ctx ? ctx : &evemu_default_context)->stats;
+	for (i = 0; i < NFIELDS; i++)
+		__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+}
+
+void evemu_context_enable_timers(struct evemu_context *ctx, int enable)
+{
+	__atomic_store_n(&(ctx ? ctx : &evemu_default_context)->timers,
+			 !!enable, __ATOMIC_RELAXED);
+}
+
+void evemu_stats_snapshot(struct evemu_stats *stats)
+{
+	evemu_context_get_stats(NULL, stats);
+}
+
+void evemu_stats_reset(void)
+{
+	evemu_context_reset_stats(NULL);
+}
+
+void evemu_stats_enable_timers(int enable)
+{
+	evemu_context_enable_timers(NULL, enable);
+}
+
+static void print_rate(FILE *fp, const char *what, uint64_t count,
+		       const char *unit, uint64_t bytes, uint64_t ns)
+{
+	fprintf(fp, "  %-10s %12llu %s", what, (unsigned long long)count, unit);
+	if (bytes)
+		fprintf(fp, ", %llu bytes", (unsigned long long)bytes);
+	if (ns) {
+		fprintf(fp, ", %.3f ms", ns / 1e6);
+		if (count)
+			fprintf(fp, " (%.0f ns each)", (double)ns / count);
+	}
+	fprintf(fp, "\n");
+}
+
+void evemu_stats_print(FILE *fp, const struct evemu_stats *stats)
+{
+	fprintf(fp, "evemu statistics:\n");
+	fprintf(fp, "  devices    %12llu parsed, %llu written\n",
+		(unsigned long long)stats->devices_parsed,
+		(unsigned long long)stats->devices_written);
+	print_rate(fp, "parsed", stats->events_parsed, "events",
+		   stats->bytes_parsed, stats->parse_ns);
+	print_rate(fp, "formatted", stats->events_formatted, "events",
+		   stats->bytes_formatted, stats->format_ns);
+	print_rate(fp, "read", stats->events_read, "events", 0, 0);
+	print_rate(fp, "read()", stats->read_calls, "calls", 0, stats->read_ns);
+	print_rate(fp, "played", stats->events_played, "events", 0, 0);
+	print_rate(fp, "write()", stats->write_calls, "calls", 0, stats->write_ns);
+	print_rate(fp, "sleeps", stats->sleeps, "waits", 0, stats->sleep_ns);
+	fprintf(fp, "  %-10s %12llu events\n", "unsupported",
+		(unsigned long long)stats->incompatible_events);
+	fprintf(fp, "  %-10s %12llu events\n", "dropped",
+		(unsigned long long)stats->dropped_events);
+	fprintf(fp, "  %-10s %12llu events\n", "filtered",
+		(unsigned long long)stats->filtered_events);
+}
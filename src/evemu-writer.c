@@ -0,0 +1,307 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version 3
+ * as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranties of
+ * MERCHANTABILITY, SATISFACTORY QUALITY, or FITNESS FOR A PARTICULAR
+ * PURPOSE.  See the GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Asynchronous event writer. The recording thread copies raw events into
+ * a ring and returns; a background thread formats and writes them. The
+ * ring is single producer, single consumer: the producer owns the free
+ * slots and the consumer the filled ones, the mutex only protects the two
+ * indices, never the copying or the formatting.
+ */
+
+#define _GNU_SOURCE
+#include "evemu-impl.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define READ_BATCH 64
+
+struct writer_event {
+	struct input_event ev;
+	int id;
+};
+
+struct evemu_writer {
+	struct evemu_context *ctx;	/* of the thread that created it */
+	FILE *fp;
+	int with_id;
+	long offset;		/* usec of the first event, -1 before it */
+
+	struct writer_event *events;
+	size_t capacity;
+	size_t head;		/* total events pushed, producer side */
+	size_t tail;		/* total events written, consumer side */
+	int stop;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	struct evemu_writer_stats stats;
+};
+
+static void write_one(struct evemu_writer *w, struct writer_event *e)
+{
+	long time = e->ev.time.tv_sec * 1000000L + e->ev.time.tv_usec;
+
+	if (w->offset < 0)
+		w->offset = time;
+	time -= w->offset;
+	e->ev.time.tv_sec = time / 1000000;
+	e->ev.time.tv_usec = time % 1000000;
+
+	if (w->with_id)
+		evemu_write_event_with_id(w->fp, &e->ev, e->id);
+	else
+		evemu_write_event(w->fp, &e->ev);
+}
+
+static void *writer_thread(void *data)
+{
+	struct evemu_writer *w = data;
+	size_t head, tail;
+
+	evemu_context_use(w->ctx);
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->head == w->tail && !w->stop)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (w->head == w->tail)
+			break;
+
+		head = w->head;
+		tail = w->tail;
+		pthread_mutex_unlock(&w->lock);
+
+		for (; tail != head; tail++)
+			write_one(w, &w->events[tail % w->capacity]);
+		fflush(w->fp);
+
+		pthread_mutex_lock(&w->lock);
+		w->tail = tail;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+struct evemu_writer *evemu_writer_new(FILE *fp, size_t capacity, int with_id)
+{
+	struct sched_param param = { 0 };
+	struct evemu_writer *w;
+	pthread_attr_t attr;
+	int rc;
+
+	if (capacity == 0)
+		capacity = EVEMU_WRITER_DEFAULT_CAPACITY;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->events = malloc(capacity * sizeof(*w->events));
+	if (!w->events) {
+		free(w);
+		return NULL;
+	}
+	/* fault the ring in before recording starts */
+	memset(w->events, 0, capacity * sizeof(*w->events));
+
+	w->ctx = current_context();
+	w->fp = fp;
+	w->with_id = with_id;
+	w->offset = -1;
+	w->capacity = capacity;
+	w->stats.capacity = capacity;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	/* never compete with a real-time reader, whatever its policy */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+	pthread_attr_setschedparam(&attr, &param);
+	rc = pthread_create(&w->thread, &attr, writer_thread, w);
+	pthread_attr_destroy(&attr);
+	if (rc != 0) {
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		free(w->events);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+int evemu_writer_push(struct evemu_writer *w, const struct input_event *ev,
+		      int count, int dev_id)
+{
+	size_t head, occupancy;
+	int i;
+
+	if (count <= 0)
+		return 0;
+
+	/* the counters are read from other threads too, under the lock */
+	pthread_mutex_lock(&w->lock);
+	head = w->head;
+	occupancy = head - w->tail;
+	w->stats.batches++;
+	if (occupancy + count > w->capacity) {
+		w->stats.dropped_batches++;
+		w->stats.dropped_events += count;
+		pthread_mutex_unlock(&w->lock);
+		STATS_ADD(w->ctx, dropped_events, count);
+		return -ENOSPC;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	/* slots between head and tail + capacity belong to us */
+	for (i = 0; i < count; i++) {
+		struct writer_event *e = &w->events[(head + i) % w->capacity];
+
+		e->ev = ev[i];
+		e->id = dev_id;
+	}
+
+	occupancy += count;
+
+	pthread_mutex_lock(&w->lock);
+	w->stats.events += count;
+	if (occupancy > w->stats.max_occupancy)
+		w->stats.max_occupancy = occupancy;
+	w->head = head + count;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+
+	return 0;
+}
+
+void evemu_writer_get_stats(struct evemu_writer *w,
+			    struct evemu_writer_stats *stats)
+{
+	pthread_mutex_lock(&w->lock);
+	*stats = w->stats;
+	stats->occupancy = w->head - w->tail;
+	pthread_mutex_unlock(&w->lock);
+}
+
+void evemu_writer_delete(struct evemu_writer *w)
+{
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = 1;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	free(w->events);
+	free(w);
+}
+
+/* drops the events the filter rejects, returns the number left */
+static int filter_batch(struct evemu_writer *w, const struct evemu_filter *filter,
+			struct input_event *batch, int count)
+{
+	int i, n = 0;
+
+	for (i = 0; i < count; i++) {
+		if (filter_accepts(filter, batch[i].type, batch[i].code))
+			batch[n++] = batch[i];
+	}
+	STATS_ADD(w->ctx, filtered_events, count - n);
+
+	return n;
+}
+
+int evemu_record_all_async(FILE *fp, int *fds, int count, int ms,
+			   struct evemu_writer_stats *stats)
+{
+	return evemu_record_all_async_filtered(fp, fds, count, ms, NULL, stats);
+}
+
+int evemu_record_all_async_filtered(FILE *fp, int *fds, int count, int ms,
+				    const struct evemu_filter *filter,
+				    struct evemu_writer_stats *stats)
+{
+	struct input_event batch[READ_BATCH];
+	struct evemu_writer *w;
+	struct pollfd *pfds;
+	int ret = 0;
+	int i;
+
+	pfds = calloc(count, sizeof(*pfds));
+	if (!pfds)
+		return -ENOMEM;
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		if (filter)
+			evemu_filter_apply(filter, fds[i]);
+	}
+
+	fprintf(fp, "[Events]\n");
+	fflush(fp);
+
+	w = evemu_writer_new(fp, 0, 1);
+	if (!w) {
+		free(pfds);
+		return -ENOMEM;
+	}
+
+	while (ret == 0 && poll(pfds, count, ms) > 0) {
+		for (i = 0; i < count; i++) {
+			ssize_t n;
+
+			if (!(pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+
+			n = read_device(w->ctx, fds[i], batch, sizeof(batch));
+			if (n < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (n <= 0) {
+				ret = n ? -errno : -ENODEV;
+				break;
+			}
+
+			n /= sizeof(batch[0]);
+			if (filter)
+				n = filter_batch(w, filter, batch, n);
+
+			/* a full ring drops the batch, the reader never waits */
+			evemu_writer_push(w, batch, n, i);
+		}
+	}
+
+	if (stats)
+		evemu_writer_get_stats(w, stats);
+	evemu_writer_delete(w);
+	free(pfds);
+	return ret;
+}
@@ -50,8 +50,10 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <poll.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <time.h>
 
 #include "version.h"
 
@@ -62,31 +64,6 @@
 
 #define SYSCALL(call) while (((call) == -1) && (errno == EINTR))
 
-enum error_level {
-	INFO,
-	WARNING,
-	FATAL,
-};
-
-static int error(enum error_level level, const char *format, ...)
-{
-	va_list args;
-	const char *strlevel = NULL;
-
-	switch (level) {
-		case INFO: strlevel = "INFO"; break;
-		case WARNING: strlevel = "WARNING"; break;
-		case FATAL: strlevel = "FATAL"; break;
-	}
-
-	fprintf(stderr, "%s: ", strlevel);
-	va_start(args, format);
-	vfprintf(stderr, format, args);
-	va_end(args);
-
-	return -1;
-}
-
 static int is_comment(char *line)
 {
 	return line && strlen(line) > 0 && line[0] == '#';
@@ -126,6 +103,7 @@ struct evemu_device *evemu_new(const char *name)
 			return NULL;
 		}
 		dev->version = EVEMU_VERSION;
+		dev->ctx = current_context();
 		evemu_set_name(dev, name);
 	}
 
@@ -140,6 +118,53 @@ void evemu_delete(struct evemu_device *dev)
 	free(dev);
 }
 
+struct evemu_device *evemu_clone(const struct evemu_device *src)
+{
+	struct evemu_device *dev;
+	unsigned int type, code;
+
+	dev = evemu_new(evemu_get_name(src));
+	if (!dev)
+		return NULL;
+	dev->ctx = src->ctx;
+
+	evemu_set_id_bustype(dev, evemu_get_id_bustype(src));
+	evemu_set_id_vendor(dev, evemu_get_id_vendor(src));
+	evemu_set_id_product(dev, evemu_get_id_product(src));
+	evemu_set_id_version(dev, evemu_get_id_version(src));
+
+#ifdef INPUT_PROP_MAX
+	for (code = 0; code < INPUT_PROP_MAX; code++)
+		if (evemu_has_prop(src, code))
+			libevdev_enable_property(dev->evdev, code);
+#endif
+
+	for (type = 0; type < EV_CNT; type++) {
+		int max = libevdev_event_type_get_max(type);
+
+		if (max == -1 || !evemu_has_bit(src, type))
+			continue;
+
+		for (code = 0; code <= (unsigned int)max; code++) {
+			const void *data = NULL;
+			int rep;
+
+			if (!evemu_has_event(src, type, code))
+				continue;
+
+			if (type == EV_ABS) {
+				data = libevdev_get_abs_info(src->evdev, code);
+			} else if (type == EV_REP) {
+				rep = libevdev_get_event_value(src->evdev, type, code);
+				data = &rep;
+			}
+			libevdev_enable_event_code(dev->evdev, type, code, data);
+		}
+	}
+
+	return dev;
+}
+
 unsigned int evemu_get_version(const struct evemu_device *dev)
 {
 	return dev->version;
@@ -229,29 +254,192 @@ int evemu_extract(struct evemu_device *dev, int fd)
 	return libevdev_set_fd(dev->evdev, fd);
 }
 
-static inline int bit_is_set(unsigned char *mask, int bit)
+/* bytes of a mask of nbits, rounded up to whole 64-bit words */
+#define MASK_BYTES(nbits) ((((nbits) + 63) / 64) * 8)
+
+/* word n of a byte mask, bit i of the word is bit 64 * n + i of the mask */
+static inline uint64_t mask_word(const unsigned char *mask, int n)
+{
+	uint64_t word = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		word = word << 8 | mask[n * 8 + i];
+	return word;
+}
+
+/*
+ * The first set bit at or after from and below nbits, or -1. The mask
+ * must hold MASK_BYTES(nbits) bytes. Zero words are skipped whole, so
+ * walking a sparse mask costs one step per set bit.
+ */
+static int next_set_bit(const unsigned char *mask, int nbits, int from)
 {
-	return !!(mask[bit/8] & (1 << (bit & 0x7)));
+	int n = from / 64;
+	uint64_t word;
+
+	if (from >= nbits)
+		return -1;
+
+	word = mask_word(mask, n) & (~0ULL << (from % 64));
+	while (!word) {
+		if (++n * 64 >= nbits)
+			return -1;
+		word = mask_word(mask, n);
+	}
+
+	from = n * 64 + __builtin_ctzll(word);
+	return from < nbits ? from : -1;
 }
 
+#define for_each_set_bit(bit, mask, nbits) \
+	for ((bit) = next_set_bit(mask, nbits, 0); (bit) >= 0; \
+	     (bit) = next_set_bit(mask, nbits, (bit) + 1))
+
 static inline void set_bit(unsigned char *mask, int bit)
 {
 	mask[bit/8] |= 1 << (bit & 0x7);
 }
 
-#define max(a, b) (a > b) ? a : b
+int evemu_get_event_mask(const struct evemu_device *dev, int type,
+			 unsigned char *mask, size_t size)
+{
+	int max, code, needed;
+
+	if (type < 0 || type >= EV_CNT)
+		return -EINVAL;
+	max = type == EV_SYN ? EV_MAX : libevdev_event_type_get_max(type);
+	if (max < 0)
+		return -EINVAL;
+
+	needed = max / 8 + 1;
+	if (size > (size_t)needed)
+		size = needed;
+	memset(mask, 0, size);
+
+	if (type != EV_SYN && !libevdev_has_event_type(dev->evdev, type))
+		return needed;
+
+	for (code = 0; code <= max && (size_t)code / 8 < size; code++) {
+		int set = type == EV_SYN ?
+			  libevdev_has_event_type(dev->evdev, code) :
+			  libevdev_has_event_code(dev->evdev, type, code);
+		if (set)
+			set_bit(mask, code);
+	}
+
+	return needed;
+}
 
-static void write_prop(FILE * fp, const struct evemu_device *dev)
+int evemu_get_prop_mask(const struct evemu_device *dev,
+			unsigned char *mask, size_t size)
 {
 #ifdef INPUT_PROP_MAX
-	int i;
-	unsigned char mask[max(8, (INPUT_PROP_MAX + 7)/8)] = {0};
+	int prop, needed = INPUT_PROP_MAX / 8 + 1;
+
+	if (size > (size_t)needed)
+		size = needed;
+	memset(mask, 0, size);
+
+	for (prop = 0; prop <= INPUT_PROP_MAX && (size_t)prop / 8 < size; prop++)
+		if (libevdev_has_property(dev->evdev, prop))
+			set_bit(mask, prop);
+
+	return needed;
+#else
+	return 0;
+#endif
+}
+
+int evemu_get_abs_table(const struct evemu_device *dev,
+			struct input_absinfo *abs, size_t count)
+{
+	size_t code;
 
-	for (i = 0; i < INPUT_PROP_MAX; i ++) {
-		if (evemu_has_prop(dev, i))
-			set_bit(mask, i);
+	for (code = 0; code < count && code < ABS_CNT; code++) {
+		const struct input_absinfo *info;
+
+		info = libevdev_get_abs_info(dev->evdev, code);
+		if (info)
+			abs[code] = *info;
+		else
+			memset(&abs[code], 0, sizeof(abs[code]));
 	}
 
+	return ABS_CNT;
+}
+
+#define max(a, b) (a > b) ? a : b
+
+/* the highest code of a type that fits struct evemu_desc */
+static int type_max(unsigned int type)
+{
+	int max = libevdev_event_type_get_max(type);
+	int room = type == EV_ABS ? DESC_ABS_CNT : DESC_CODE_CNT;
+
+	return max >= room ? room - 1 : max;
+}
+
+void evemu_desc_from_device(struct evemu_desc *desc,
+			    const struct evemu_device *dev)
+{
+	int type;
+	unsigned int code;
+
+	memset(desc, 0, sizeof(*desc));
+	snprintf(desc->name, sizeof(desc->name), "%s", evemu_get_name(dev));
+	desc->id.bustype = evemu_get_id_bustype(dev);
+	desc->id.vendor = evemu_get_id_vendor(dev);
+	desc->id.product = evemu_get_id_product(dev);
+	desc->id.version = evemu_get_id_version(dev);
+
+	evemu_get_event_mask(dev, EV_SYN, desc->types, sizeof(desc->types));
+	/* the EV_SYN mask is the types, its codes need asking one by one */
+	for (code = 0; code <= SYN_MAX; code++)
+		if (libevdev_has_event_code(dev->evdev, EV_SYN, code))
+			set_bit(desc->codes[EV_SYN], code);
+	for_each_set_bit(type, desc->types, DESC_TYPE_CNT)
+		if (type != EV_SYN)
+			evemu_get_event_mask(dev, type, desc->codes[type],
+					     sizeof(desc->codes[type]));
+	evemu_get_prop_mask(dev, desc->props, sizeof(desc->props));
+	evemu_get_abs_table(dev, desc->abs, DESC_ABS_CNT);
+}
+
+void evemu_desc_to_device(const struct evemu_desc *desc,
+			  struct evemu_device *dev)
+{
+	int type, code;
+
+	if (strlen(evemu_get_name(dev)) == 0)
+		evemu_set_name(dev, desc->name);
+	evemu_set_id_bustype(dev, desc->id.bustype);
+	evemu_set_id_vendor(dev, desc->id.vendor);
+	evemu_set_id_product(dev, desc->id.product);
+	evemu_set_id_version(dev, desc->id.version);
+
+	for_each_set_bit(code, desc->props, 8 * sizeof(desc->props))
+		libevdev_enable_property(dev->evdev, code);
+
+	/* libevdev gives every device all of EV_SYN. An axis comes with its
+	 * absinfo, no setter calls per field */
+	for_each_set_bit(type, desc->types, DESC_TYPE_CNT) {
+		if (type == EV_SYN)
+			continue;
+		libevdev_enable_event_type(dev->evdev, type);
+		for_each_set_bit(code, desc->codes[type], type_max(type) + 1)
+			libevdev_enable_event_code(dev->evdev, type, code,
+						   type == EV_ABS ? &desc->abs[code] : NULL);
+	}
+}
+
+
+static void write_prop(FILE * fp, const struct evemu_desc *desc)
+{
+#ifdef INPUT_PROP_MAX
+	int i;
+	const unsigned char *mask = desc->props;
+
 	for (i = 0; i < (INPUT_PROP_MAX + 7)/8; i +=8) {
 		fprintf(fp, "P: %02x %02x %02x %02x %02x %02x %02x %02x\n",
 			mask[i], mask[i + 1], mask[i + 2], mask[i + 3],
@@ -260,7 +448,7 @@ static void write_prop(FILE * fp, const struct evemu_device *dev)
 #endif
 }
 
-static void write_mask(FILE * fp, const struct evemu_device *dev)
+static void write_mask(FILE * fp, const struct evemu_desc *desc)
 {
 	unsigned int type;
 
@@ -268,19 +456,14 @@ static void write_mask(FILE * fp, const struct evemu_device *dev)
 	   printed out exactly that */
 	fprintf(fp, "B: 00 0b 00 00 00 00 00 00 00\n");
 
-	for (type = 1 /* don't write EV_SYN */; type < EV_CNT; type++) {
+	for (type = 1 /* don't write EV_SYN */; type < DESC_TYPE_CNT; type++) {
 		int i;
-		int max = libevdev_event_type_get_max(type);
-		unsigned char mask[KEY_CNT] = {0};
-		unsigned int code;
+		int max = type_max(type);
+		const unsigned char *mask = desc->codes[type];
 
 		if (max == -1)
 			continue;
 
-		for (code = 0; code < (unsigned int)max; code++)
-			if (evemu_has_event(dev, type, code))
-				set_bit(mask, code);
-
 		for (i = 0; i < (max + 7)/8; i += 8) {
 			fprintf(fp, "B: %02x %02x %02x %02x %02x %02x %02x %02x %02x\n",
 				type, mask[i], mask[i + 1], mask[i + 2], mask[i + 3],
@@ -296,285 +479,491 @@ static void write_abs(FILE *fp, int index, const struct input_absinfo *abs)
 }
 
 /* Print an evtest-like description */
-static void write_desc(const struct evemu_device *dev, FILE *fp)
+static void write_desc(const struct evemu_desc *desc, FILE *fp)
 {
 	int i, j;
-	fprintf(fp, "# Input device name: \"%s\"\n", evemu_get_name(dev));
+	fprintf(fp, "# Input device name: \"%s\"\n", desc->name);
 	fprintf(fp, "# Input device ID: bus %#04x vendor %#04x product %#04x version %#04x\n",
-		evemu_get_id_bustype(dev), evemu_get_id_vendor(dev),
-		evemu_get_id_product(dev), evemu_get_id_version(dev));
+		desc->id.bustype, desc->id.vendor,
+		desc->id.product, desc->id.version);
 	fprintf(fp, "# Supported events:\n");
-	for (i = 0; i < EV_MAX; i++) {
-		if (!evemu_has_bit(dev, i))
-			continue;
-
+	for_each_set_bit(i, desc->types, DESC_TYPE_CNT) {
 		fprintf(fp, "#   Event type %d (%s)\n", i, libevdev_event_type_get_name(i));
-		for (j = 0; j < libevdev_event_type_get_max(i); j++) {
-			if (!evemu_has_event(dev, i, j))
-				continue;
-
+		for_each_set_bit(j, desc->codes[i], type_max(i)) {
 			fprintf(fp, "#     Event code %d (%s)\n",
 				    j, libevdev_event_code_get_name(i, j));
 			if (i == EV_ABS) {
+				const struct input_absinfo *abs = &desc->abs[j];
+
 				fprintf(fp, "#       Value %6d\n"
 					    "#       Min   %6d\n"
 					    "#       Max   %6d\n"
 					    "#       Fuzz  %6d\n"
 					    "#       Flat  %6d\n"
 					    "#       Resolution %d\n",
-					    evemu_get_abs_current_value(dev, j),
-					    evemu_get_abs_minimum(dev, j),
-					    evemu_get_abs_maximum(dev,j),
-					    evemu_get_abs_fuzz(dev, j),
-					    evemu_get_abs_flat(dev, j),
-					    evemu_get_abs_resolution(dev, j));
+					    abs->value, abs->minimum, abs->maximum,
+					    abs->fuzz, abs->flat, abs->resolution);
 			}
 		}
 	}
 
 #ifdef INPUT_PROP_MAX
 	fprintf(fp, "# Properties:\n");
-	for (i = 0; i < INPUT_PROP_MAX; i++) {
-		if (!evemu_has_prop(dev, i))
-			continue;
+	for_each_set_bit(i, desc->props, INPUT_PROP_MAX)
 		fprintf(fp, "#   Property  type %d (%s)\n", i,
 				libevdev_property_get_name(i));
-	}
 #endif
 }
 
-int evemu_write(const struct evemu_device *dev, FILE *fp)
+static void write_description(const struct evemu_desc *desc, FILE *fp)
 {
 	int i;
 
 	fprintf(fp, "# EVEMU %d.%d\n", EVEMU_FILE_MAJOR, EVEMU_FILE_MINOR);
 
-	write_desc(dev, fp);
+	write_desc(desc, fp);
 
-	fprintf(fp, "N: %s\n", evemu_get_name(dev));
+	fprintf(fp, "N: %s\n", desc->name);
 
 	fprintf(fp, "I: %04x %04x %04x %04x\n",
-		evemu_get_id_bustype(dev),
-		evemu_get_id_vendor(dev),
-		evemu_get_id_product(dev),
-		evemu_get_id_version(dev));
+		desc->id.bustype, desc->id.vendor,
+		desc->id.product, desc->id.version);
 
-	write_prop(fp, dev);
-	write_mask(fp, dev);
+	write_prop(fp, desc);
+	write_mask(fp, desc);
 
-	for (i = 0; i < ABS_CNT; i++)
-		if (evemu_has_event(dev, EV_ABS, i))
-			write_abs(fp, i, libevdev_get_abs_info(dev->evdev, i));
+	for_each_set_bit(i, desc->codes[EV_ABS], DESC_ABS_CNT)
+		write_abs(fp, i, &desc->abs[i]);
+}
+
+int evemu_write(const struct evemu_device *dev, FILE *fp)
+{
+	uint64_t start = stats_clock(dev->ctx);
+	struct evemu_desc desc;
+
+	evemu_desc_from_device(&desc, dev);
+	write_description(&desc, fp);
 
+	STATS_ADD(dev->ctx, devices_written, 1);
+	STATS_ELAPSED(dev->ctx, format_ns, start);
 	return 0;
 }
 
-static int parse_name(struct evemu_device *dev, const char *line)
+int evemu_desc_write(const struct evemu_desc *desc, FILE *fp)
 {
-	int matched;
-	char *devname = NULL;
+	struct evemu_context *ctx = current_context();
+	uint64_t start = stats_clock(ctx);
+
+	write_description(desc, fp);
+
+	STATS_ADD(ctx, devices_written, 1);
+	STATS_ELAPSED(ctx, format_ns, start);
+	return 0;
+}
+
+/*
+ * The description parser works on one line at a time, from a stream or a
+ * memory buffer, and fills a struct evemu_desc. Lines are never copied nor
+ * NUL-terminated in the buffer case, the scanners below take the line end
+ * instead and mimic the sscanf() conversions the format was defined with.
+ */
+struct desc_reader {
+	struct evemu_context *ctx;
+	struct evemu_desc *desc;
+	/* we read in properties and bits 8 at a time, but the file format
+	 * has no hint which byte we're up to. So we count what we've read
+	 * already to know where the next one tacks onto */
+	int pbytes, mbytes[EV_CNT];
+
+	FILE *fp;
+	char *buf;		/* getline() buffer of the stream */
+	size_t size;
+	const char *pos;	/* next line of the memory buffer */
+	const char *limit;
+	const char *line;	/* current line, with its newline */
+	const char *end;
+};
 
-	if ((matched = sscanf(line, "N: %m[^\n]\n", &devname)) > 0) {
-		if (strlen(evemu_get_name(dev)) == 0)
-			evemu_set_name(dev, devname);
+static int desc_read_line(struct desc_reader *r)
+{
+	if (r->fp) {
+		ssize_t len = getline(&r->buf, &r->size, r->fp);
+
+		if (len < 0)
+			return 0;
+		r->line = r->buf;
+		r->end = r->buf + len;
+	} else {
+		const char *nl;
+
+		if (r->pos >= r->limit)
+			return 0;
+		nl = memchr(r->pos, '\n', r->limit - r->pos);
+		r->line = r->pos;
+		r->end = nl ? nl + 1 : r->limit;
+		r->pos = r->end;
 	}
 
-	if (devname != NULL)
-		free(devname);
+	return 1;
+}
 
-	if (matched <= 0)
-		error(FATAL, "Expected device name, but got: %s", line);
+static int desc_is_comment(const struct desc_reader *r)
+{
+	return r->end > r->line && r->line[0] == '#';
+}
 
-	return matched > 0;
+/* skips empty lines, like first_line() */
+static int desc_first_line(struct desc_reader *r)
+{
+	while (desc_read_line(r)) {
+		if (r->end - r->line > 1)
+			return 1;
+	}
+	return 0;
 }
 
-static int parse_bus_vid_pid_ver(struct evemu_device *dev, const char *line)
+/* skips empty lines and comments, like next_line() */
+static int desc_next_line(struct desc_reader *r)
 {
-	int matched;
-	unsigned bustype, vendor, product, version;
+	while (desc_first_line(r)) {
+		if (!desc_is_comment(r))
+			return 1;
+	}
+	return 0;
+}
+
+/* hex digit values plus one, zero for anything else */
+static const unsigned char hex_digit[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static const char *skip_space(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r')))
+		p++;
+	return p;
+}
+
+/* "%0<width>x", returns 1 if a number was converted */
+static int scan_hex(const char **p, const char *end, int width,
+		    unsigned int *value)
+{
+	const char *s = skip_space(*p, end);
+	unsigned int v = 0;
+	int n;
+
+	for (n = 0; n < width && s < end && hex_digit[(unsigned char)*s]; n++, s++)
+		v = v * 16 + hex_digit[(unsigned char)*s] - 1;
+	if (n == 0)
+		return 0;
+
+	*value = v;
+	*p = s;
+	return 1;
+}
 
-	if ((matched = sscanf(line, "I: %04x %04x %04x %04x\n",
-				    &bustype, &vendor, &product, &version)) > 0) {
-		evemu_set_id_bustype(dev, bustype);
-		evemu_set_id_vendor(dev, vendor);
-		evemu_set_id_product(dev, product);
-		evemu_set_id_version(dev, version);
+/* "%d", returns 1 if a number was converted */
+static int scan_int(const char **p, const char *end, int *value)
+{
+	const char *s = skip_space(*p, end);
+	unsigned int v = 0;
+	int negative = 0;
+	const char *digits;
+
+	if (s < end && (*s == '-' || *s == '+'))
+		negative = *s++ == '-';
+	for (digits = s; s < end && *s >= '0' && *s <= '9'; s++)
+		v = v * 10 + (*s - '0');
+	if (s == digits)
+		return 0;
+
+	*value = negative ? -v : v;
+	*p = s;
+	return 1;
+}
+
+/* a two character line tag like "B:" */
+static int scan_tag(const char **p, const char *end, const char *tag)
+{
+	if (end - *p <= 2 || (*p)[0] != tag[0] || (*p)[1] != tag[1])
+		return 0;
+	*p += 2;
+	return 1;
+}
+
+/* up to @count hex bytes, returns the number converted */
+static int scan_bytes(const char **p, const char *end, unsigned char *bytes,
+		      int count)
+{
+	unsigned int v;
+	int n;
+
+	for (n = 0; n < count && scan_hex(p, end, 2, &v); n++)
+		bytes[n] = v;
+	return n;
+}
+
+static int line_length(const struct desc_reader *r)
+{
+	return r->end - r->line;
+}
+
+static int parse_name(struct desc_reader *r)
+{
+	const char *p = r->line;
+	const char *name = NULL, *name_end = NULL;
+	int matched = 0;
+
+	if (r->end - p >= 2 && p[0] == 'N' && p[1] == ':') {
+		/* a line only ever has a newline at its end */
+		name = skip_space(p + 2, r->end);
+		name_end = r->end;
+		if (name_end > name && name_end[-1] == '\n')
+			name_end--;
+		matched = name_end > name;
+	}
+
+	if (matched) {
+		size_t len = name_end - name;
+
+		if (len >= sizeof(r->desc->name))
+			len = sizeof(r->desc->name) - 1;
+		memcpy(r->desc->name, name, len);
+		r->desc->name[len] = '\0';
+	}
+
+	if (!matched)
+		evemu_log(r->ctx, EVEMU_LOG_ERROR, "Expected device name, but got: %.*s",
+			  line_length(r), r->line);
+
+	return matched;
+}
+
+static int parse_bus_vid_pid_ver(struct desc_reader *r)
+{
+	const char *p = r->line;
+	unsigned int id[4];
+	int matched = 0;
+
+	if (r->end - p >= 2 && p[0] == 'I' && p[1] == ':') {
+		p += 2;
+		while (matched < 4 && scan_hex(&p, r->end, 4, &id[matched]))
+			matched++;
 	}
 
-	if (matched != 4)
-		error(FATAL, "Expected bus/vendor/product/version, got: %s", line);
+	if (matched != 4) {
+		evemu_log(r->ctx, EVEMU_LOG_ERROR, "Expected bus/vendor/product/version, got: %.*s",
+			  line_length(r), r->line);
+		return 0;
+	}
+
+	r->desc->id.bustype = id[0];
+	r->desc->id.vendor = id[1];
+	r->desc->id.product = id[2];
+	r->desc->id.version = id[3];
 
-	return matched == 4;
+	return 1;
 }
 
-static int parse_prop(struct evemu_device *dev, const char *line)
+static int parse_prop(struct desc_reader *r)
 {
+	const char *p = r->line;
 	int matched;
 	unsigned char mask[8];
-	size_t i;
+	int i;
 
-	if (strlen(line) <= 2 || strncmp(line, "P:", 2) != 0)
+	if (!scan_tag(&p, r->end, "P:"))
 		return 0;
 
-	matched = sscanf(line, "P: %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx\n",
-				mask + 0, mask + 1, mask + 2, mask + 3,
-				mask + 4, mask + 5, mask + 6, mask + 7);
-
+	matched = scan_bytes(&p, r->end, mask, 8);
 	if (matched != 8) {
-		error(WARNING, "Invalid INPUT_PROP line. Parsed %d numbers, expected 8: %s", matched, line);
+		evemu_log(r->ctx, EVEMU_LOG_WARNING, "Invalid INPUT_PROP line. Parsed %d numbers, expected 8: %.*s",
+			  matched, line_length(r), r->line);
 		return -1;
 	}
 
-	for (i = 0; i < sizeof(mask) * 8; i++) {
-		if (bit_is_set(mask, i))
-			libevdev_enable_property(dev->evdev, dev->pbytes * 8 + i);
+	/* the properties a device could not take are dropped */
+	for_each_set_bit(i, mask, 64) {
+		unsigned int prop = r->pbytes * 8 + i;
+
+#ifdef INPUT_PROP_MAX
+		if (prop <= INPUT_PROP_MAX && prop < 8 * sizeof(r->desc->props))
+			set_bit(r->desc->props, prop);
+#endif
 	}
 
-	dev->pbytes += 8;
+	r->pbytes += 8;
 
 	return 1;
 }
 
-static int parse_mask(struct evemu_device *dev, const char *line)
+static int parse_mask(struct desc_reader *r)
 {
-	int matched;
+	const char *p = r->line;
+	int matched = 0;
 	unsigned char mask[8];
-	unsigned int index, i;
+	unsigned int index;
+	int bit;
 
-	if (strlen(line) <= 2 || strncmp(line, "B:", 2) != 0)
+	if (!scan_tag(&p, r->end, "B:"))
 		return 0;
 
-	matched = sscanf(line, "B: %02x %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx %02hhx\n",
-				&index, mask + 0, mask + 1, mask + 2, mask + 3,
-				mask + 4, mask + 5, mask + 6, mask + 7);
+	if (scan_hex(&p, r->end, 2, &index))
+		matched = 1 + scan_bytes(&p, r->end, mask, 8);
 
 	if (matched != 9) {
-		error(WARNING, "Invalid EV_BIT line. Parsed %d numbers, expected 9: %s", matched, line);
+		evemu_log(r->ctx, EVEMU_LOG_WARNING, "Invalid EV_BIT line. Parsed %d numbers, expected 9: %.*s",
+			  matched, line_length(r), r->line);
 		return -1;
 	}
 
-	for (i = 0; i < sizeof(mask) * 8; i++) {
-		if (bit_is_set(mask, i)) {
-			struct input_absinfo abs = {0}; /* dummy */
+	/* like a device, drop the codes of unknown types or past the maximum */
+	if (index >= DESC_TYPE_CNT)
+		return 1;
 
-			abs.minimum = 0;
-			abs.maximum = 1;
+	for_each_set_bit(bit, mask, 64) {
+		struct evemu_desc *desc = r->desc;
+		int code = r->mbytes[index] * 8 + bit;
 
-			unsigned int code = dev->mbytes[index] * 8 + i;
-			libevdev_enable_event_code(dev->evdev, index, code, (index == EV_ABS) ? &abs : NULL);
+		if (code > type_max(index))
+			continue;
+
+		set_bit(desc->types, index);
+		set_bit(desc->codes[index], code);
+		if (index == EV_ABS) {
+			/* dummy, until the A: line of the axis */
+			memset(&desc->abs[code], 0, sizeof(desc->abs[code]));
+			desc->abs[code].maximum = 1;
 		}
 	}
 
-	dev->mbytes[index] += 8;
+	r->mbytes[index] += 8;
 
 	return 1;
 }
 
-static int parse_abs(struct evemu_device *dev, const char *line, struct version *fversion)
+static int parse_abs(struct desc_reader *r, struct version *fversion)
 {
-	int matched;
-	struct input_absinfo abs = {0};
+	const char *p = r->line;
+	int matched = 0;
+	int values[5] = {0};
 	unsigned int index;
 	int needed = 5;
 
 	if (version_cmp(*fversion, version(1, 1)) > 0)
 			needed = 6; /* resolution field */
 
-	if (strlen(line) <= 2 || strncmp(line, "A:", 2) != 0)
+	if (!scan_tag(&p, r->end, "A:"))
 		return 0;
 
-	matched = sscanf(line, "A: %02x %d %d %d %d %d\n",
-				&index, &abs.minimum, &abs.maximum,
-				&abs.fuzz, &abs.flat, &abs.resolution);
+	if (scan_hex(&p, r->end, 2, &index))
+		for (matched = 1; matched < 6; matched++)
+			if (!scan_int(&p, r->end, &values[matched - 1]))
+				break;
 
 	if (matched != needed) {
-		error(FATAL, "Invalid EV_ABS line. Parsed %d numbers, expected %d: %s", matched, needed, line);
+		evemu_log(r->ctx, EVEMU_LOG_ERROR, "Invalid EV_ABS line. Parsed %d numbers, expected %d: %.*s",
+			  matched, needed, line_length(r), r->line);
 		return -1;
 	}
 
-	evemu_set_abs_minimum(dev, index, abs.minimum);
-	evemu_set_abs_maximum(dev, index, abs.maximum);
-	evemu_set_abs_fuzz(dev, index, abs.fuzz);
-	evemu_set_abs_flat(dev, index, abs.flat);
-	evemu_set_abs_resolution(dev, index, abs.resolution);
+	if (index < DESC_ABS_CNT) {
+		struct input_absinfo *abs = &r->desc->abs[index];
+
+		abs->minimum = values[0];
+		abs->maximum = values[1];
+		abs->fuzz = values[2];
+		abs->flat = values[3];
+		abs->resolution = values[4];
+	}
 
 	return 1;
 }
 
-static struct version parse_file_format_version(const char *line)
+static struct version parse_file_format_version(const struct desc_reader *r)
 {
 	struct version v;
-	uint16_t major, minor;
-
-	if (sscanf(line, "# EVEMU %hd.%hd\n", &major, &minor) != 2) {
-		major = 1;
-		minor = 0;
+	const char *p = r->line;
+	int major = 1, minor = 0;
+
+	if (r->end - p >= 1 && p[0] == '#') {
+		p = skip_space(p + 1, r->end);
+		if (r->end - p < 5 || strncmp(p, "EVEMU", 5) != 0 ||
+		    (p += 5, !scan_int(&p, r->end, &major)) ||
+		    p >= r->end || *p++ != '.' ||
+		    !scan_int(&p, r->end, &minor)) {
+			major = 1;
+			minor = 0;
+		}
 	}
 
-
 	v = version(major, minor);
 
 	if (version_cmp(v, version(EVEMU_FILE_MAJOR, EVEMU_FILE_MINOR)) > 0)
-		fprintf(stderr, "Warning: file format %d.%d is newer than "
-				"supported version %d.%d.\n",
+		evemu_log(r->ctx, EVEMU_LOG_WARNING,
+			  "file format %d.%d is newer than supported version %d.%d.\n",
 			major, minor, EVEMU_FILE_MAJOR, EVEMU_FILE_MINOR);
 
 	return v;
 }
 
-int evemu_read(struct evemu_device *dev, FILE *fp)
+static int read_description(struct desc_reader *r)
 {
-	int rc = -1;
+	int rc = -1, code;
 	struct version file_version; /* file format version */
-	size_t size = 0;
-	char *line = NULL;
+	uint64_t start = stats_clock(r->ctx);
 
-	memset(dev->mbytes, 0, sizeof(*dev->mbytes));
-	dev->pbytes = 0;
-	dev->version = EVEMU_VERSION;
+	memset(r->desc, 0, sizeof(*r->desc));
+	/* like with libevdev, every device has all of EV_SYN */
+	set_bit(r->desc->types, EV_SYN);
+	for (code = 0; code <= type_max(EV_SYN); code++)
+		set_bit(r->desc->codes[EV_SYN], code);
 
 	/* first line _may_ be version */
-	if (!first_line(fp, &line, &size)) {
-		error(WARNING, "This appears to be an empty file\n");
+	if (!desc_first_line(r)) {
+		evemu_log(r->ctx, EVEMU_LOG_WARNING, "This appears to be an empty file\n");
 		return -1;
 	}
 
-	file_version = parse_file_format_version(line);
+	file_version = parse_file_format_version(r);
 
-	if (is_comment(line) && !next_line(fp, &line, &size)) {
-		error(WARNING, "This appears to be an empty file\n");
+	if (desc_is_comment(r) && !desc_next_line(r)) {
+		evemu_log(r->ctx, EVEMU_LOG_WARNING, "This appears to be an empty file\n");
 		goto out;
 	}
 
-	if (!parse_name(dev, line))
+	if (!parse_name(r))
 		goto out;
 
-	if (!next_line(fp, &line, &size))
+	if (!desc_next_line(r))
 		goto out;
 
-	if (!parse_bus_vid_pid_ver(dev, line))
+	if (!parse_bus_vid_pid_ver(r))
 		goto out;
 
 	/* devices without prop/mask/abs bits are valid */
-	if (!next_line(fp, &line, &size)) {
+	if (!desc_next_line(r)) {
 		rc = 1;
 		goto out;
 	}
 
-	while((rc = parse_prop(dev, line)) > 0)
-		if (!next_line(fp, &line, &size))
+	while((rc = parse_prop(r)) > 0)
+		if (!desc_next_line(r))
 			break;
 	if (rc == -1)
 		goto out;
 
-	while((rc = parse_mask(dev, line)) > 0)
-		if (!next_line(fp, &line, &size))
+	while((rc = parse_mask(r)) > 0)
+		if (!desc_next_line(r))
 			break;
 	if (rc == -1)
 		goto out;
 
-	while((rc = parse_abs(dev, line, &file_version)) > 0)
-		if (!next_line(fp, &line, &size))
+	while((rc = parse_abs(r, &file_version)) > 0)
+		if (!desc_next_line(r))
 			break;
 	if (rc == -1)
 		goto out;
@@ -582,10 +971,63 @@ int evemu_read(struct evemu_device *dev, FILE *fp)
 	rc = 1;
 
 out:
-	free(line);
+	if (rc > 0)
+		STATS_ADD(r->ctx, devices_parsed, 1);
+	STATS_ELAPSED(r->ctx, parse_ns, start);
 	return rc;
 }
 
+/* the description goes to the device in one go, once it is complete */
+static int read_into_device(struct evemu_device *dev, struct desc_reader *r)
+{
+	struct evemu_desc desc;
+	int rc;
+
+	dev->version = EVEMU_VERSION;
+	r->ctx = dev->ctx;
+	r->desc = &desc;
+	rc = read_description(r);
+	if (rc > 0)
+		evemu_desc_to_device(&desc, dev);
+
+	return rc;
+}
+
+int evemu_read(struct evemu_device *dev, FILE *fp)
+{
+	struct desc_reader r = { .fp = fp };
+	int rc;
+
+	rc = read_into_device(dev, &r);
+	free(r.buf);
+	return rc;
+}
+
+int evemu_read_buffer(struct evemu_device *dev, const char *buf, size_t size)
+{
+	struct desc_reader r = { .pos = buf, .limit = buf + size };
+
+	return read_into_device(dev, &r);
+}
+
+int evemu_desc_read(struct evemu_desc *desc, FILE *fp)
+{
+	struct desc_reader r = { .ctx = current_context(), .desc = desc, .fp = fp };
+	int rc;
+
+	rc = read_description(&r);
+	free(r.buf);
+	return rc;
+}
+
+int evemu_desc_read_buffer(struct evemu_desc *desc, const char *buf, size_t size)
+{
+	struct desc_reader r = { .ctx = current_context(), .desc = desc,
+				 .pos = buf, .limit = buf + size };
+
+	return read_description(&r);
+}
+
 static int write_event_desc(FILE *fp, const struct input_event *ev)
 {
 	int rc;
@@ -610,24 +1052,62 @@ static int write_event_desc(FILE *fp, const struct input_event *ev)
 
 int evemu_write_event(FILE *fp, const struct input_event *ev)
 {
+	struct evemu_context *ctx = current_context();
+	uint64_t start = stats_clock(ctx);
 	int rc;
 	rc = fprintf(fp, "E: %lu.%06u %04x %04x %04d	",
 		     ev->time.tv_sec, (unsigned)ev->time.tv_usec,
 		     ev->type, ev->code, ev->value);
 	rc += write_event_desc(fp, ev);
+	STATS_ADD(ctx, events_formatted, 1);
+	STATS_ADD(ctx, bytes_formatted, rc);
+	STATS_ELAPSED(ctx, format_ns, start);
 	return rc;
 }
 
 int evemu_write_event_with_id(FILE *fp, const struct input_event *ev, int dev_id)
 {
+	struct evemu_context *ctx = current_context();
+	uint64_t start = stats_clock(ctx);
   int rc;
 	rc = fprintf(fp, "E: %d %lu.%06u %04x %04x %04d	", dev_id,
                ev->time.tv_sec, (unsigned)ev->time.tv_usec,
                ev->type, ev->code, ev->value);
 	rc += write_event_desc(fp, ev);
+	STATS_ADD(ctx, events_formatted, 1);
+	STATS_ADD(ctx, bytes_formatted, rc);
+	STATS_ELAPSED(ctx, format_ns, start);
 	return rc;
 }
 
+ssize_t read_device(struct evemu_context *ctx, int fd, void *buf, size_t size)
+{
+	uint64_t start = stats_clock(ctx);
+	ssize_t ret;
+
+	SYSCALL(ret = read(fd, buf, size));
+	STATS_ELAPSED(ctx, read_ns, start);
+	STATS_ADD(ctx, read_calls, 1);
+	if (ret > 0)
+		STATS_ADD(ctx, events_read, ret / sizeof(struct input_event));
+	return ret;
+}
+
+/* write() to a kernel device, counted in the stats */
+static ssize_t write_device(struct evemu_context *ctx, int fd,
+			    const struct input_event *ev, size_t count)
+{
+	uint64_t start = stats_clock(ctx);
+	ssize_t ret;
+
+	SYSCALL(ret = write(fd, ev, count * sizeof(*ev)));
+	STATS_ELAPSED(ctx, write_ns, start);
+	STATS_ADD(ctx, write_calls, 1);
+	if (ret > 0)
+		STATS_ADD(ctx, events_played, ret / sizeof(*ev));
+	return ret;
+}
+
 static inline long time_to_long(const struct timeval *tv) {
 	return tv->tv_sec * 1000000 + tv->tv_usec;
 }
@@ -641,18 +1121,35 @@ static inline struct timeval long_to_time(long time) {
 
 int evemu_record(FILE *fp, int fd, int ms)
 {
+	return evemu_record_filtered(fp, fd, ms, NULL);
+}
+
+int evemu_record_filtered(FILE *fp, int fd, int ms,
+			  const struct evemu_filter *filter)
+{
+	struct evemu_context *ctx = current_context();
 	struct pollfd fds = { fd, POLLIN, 0 };
 	struct input_event ev;
 	int ret;
 	long offset = 0;
 
+	/* the userspace test below stays, the kernel may not mask it all */
+	if (filter)
+		evemu_filter_apply(filter, fd);
+
 	while (poll(&fds, 1, ms) > 0) {
-		SYSCALL(ret = read(fd, &ev, sizeof(ev)));
+		ret = read_device(ctx, fd, &ev, sizeof(ev));
 		if (ret < 0)
 			return ret;
 		if (ret == sizeof(ev)) {
 			long time;
 
+			PROBE6(record_event, 0, ev.time.tv_sec, ev.time.tv_usec,
+			       ev.type, ev.code, ev.value);
+			if (filter && !filter_accepts(filter, ev.type, ev.code)) {
+				STATS_ADD(ctx, filtered_events, 1);
+				continue;
+			}
 			if (offset == 0)
 				offset = time_to_long(&ev.time);
 
@@ -666,8 +1163,41 @@ int evemu_record(FILE *fp, int fd, int ms)
 	return 0;
 }
 
+int evemu_read_batch(int fd, struct input_event *events, int count,
+		     const struct evemu_filter *filter)
+{
+	struct evemu_context *ctx = current_context();
+	ssize_t ret;
+	int i, n = 0;
+
+	ret = read_device(ctx, fd, events, count * sizeof(*events));
+	if (ret < 0)
+		return -errno;
+
+	for (i = 0; i < ret / (ssize_t)sizeof(*events); i++) {
+		struct input_event *ev = &events[i];
+
+		PROBE6(record_event, 0, ev->time.tv_sec, ev->time.tv_usec,
+		       ev->type, ev->code, ev->value);
+		if (filter && !filter_accepts(filter, ev->type, ev->code)) {
+			STATS_ADD(ctx, filtered_events, 1);
+			continue;
+		}
+		events[n++] = *ev;
+	}
+
+	return n;
+}
+
 int evemu_record_all(FILE* fp, int* fds, int counts, int ms)
 {
+  return evemu_record_all_filtered(fp, fds, counts, ms, NULL);
+}
+
+int evemu_record_all_filtered(FILE *fp, int *fds, int counts, int ms,
+                              const struct evemu_filter *filter)
+{
+  struct evemu_context *ctx = current_context();
   struct pollfd* pfds = malloc(counts*sizeof(struct pollfd));
   if (fds == NULL)
     return -1;
@@ -678,6 +1208,8 @@ int evemu_record_all(FILE* fp, int* fds, int counts, int ms)
     pfds[i].fd =fds[i];
     pfds[i].events=POLLIN;
     pfds[i].revents=0;
+    if (filter)
+      evemu_filter_apply(filter, fds[i]);
   }
 
   int ret = 0;
@@ -687,18 +1219,24 @@ int evemu_record_all(FILE* fp, int* fds, int counts, int ms)
       if (pfds[i].revents == POLLIN) {
         int fd = pfds[i].fd;
         struct input_event ev;
-        SYSCALL(ret = read(fd, &ev, sizeof(ev)));
+        ret = read_device(ctx, fd, &ev, sizeof(ev));
         if (ret < 0)
           break;
         if (ret == sizeof(ev)) {
           long time;
-          if (offset == 0)
-            offset = time_to_long(&ev.time);
-
-          time = time_to_long(&ev.time);
-          ev.time = long_to_time(time - offset);
-          evemu_write_event_with_id(fp, &ev, i);
-          fflush(fp);
+          PROBE6(record_event, i, ev.time.tv_sec, ev.time.tv_usec,
+                 ev.type, ev.code, ev.value);
+          if (filter && !filter_accepts(filter, ev.type, ev.code)) {
+            STATS_ADD(ctx, filtered_events, 1);
+          } else {
+            if (offset == 0)
+              offset = time_to_long(&ev.time);
+
+            time = time_to_long(&ev.time);
+            ev.time = long_to_time(time - offset);
+            evemu_write_event_with_id(fp, &ev, i);
+            fflush(fp);
+          }
 
           ret =0;
         }
@@ -715,18 +1253,59 @@ int evemu_record_all(FILE* fp, int* fds, int counts, int ms)
   return ret;
 }
 
+/*
+ * The line buffer of evemu_read_event(). It is kept per thread, so once
+ * the longest line of a stream has been seen, reading events does not
+ * allocate any more. The buffer is freed when the thread exits.
+ */
+struct line_buffer {
+	char *line;
+	size_t size;
+};
+
+static __thread struct line_buffer event_line;
+static pthread_key_t event_line_key;
+static pthread_once_t event_line_once = PTHREAD_ONCE_INIT;
+
+static void event_line_free(void *data)
+{
+	struct line_buffer *buf = data;
+
+	free(buf->line);
+	buf->line = NULL;
+	buf->size = 0;
+}
+
+static void event_line_init(void)
+{
+	pthread_key_create(&event_line_key, event_line_free);
+}
+
+static struct line_buffer *event_line_get(void)
+{
+	/* the first use in a thread registers the buffer for freeing */
+	if (!event_line.line) {
+		pthread_once(&event_line_once, event_line_init);
+		pthread_setspecific(event_line_key, &event_line);
+	}
+	return &event_line;
+}
+
 int evemu_read_event(FILE *fp, struct input_event *ev)
 {
 	unsigned long sec;
 	unsigned usec, type, code;
 	int value;
 	int matched = 0;
-	char *line = NULL;
-	size_t size = 0;
+	struct line_buffer *buf = event_line_get();
+	char *line;
+	struct evemu_context *ctx = current_context();
+	uint64_t start = stats_clock(ctx);
 
 	do {
-		if (!next_line(fp, &line, &size))
+		if (!next_line(fp, &buf->line, &buf->size))
 			goto out;
+		line = buf->line;
 	} while(strlen(line) > 2 && strncmp(line, "E:", 2) != 0);
 
 	if (strlen(line) <= 2 || strncmp(line, "E:", 2) != 0)
@@ -735,8 +1314,9 @@ int evemu_read_event(FILE *fp, struct input_event *ev)
 	matched = sscanf(line, "E: %lu.%06u %04x %04x %d\n",
 			 &sec, &usec, &type, &code, &value);
 	if (matched != 5) {
-		error(FATAL, "Invalid event format: %s\n", line);
-		return -1;
+		evemu_log(ctx, EVEMU_LOG_ERROR, "Invalid event format: %s\n", line);
+		matched = -1;
+		goto out;
 	}
 
 	ev->time.tv_sec = sec;
@@ -745,11 +1325,48 @@ int evemu_read_event(FILE *fp, struct input_event *ev)
 	ev->code = code;
 	ev->value = value;
 
+	PROBE5(parse_event, ev->time.tv_sec, ev->time.tv_usec,
+	       ev->type, ev->code, ev->value);
+	STATS_ADD(ctx, events_parsed, 1);
+	STATS_ADD(ctx, bytes_parsed, strlen(line));
 out:
-	free(line);
-	return matched > 0;
+	STATS_ELAPSED(ctx, parse_ns, start);
+	return matched < 0 ? -1 : matched > 0;
 }
 
+ssize_t evemu_read_events(FILE *fp, struct input_event **events)
+{
+	struct input_event *array = NULL, *tmp;
+	size_t count = 0, size = 0;
+	int ret;
+
+	for (;;) {
+		if (count == size) {
+			size = size ? 2 * size : 1024;
+			tmp = realloc(array, size * sizeof(*array));
+			if (!tmp) {
+				free(array);
+				return -ENOMEM;
+			}
+			array = tmp;
+		}
+
+		ret = evemu_read_event(fp, &array[count]);
+		if (ret <= 0)
+			break;
+		count++;
+	}
+
+	if (ret < 0 || count == 0) {
+		free(array);
+		array = NULL;
+		if (ret < 0)
+			return -EINVAL;
+	}
+
+	*events = array;
+	return count;
+}
 
 int evemu_create_event(struct input_event *ev, int type, int code, int value)
 {
@@ -777,7 +1394,14 @@ int evemu_read_event_realtime(FILE *fp, struct input_event *ev,
 		usec = 1000000L * (ev->time.tv_sec - evtime->tv_sec);
 		usec += ev->time.tv_usec - evtime->tv_usec;
 		if (usec > 500) {
+			struct evemu_context *ctx = current_context();
+			uint64_t start = stats_clock(ctx);
+
+			PROBE1(sleep_begin, usec);
 			usleep(usec);
+			PROBE1(sleep_end, usec);
+			STATS_ADD(ctx, sleeps, 1);
+			STATS_ELAPSED(ctx, sleep_ns, start);
 			*evtime = ev->time;
 		}
 	}
@@ -788,66 +1412,239 @@ int evemu_read_event_realtime(FILE *fp, struct input_event *ev,
 int evemu_play_one(int fd, const struct input_event *ev)
 {
 	int ret;
-	SYSCALL(ret = write(fd, ev, sizeof(*ev)));
+	ret = write_device(current_context(), fd, ev, 1);
 	return (ret == -1 || (size_t)ret < sizeof(*ev)) ? -1 : 0;
 }
 
-static void evemu_warn_about_incompatible_event(struct input_event *ev)
+int evemu_play_frame(int fd, const struct input_event *frame, int count)
+{
+	int ret;
+	ret = write_device(current_context(), fd, frame, count);
+	return (ret == -1 || (size_t)ret < count * sizeof(*frame)) ? -1 : 0;
+}
+
+static void evemu_warn_about_incompatible_event(struct evemu_context *ctx,
+						struct input_event *ev)
 {
-	const int max_warnings = 3;
-	static int warned = 0;
+	unsigned int max_warnings = ctx->incompatible.burst;
+	unsigned int warned;
 
-	if (++warned <= max_warnings) {
+	STATS_ADD(ctx, incompatible_events, 1);
+	warned = ratelimit_test(&ctx->incompatible);
+	if (warned <= max_warnings) {
 		if (warned == 1)
-			error(WARNING, "You are trying to play events incompatbile with this device. "
-					"Is this the right device/recordings file?\n");
-		error(WARNING, "%s %s is not supported by this device.\n",
+			evemu_log(ctx, EVEMU_LOG_WARNING,
+				  "You are trying to play events incompatbile with this device. "
+				  "Is this the right device/recordings file?\n");
+		evemu_log(ctx, EVEMU_LOG_WARNING, "%s %s is not supported by this device.\n",
 				libevdev_event_type_get_name(ev->type),
 				libevdev_event_code_get_name(ev->type, ev->code));
 	} else if (warned == max_warnings + 1) {
-		error(INFO, "warned about incompatible events %d times. Will be quiet now.\n",
-				warned - 1);
+		evemu_log(ctx, EVEMU_LOG_INFO,
+			  "warned about incompatible events %u times. Will be quiet now.\n",
+			  max_warnings);
 	}
 }
 
-int evemu_play(FILE *fp, int fd)
+static long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_usec(struct evemu_context *ctx, long usec)
 {
+	struct timespec ts;
+	uint64_t start = stats_clock(ctx);
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	STATS_ADD(ctx, sleeps, 1);
+	STATS_ELAPSED(ctx, sleep_ns, start);
+}
+
+/* deadlines of evemu_play_timed(), counted from the first event */
+struct play_clock {
+	evemu_wakeup_func_t wakeup;
+	void *data;
+	long first;		/* time of the first event, -1 before it */
+	long start;		/* CLOCK_MONOTONIC usec of the first event */
+	long due;		/* offset of the last deadline slept to */
+};
+
+static void sleep_until_due(struct evemu_context *ctx, struct play_clock *clk,
+			    const struct input_event *ev)
+{
+	long time = time_to_long(&ev->time);
+	long target, late;
+	struct timespec now;
+
+	if (clk->first < 0) {
+		clk->first = time;
+		clk->start = now_usec();
+	}
+	if (time - clk->first <= clk->due)
+		return;
+
+	clk->due = time - clk->first;
+	target = clk->start + clk->due;
+	sleep_until_usec(ctx, target);
+
+	if (clk->wakeup) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		late = (now.tv_sec * 1000000L - target) * 1000L + now.tv_nsec;
+		clk->wakeup(late > 0 ? late : 0, clk->data);
+	}
+}
+
+/*
+ * Replays events the filter does not accept with a warning, or drops
+ * them. Without a filter, the device's own capabilities are the filter.
+ * Without a clock, each event is slept to relative to the one before.
+ */
+static int play(FILE *fp, int fd, const struct evemu_filter *filter, int drop,
+		struct play_clock *clk)
+{
+	struct evemu_context *ctx = current_context();
+	struct evemu_filter *own = NULL;
 	struct input_event ev;
 	struct timeval evtime;
-	int ret;
-	struct evemu_device *dev;
+	ssize_t ret __attribute__((unused));
 
-	dev = evemu_new(NULL);
-	if (dev) {
-		if (evemu_extract(dev, fd) != 0) {
-			evemu_delete(dev);
-			dev = NULL;
-		}
-	}
+	if (!filter)
+		filter = own = evemu_filter_new_from_fd(fd);
 
 	memset(&evtime, 0, sizeof(evtime));
-	while (evemu_read_event_realtime(fp, &ev, &evtime) > 0) {
-		if (dev &&
-		    (ev.type != EV_SYN || ev.code != SYN_MT_REPORT) &&
-		    !evemu_has_event(dev, ev.type, ev.code))
-			evemu_warn_about_incompatible_event(&ev);
-		SYSCALL(ret = write(fd, &ev, sizeof(ev)));
+	while ((clk ? evemu_read_event(fp, &ev) :
+		      evemu_read_event_realtime(fp, &ev, &evtime)) > 0) {
+		if (clk)
+			sleep_until_due(ctx, clk, &ev);
+		if (filter && !filter_accepts(filter, ev.type, ev.code)) {
+			if (drop) {
+				STATS_ADD(ctx, filtered_events, 1);
+				continue;
+			}
+			evemu_warn_about_incompatible_event(ctx, &ev);
+		}
+		PROBE6(play_begin, fd, ev.time.tv_sec, ev.time.tv_usec,
+		       ev.type, ev.code, ev.value);
+		ret = write_device(ctx, fd, &ev, 1);
+		PROBE2(play_end, fd, ret);
 	}
 
-	if (dev)
-		evemu_delete(dev);
+	evemu_filter_delete(own);
 	return 0;
 }
 
+int evemu_play(FILE *fp, int fd)
+{
+	return play(fp, fd, NULL, 0, NULL);
+}
+
+int evemu_play_filtered(FILE *fp, int fd, const struct evemu_filter *filter)
+{
+	return play(fp, fd, filter, 1, NULL);
+}
+
+int evemu_play_timed(FILE *fp, int fd, const struct evemu_filter *filter,
+		     int drop, evemu_wakeup_func_t wakeup, void *data)
+{
+	struct play_clock clk = { wakeup, data, -1, 0, 0 };
+
+	return play(fp, fd, filter, drop, &clk);
+}
+
+int evemu_play_fanout(FILE *fp, const int *fds, const long *offsets, int count)
+{
+	struct evemu_context *ctx = current_context();
+	struct input_event *events = NULL;
+	size_t nevents;
+	ssize_t n;
+	size_t *next;
+	long first, start;
+	int ret = 0;
+
+	n = evemu_read_events(fp, &events);
+	if (n < 0)
+		return -1;
+	nevents = n;
+
+	next = calloc(count, sizeof(*next));
+	if (!next) {
+		free(events);
+		return -ENOMEM;
+	}
+
+	first = nevents ? time_to_long(&events[0].time) : 0;
+	start = now_usec();
+
+	while (1) {
+		size_t end;
+		long when = 0;
+		int i, clone = -1;
+
+		/* pick the clone whose next frame is due first */
+		for (i = 0; i < count; i++) {
+			long t;
+
+			if (next[i] >= nevents)
+				continue;
+
+			t = time_to_long(&events[next[i]].time) - first;
+			if (offsets)
+				t += offsets[i];
+			if (clone == -1 || t < when) {
+				clone = i;
+				when = t;
+			}
+		}
+		if (clone == -1)
+			break;
+
+		/* a frame is everything up to and including the SYN_REPORT */
+		end = next[clone];
+		while (end < nevents &&
+		       (events[end].type != EV_SYN || events[end].code != SYN_REPORT))
+			end++;
+		if (end < nevents)
+			end++;
+
+		sleep_until_usec(ctx, start + when);
+		ret = write_device(ctx, fds[clone], &events[next[clone]],
+				   end - next[clone]);
+		if (ret < 0)
+			break;
+
+		next[clone] = end;
+		ret = 0;
+	}
+
+	free(next);
+	free(events);
+	return ret;
+}
+
 int evemu_create(struct evemu_device *dev, int fd)
 {
-	return libevdev_uinput_create_from_device(dev->evdev, fd, &dev->uidev);
+	int ret;
+
+	ret = libevdev_uinput_create_from_device(dev->evdev, fd, &dev->uidev);
+	PROBE2(device_create, evemu_get_name(dev), ret);
+	return ret;
 }
 
 int evemu_create_managed(struct evemu_device *dev)
 {
-	return libevdev_uinput_create_from_device(dev->evdev,
+	int ret;
+
+	ret = libevdev_uinput_create_from_device(dev->evdev,
 		LIBEVDEV_UINPUT_OPEN_MANAGED, &dev->uidev);
+	PROBE2(device_create, evemu_get_name(dev), ret);
+	return ret;
 }
 
 const char *evemu_get_devnode(struct evemu_device *dev)
@@ -858,7 +1655,82 @@ const char *evemu_get_devnode(struct evemu_device *dev)
 void evemu_destroy(struct evemu_device *dev)
 {
 	if (dev->uidev) {
+		PROBE1(device_destroy, evemu_get_name(dev));
 		libevdev_uinput_destroy(dev->uidev);
 		dev->uidev = NULL;
 	}
 }
+
+/* axes that rest in the middle of their range, all others at the minimum */
+static int abs_rests_centered(int code)
+{
+	return (code >= ABS_X && code <= ABS_RZ) ||
+	       (code >= ABS_HAT0X && code <= ABS_HAT3Y) ||
+	       code == ABS_TILT_X || code == ABS_TILT_Y;
+}
+
+static struct input_event *add_event(struct input_event *ev, int type,
+				     int code, int value)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+	return ev + 1;
+}
+
+int evemu_reset_state(const struct evemu_device *dev, int fd)
+{
+	struct evemu_desc desc;
+	struct input_event *frame, *ev;
+	int code, slot, ret;
+	ssize_t n;
+
+	evemu_desc_from_device(&desc, dev);
+
+	/* one frame with room for every code and two events per slot */
+	frame = malloc((KEY_CNT + SW_CNT + LED_CNT + 3 * ABS_CNT + 2) *
+		       sizeof(*frame));
+	if (!frame)
+		return -ENOMEM;
+	ev = frame;
+
+	/* lift every touch, of ABS_CNT slots at most */
+	if (libevdev_has_event_code(dev->evdev, EV_ABS, ABS_MT_SLOT) &&
+	    libevdev_has_event_code(dev->evdev, EV_ABS, ABS_MT_TRACKING_ID)) {
+		const struct input_absinfo *slots = &desc.abs[ABS_MT_SLOT];
+
+		for (slot = slots->minimum;
+		     slot <= slots->maximum && slot - slots->minimum < ABS_CNT;
+		     slot++) {
+			ev = add_event(ev, EV_ABS, ABS_MT_SLOT, slot);
+			ev = add_event(ev, EV_ABS, ABS_MT_TRACKING_ID, -1);
+		}
+		ev = add_event(ev, EV_ABS, ABS_MT_SLOT, slots->minimum);
+	}
+
+	/* the kernel drops the events that change nothing */
+	for_each_set_bit(code, desc.codes[EV_KEY], DESC_CODE_CNT)
+		ev = add_event(ev, EV_KEY, code, 0);
+	for_each_set_bit(code, desc.codes[EV_SW], SW_CNT)
+		ev = add_event(ev, EV_SW, code, 0);
+	for_each_set_bit(code, desc.codes[EV_LED], LED_CNT)
+		ev = add_event(ev, EV_LED, code, 0);
+	for_each_set_bit(code, desc.codes[EV_ABS], ABS_MT_SLOT) {
+		const struct input_absinfo *abs = &desc.abs[code];
+		int value = abs->minimum;
+
+		if (abs_rests_centered(code))
+			value = abs->minimum + (abs->maximum - abs->minimum) / 2;
+		ev = add_event(ev, EV_ABS, code, value);
+	}
+	ev = add_event(ev, EV_SYN, SYN_REPORT, 0);
+
+	n = write_device(current_context(), fd, frame, ev - frame);
+	if (n < 0)
+		ret = -errno;
+	else
+		ret = n == (ev - frame) * (ssize_t)sizeof(*frame) ? 0 : -EIO;
+	free(frame);
+	return ret;
+}
@@ -42,8 +42,11 @@
 #ifndef EVEMU_H
 #define EVEMU_H
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <errno.h>
+#include <sys/types.h>
 #include <linux/input.h>
 
 #ifdef __cplusplus
@@ -72,6 +75,18 @@ struct evemu_device *evemu_new(const char *name);
  */
 void evemu_delete(struct evemu_device *dev);
 
+/**
+ * evemu_clone() - allocate a new evemu device with the same description
+ * @dev: the device to copy
+ *
+ * This function allocates a new evemu device and copies the name, id,
+ * properties, event bits and absinfo of the given device. The kernel
+ * device created from dev, if any, is not shared with the copy.
+ *
+ * Returns NULL in case of memory failure.
+ */
+struct evemu_device *evemu_clone(const struct evemu_device *dev);
+
 /**
  * evemu_get_version() - get library version
  * @dev: the device in use
@@ -296,6 +311,52 @@ int evemu_has_event(const struct evemu_device *dev, int type, int code);
  */
 int evemu_has_bit(const struct evemu_device *dev, int type);
 
+/**
+ * evemu_get_event_mask() - copy the supported codes of an event type
+ * @dev: the device in use
+ * @type: the event type, or EV_SYN (0) for the supported event types
+ * @mask: buffer to fill, code n is bit n % 8 of byte n / 8
+ * @size: size of the buffer in bytes
+ *
+ * Fills the mask in a single call, in the layout of EVIOCGBIT, instead
+ * of one evemu_has_event() call per code. As with EVIOCGBIT, type 0
+ * gives one bit per supported event type. A short buffer gets the first
+ * @size bytes.
+ *
+ * Returns the number of bytes the full mask of the type needs, or
+ * -EINVAL for an unknown type.
+ */
+int evemu_get_event_mask(const struct evemu_device *dev, int type,
+			 unsigned char *mask, size_t size);
+
+/**
+ * evemu_get_prop_mask() - copy the input properties of a device
+ * @dev: the device in use
+ * @mask: buffer to fill, property n is bit n % 8 of byte n / 8
+ * @size: size of the buffer in bytes
+ *
+ * Works like evemu_get_event_mask(), for the properties.
+ *
+ * Returns the number of bytes the full property mask needs.
+ */
+int evemu_get_prop_mask(const struct evemu_device *dev,
+			unsigned char *mask, size_t size);
+
+/**
+ * evemu_get_abs_table() - copy the absinfo of all axes
+ * @dev: the device in use
+ * @abs: array to fill, indexed by ABS_* code
+ * @count: number of entries in the array
+ *
+ * Fills the current value, minimum, maximum, fuzz, flat and resolution
+ * of every axis in a single call. Axes the device does not have are
+ * zeroed.
+ *
+ * Returns the number of entries the full table needs, ABS_CNT.
+ */
+int evemu_get_abs_table(const struct evemu_device *dev,
+			struct input_absinfo *abs, size_t count);
+
 /**
  * evemu_extract() - configure evemu instance directly from the kernel device
  * @dev: the device in use
@@ -324,6 +385,147 @@ int evemu_write(const struct evemu_device *dev, FILE *fp);
  */
 int evemu_read(struct evemu_device *dev, FILE *fp);
 
+/**
+ * evemu_read_buffer() - read evemu configuration from memory
+ * @dev: the device in use
+ * @buf: the evemu configuration, need not be NUL-terminated
+ * @size: size of the configuration in bytes
+ *
+ * Like evemu_read(), without going through stdio: the description is
+ * parsed in a single pass over the buffer. Anything after the
+ * description, like events, is ignored.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_read_buffer(struct evemu_device *dev, const char *buf, size_t size);
+
+#define EVEMU_DESC_NAME_SIZE 256
+#define EVEMU_DESC_TYPE_COUNT 32
+#define EVEMU_DESC_CODE_COUNT 1024
+#define EVEMU_DESC_ABS_COUNT 64
+#define EVEMU_DESC_PROP_COUNT 64
+
+/**
+ * struct evemu_desc - a device description as plain data
+ * @name: the device name, longer names are cut off
+ * @id: the bus type, vendor, product and version
+ * @props: the input properties, property n is bit n % 8 of byte n / 8
+ * @types: the supported event types, in the same layout
+ * @codes: the supported codes of every event type, in the same layout
+ * @abs: the absinfo of every axis, indexed by ABS_* code
+ *
+ * Holds what a description file holds, in flat bitmaps like EVIOCGBIT
+ * fills them, without a libevdev context behind it. Descriptions that
+ * are only loaded, queried or written again can skip struct evemu_device
+ * altogether; evemu_desc_to_device() makes the device when one needs to
+ * be created.
+ *
+ * The sizes are the EVEMU_DESC_* constants of the library, not those of
+ * the <linux/input.h> an application is built with, so the struct is the
+ * same for every caller. Types, codes, axes and properties past them are
+ * dropped.
+ */
+struct evemu_desc {
+	char name[EVEMU_DESC_NAME_SIZE];
+	struct input_id id;
+	unsigned char props[EVEMU_DESC_PROP_COUNT / 8];
+	unsigned char types[EVEMU_DESC_TYPE_COUNT / 8];
+	unsigned char codes[EVEMU_DESC_TYPE_COUNT][EVEMU_DESC_CODE_COUNT / 8];
+	struct input_absinfo abs[EVEMU_DESC_ABS_COUNT];
+};
+
+/**
+ * evemu_desc_read() - read a description from a file
+ * @desc: the description to fill
+ * @fp: file pointer to read the description from
+ *
+ * Parses what evemu_read() parses, into @desc. Codes and properties a
+ * device could not have are dropped, as evemu_read() would.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_desc_read(struct evemu_desc *desc, FILE *fp);
+
+/**
+ * evemu_desc_read_buffer() - read a description from memory
+ * @desc: the description to fill
+ * @buf: the description, need not be NUL-terminated
+ * @size: size of the description in bytes
+ *
+ * Works like evemu_read_buffer(), into @desc.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_desc_read_buffer(struct evemu_desc *desc, const char *buf,
+			   size_t size);
+
+/**
+ * evemu_desc_write() - write a description to a file
+ * @desc: the description to write
+ * @fp: file pointer to write the description to
+ *
+ * Writes what evemu_write() writes for the same device.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_desc_write(const struct evemu_desc *desc, FILE *fp);
+
+/**
+ * evemu_desc_from_device() - take the description of a device
+ * @desc: the description to fill
+ * @dev: the device in use
+ */
+void evemu_desc_from_device(struct evemu_desc *desc,
+			    const struct evemu_device *dev);
+
+/**
+ * evemu_desc_to_device() - give a device the capabilities of a description
+ * @desc: the description to apply
+ * @dev: the device in use, usually fresh from evemu_new()
+ *
+ * Sets the ids, properties, codes and absinfo of the description. Like
+ * evemu_read(), the name is only set if the device has none yet.
+ */
+void evemu_desc_to_device(const struct evemu_desc *desc,
+			  struct evemu_device *dev);
+
+/**
+ * evemu_desc_read_cached() - read a description from memory, through a cache
+ * @desc: the description to fill
+ * @buf: the description, need not be NUL-terminated
+ * @size: size of the description in bytes
+ * @cache: path of the binary cache file, or NULL for one named after the
+ * text in $XDG_CACHE_HOME/evemu
+ *
+ * Works like evemu_desc_read_buffer(). If @cache holds the compiled form
+ * of this very text, keyed by a hash of its content, @desc is loaded from
+ * it with a single read instead. Otherwise the text is parsed and @cache
+ * written for the next time; failing to write it is not an error.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_desc_read_cached(struct evemu_desc *desc, const char *buf,
+			   size_t size, const char *cache);
+
+/**
+ * evemu_read_cached() - read a description file, through a cache
+ * @dev: the device in use, usually fresh from evemu_new()
+ * @path: path of the description file
+ *
+ * Works like evemu_read() on the file, with the cache of
+ * evemu_desc_read_cached() kept next to it, at @path with ".cache"
+ * appended. The whole file is hashed, this is meant for description
+ * files rather than long recordings.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_read_cached(struct evemu_device *dev, const char *path);
+
 /**
  * evemu_write_event() - write kernel event to file
  * @fp: file pointer to write the event to
@@ -336,6 +538,19 @@ int evemu_read(struct evemu_device *dev, FILE *fp);
  */
 int evemu_write_event(FILE *fp, const struct input_event *ev);
 
+/**
+ * evemu_write_event_with_id() - write kernel event of a device to file
+ * @fp: file pointer to write the event to
+ * @ev: pointer to the kernel event to write
+ * @dev_id: index of the device in a multi-device recording
+ *
+ * Writes the kernel event to the file in the format read by ev-replay.
+ *
+ * Returns a positive number if successful, zero or negative error
+ * otherwise.
+ */
+int evemu_write_event_with_id(FILE *fp, const struct input_event *ev, int dev_id);
+
 /**
  * evemu_create_event() - Create a single event
  * @ev: pointer to the kernel event to be filled
@@ -357,6 +572,20 @@ int evemu_create_event(struct input_event *ev, int type, int code, int value);
  */
 int evemu_read_event(FILE *fp, struct input_event *ev);
 
+/**
+ * evemu_read_events() - read all kernel events from file into one array
+ * @fp: file pointer to read the events from
+ * @events: set to the array of events, to be freed with free()
+ *
+ * Reads the events until the end of the file into a single contiguous
+ * array, so callers can walk, slice or map them without one call per
+ * event. *@events is NULL if there were no events.
+ *
+ * Returns the number of events read if successful, negative error
+ * otherwise.
+ */
+ssize_t evemu_read_events(FILE *fp, struct input_event **events);
+
 /**
  * evemu_read_event_realtime() - read kernel events in realtime
  * @fp: file pointer to read the event from
@@ -388,6 +617,25 @@ int evemu_read_event_realtime(FILE *fp, struct input_event *ev,
  */
 int evemu_record(FILE *fp, int fd, int ms);
 
+struct evemu_filter;
+
+/**
+ * evemu_record_filtered() - record only the events a filter accepts
+ * @fp: file pointer to write the events to
+ * @fd: file descriptor of kernel device to read from
+ * @ms: maximum time to wait for an event to appear before reading (ms)
+ * @filter: the events to write, or NULL for all events
+ *
+ * Works like evemu_record(), but events the filter does not accept are
+ * not written. The filter is first installed in the kernel with
+ * evemu_filter_apply(), so where supported those events are never read;
+ * otherwise they are read and dropped.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_record_filtered(FILE *fp, int fd, int ms,
+			  const struct evemu_filter *filter);
+
 /**
  * evemu_record_call() - read events directly from multiple kernel device
  * @fp: file pointer to write the events to
@@ -402,6 +650,40 @@ int evemu_record(FILE *fp, int fd, int ms);
  * Returns zero if successful, negative error otherwise.
  */
 int evemu_record_all(FILE* fp, int* fds, int counts, int ms);
+
+/**
+ * evemu_record_all_filtered() - record only the events a filter accepts
+ * @fp: file pointer to write the events to
+ * @fds: file descriptor array of kernel device to read from
+ * @counts: number of devices in fds need to record
+ * @ms: maximum time to wait for an event to appear before reading (ms)
+ * @filter: the events to write, or NULL for all events
+ *
+ * Works like evemu_record_all(), with the filter of
+ * evemu_record_filtered() applied to every device.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_record_all_filtered(FILE *fp, int *fds, int counts, int ms,
+			      const struct evemu_filter *filter);
+
+/**
+ * evemu_read_batch() - read the queued events of a kernel device
+ * @fd: file descriptor of kernel device to read from
+ * @events: array to read the events into
+ * @count: number of events the array holds
+ * @filter: the events to keep, or NULL for all
+ *
+ * Reads up to @count events in a single system call, counted in the
+ * statistics like the reads of evemu_record(). Events the filter does
+ * not accept are removed from the array and counted as filtered. For
+ * tools that record in their own loop.
+ *
+ * Returns the number of events left in the array, which may be zero if
+ * all were filtered, or negative error.
+ */
+int evemu_read_batch(int fd, struct input_event *events, int count,
+		     const struct evemu_filter *filter);
   
 /**
  * evemu_play_one() - play one event to kernel device
@@ -412,6 +694,19 @@ int evemu_record_all(FILE* fp, int* fds, int counts, int ms);
  */
 int evemu_play_one(int fd, const struct input_event *ev);
 
+/**
+ * evemu_play_frame() - play a frame of events to kernel device
+ * @fd: file descriptor of kernel device to write to
+ * @frame: array of kernel events to be played
+ * @count: number of events in the frame
+ *
+ * Writes all events in a single system call. The frame should end with
+ * an EV_SYN/SYN_REPORT event.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_play_frame(int fd, const struct input_event *frame, int count);
+
 /**
  * evemu_play() - replay events from file to kernel device in realtime
  * @fp: file pointer to read the events from
@@ -425,6 +720,135 @@ int evemu_play_one(int fd, const struct input_event *ev);
  */
 int evemu_play(FILE *fp, int fd);
 
+/**
+ * evemu_filter_new() - precompute a (type, code) filter
+ * @dev: the device whose events to accept, or NULL to accept all events
+ *
+ * The filter is a flat bitmap with one bit per event code, built once so
+ * that testing an event is a constant-time bit lookup instead of a
+ * device query. A filter built from a device accepts every event code
+ * the device supports and all of EV_SYN.
+ *
+ * Returns NULL in case of memory failure.
+ */
+struct evemu_filter *evemu_filter_new(const struct evemu_device *dev);
+
+/**
+ * evemu_filter_new_from_fd() - a filter for the events a kernel device supports
+ * @fd: file descriptor of the kernel device
+ *
+ * Same as evemu_filter_new() for the description evemu_extract() gives
+ * for @fd.
+ *
+ * Returns NULL if the device cannot be queried or in case of memory
+ * failure.
+ */
+struct evemu_filter *evemu_filter_new_from_fd(int fd);
+
+/**
+ * evemu_filter_delete() - free a filter
+ * @filter: the filter to free
+ */
+void evemu_filter_delete(struct evemu_filter *filter);
+
+/**
+ * evemu_filter_set() - accept or drop an event code
+ * @filter: the filter to change
+ * @type: the event type
+ * @code: the event code, or -1 for all codes of the type
+ * @accept: nonzero to accept the events, zero to drop them
+ *
+ * Returns zero if successful, or -EINVAL for an unknown type or code.
+ */
+int evemu_filter_set(struct evemu_filter *filter, unsigned int type,
+		     int code, int accept);
+
+/**
+ * evemu_filter_apply() - let the kernel drop the events a filter rejects
+ * @filter: the filter to install
+ * @fd: file descriptor of the kernel device to read from
+ *
+ * Installs the filter on @fd with EVIOCSMASK, so the events it rejects
+ * are not queued for this reader at all. The mask stays on the file
+ * descriptor until it is closed. The kernel only masks codes of some
+ * types and never masks EV_SYN, so readers should still test events
+ * with evemu_filter_accepts(); events queued before the call are not
+ * masked either.
+ *
+ * Returns zero if successful, or a negative error if the kernel does not
+ * support EVIOCSMASK, in which case nothing may have been masked.
+ */
+int evemu_filter_apply(const struct evemu_filter *filter, int fd);
+
+/**
+ * evemu_filter_accepts() - test an event code against a filter
+ * @filter: the filter in use
+ * @type: the event type
+ * @code: the event code
+ *
+ * Returns nonzero if the filter accepts the event, zero otherwise.
+ */
+int evemu_filter_accepts(const struct evemu_filter *filter,
+			 unsigned int type, unsigned int code);
+
+/**
+ * evemu_play_filtered() - replay only the events a filter accepts
+ * @fp: file pointer to read the events from
+ * @fd: file descriptor of kernel device to write to
+ * @filter: the events to write, or NULL for those the device supports
+ *
+ * Works like evemu_play(), but drops the events the filter does not
+ * accept instead of writing them, without a warning. With a NULL filter,
+ * the filter is built from the kernel device once before the replay, so
+ * events the device cannot emit are never written.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_play_filtered(FILE *fp, int fd, const struct evemu_filter *filter);
+
+/**
+ * evemu_wakeup_func_t - told how late evemu_play_timed() woke up
+ * @late_ns: nanoseconds between the deadline and the wakeup
+ * @data: the pointer given to evemu_play_timed()
+ */
+typedef void (*evemu_wakeup_func_t)(long late_ns, void *data);
+
+/**
+ * evemu_play_timed() - replay events against absolute deadlines
+ * @fp: file pointer to read the events from
+ * @fd: file descriptor of kernel device to write to
+ * @filter: the events to accept, or NULL for those the device supports
+ * @drop: nonzero to drop the events the filter does not accept, zero to
+ * write them with a warning
+ * @wakeup: if not NULL, called after every sleep
+ * @data: passed to @wakeup
+ *
+ * Filters, warns and counts like evemu_play() with @drop zero, and like
+ * evemu_play_filtered() otherwise. Each event is written once its time,
+ * counted from the first event, has passed on CLOCK_MONOTONIC, so sleep
+ * overshoot does not add up over a long replay.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_play_timed(FILE *fp, int fd, const struct evemu_filter *filter,
+		     int drop, evemu_wakeup_func_t wakeup, void *data);
+
+/**
+ * evemu_play_fanout() - replay events from file to several kernel devices
+ * @fp: file pointer to read the events from
+ * @fds: file descriptor array of kernel devices to write to
+ * @offsets: per-device delay in microseconds, or NULL for no delay
+ * @count: number of devices in fds
+ *
+ * Reads all events from the file once, then writes every frame to each
+ * of the kernel devices, in realtime. The events for fds[i] are delayed
+ * by offsets[i] microseconds. The function terminates when every device
+ * has received all events.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_play_fanout(FILE *fp, const int *fds, const long *offsets, int count);
+
 /**
  * evemu_create() - create a kernel device from the evemu configuration
  * @dev: the device in use
@@ -457,6 +881,38 @@ int evemu_create_managed(struct evemu_device *dev);
  */
 const char *evemu_get_devnode(struct evemu_device *dev);
 
+/**
+ * evemu_create_all() - create many kernel devices at once
+ * @devs: array of the devices to create
+ * @count: number of devices in the array
+ * @threads: number of threads to create them with, zero or less for one
+ * per CPU
+ *
+ * Works like evemu_create_managed() on every device, with the uinput setup
+ * of the devices spread over @threads. Does not wait for the device
+ * nodes, see evemu_wait_devnodes(). If any device fails, all of them are
+ * destroyed again.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_create_all(struct evemu_device **devs, int count, int threads);
+
+/**
+ * evemu_wait_devnodes() - wait until created devices can be used
+ * @devs: array of created devices
+ * @count: number of devices in the array
+ * @ms: how long to wait at most, in milliseconds, negative to wait
+ * for as long as it takes
+ *
+ * Waits until the device node of every device exists and, when udev
+ * runs, udev has processed it. All devices are waited for through a
+ * single inotify watch.
+ *
+ * Returns zero if successful, -ETIMEDOUT if some node was not ready in
+ * time, negative error otherwise.
+ */
+int evemu_wait_devnodes(struct evemu_device **devs, int count, int ms);
+
 /**
  * evemu_destroy() - destroy all created kernel devices
  * @dev: the device to destroy
@@ -465,6 +921,551 @@ const char *evemu_get_devnode(struct evemu_device *dev);
  */
 void evemu_destroy(struct evemu_device *dev);
 
+/**
+ * evemu_reset_state() - bring a kernel device back to rest
+ * @dev: the device description
+ * @fd: file descriptor of the kernel device to write to
+ *
+ * Writes one frame that lifts every touch of a multitouch device,
+ * releases every key and button, turns off switches and LEDs, and moves
+ * the axes back to rest: position, hat and tilt axes to the middle of
+ * their range, all others to their minimum. The kernel drops the events
+ * that change nothing, so a device already at rest sees an empty frame.
+ * Meant for reusing a created device, e.g. between tests, instead of
+ * creating a new one.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_reset_state(const struct evemu_device *dev, int fd);
+
+/**
+ * enum evemu_gesture - synthetic gestures produced by the generator
+ * @EVEMU_GESTURE_TAP: fingers touch down and lift without motion
+ * @EVEMU_GESTURE_SWIPE: fingers move horizontally across the device
+ * @EVEMU_GESTURE_PINCH: fingers on a circle move towards its center
+ * @EVEMU_GESTURE_PALM: one large contact with random jitter
+ */
+enum evemu_gesture {
+	EVEMU_GESTURE_TAP,
+	EVEMU_GESTURE_SWIPE,
+	EVEMU_GESTURE_PINCH,
+	EVEMU_GESTURE_PALM,
+};
+
+/* A frame of this size holds any frame the generator produces */
+#define EVEMU_GENERATOR_FRAME_SIZE 128
+
+struct evemu_generator;
+
+/**
+ * evemu_generator_new() - create a synthetic gesture generator
+ * @dev: the device description the events are generated for
+ * @gesture: the gesture to repeat
+ * @fingers: number of fingers, limited by the device's slot count
+ * @rate: frames per second, used for the event timestamps
+ * @frames: number of frames per gesture, including touch down and up
+ *
+ * The generator uses the absinfo ranges and the number of multitouch
+ * slots of the device. Devices with ABS_MT_SLOT get protocol B frames,
+ * other absolute devices get single-touch frames. The gesture repeats
+ * endlessly, with new tracking ids for every repetition.
+ *
+ * Returns NULL if the device has no absolute axes or in case of memory
+ * failure.
+ */
+struct evemu_generator *evemu_generator_new(const struct evemu_device *dev,
+					    enum evemu_gesture gesture,
+					    int fingers, int rate, int frames);
+
+/**
+ * evemu_generator_delete() - free a generator
+ * @gen: the generator to free
+ */
+void evemu_generator_delete(struct evemu_generator *gen);
+
+/**
+ * evemu_generator_get_frames() - get the number of frames of one gesture
+ * @gen: the generator in use
+ *
+ * Taps only have their touch down and up frames, other gestures the
+ * number given to evemu_generator_new(), but at least two.
+ *
+ * Returns the number of frames of a gesture, touch down and release included.
+ */
+int evemu_generator_get_frames(const struct evemu_generator *gen);
+
+/**
+ * evemu_generator_next_frame() - generate the next frame of events
+ * @gen: the generator in use
+ * @frame: array to be filled with the events of the frame
+ * @max: number of events the array can hold
+ *
+ * The frame ends with an EV_SYN/SYN_REPORT event and can be passed
+ * straight to evemu_play_frame(). This function does not allocate.
+ *
+ * Returns the number of events in the frame, or -ENOSPC if the frame
+ * is too small. EVEMU_GENERATOR_FRAME_SIZE is always sufficient.
+ */
+int evemu_generator_next_frame(struct evemu_generator *gen,
+			       struct input_event *frame, int max);
+
+/* Events the writer ring holds when no capacity is given */
+#define EVEMU_WRITER_DEFAULT_CAPACITY 65536
+
+/**
+ * struct evemu_writer_stats - counters of an asynchronous writer
+ * @capacity: number of events the ring holds
+ * @occupancy: events waiting to be written
+ * @max_occupancy: highest occupancy seen when pushing
+ * @batches: number of batches pushed, including dropped ones
+ * @events: number of events accepted into the ring
+ * @dropped_batches: number of batches dropped because the ring was full
+ * @dropped_events: number of events in the dropped batches
+ */
+struct evemu_writer_stats {
+	unsigned long capacity;
+	unsigned long occupancy;
+	unsigned long max_occupancy;
+	unsigned long batches;
+	unsigned long events;
+	unsigned long dropped_batches;
+	unsigned long dropped_events;
+};
+
+struct evemu_writer;
+
+/**
+ * evemu_writer_new() - start an asynchronous event writer
+ * @fp: file pointer to write the events to
+ * @capacity: number of events the ring holds, 0 for the default
+ * @with_id: write events with their device id, as evemu_record_all() does
+ *
+ * The ring is allocated up front. A background thread formats the
+ * pushed events, with timestamps relative to the first event, and
+ * flushes @fp whenever the ring runs empty.
+ *
+ * Returns NULL in case of memory failure or if the thread could not be
+ * started.
+ */
+struct evemu_writer *evemu_writer_new(FILE *fp, size_t capacity, int with_id);
+
+/**
+ * evemu_writer_push() - hand a batch of events to the writer
+ * @w: the writer in use
+ * @ev: array of kernel events
+ * @count: number of events in the array
+ * @dev_id: device id written with the events
+ *
+ * Only copies the events, it never waits for the writer thread. Only one
+ * thread may push to a writer.
+ *
+ * Returns zero if successful, or -ENOSPC if the ring was too full and
+ * the whole batch was dropped.
+ */
+int evemu_writer_push(struct evemu_writer *w, const struct input_event *ev,
+		      int count, int dev_id);
+
+/**
+ * evemu_writer_get_stats() - read the counters of a writer
+ * @w: the writer in use
+ * @stats: filled with the current counters
+ *
+ * May be called from any thread, also while events are pushed.
+ */
+void evemu_writer_get_stats(struct evemu_writer *w,
+			    struct evemu_writer_stats *stats);
+
+/**
+ * evemu_writer_delete() - write the remaining events and stop the writer
+ * @w: the writer to free
+ */
+void evemu_writer_delete(struct evemu_writer *w);
+
+/**
+ * evemu_record_all_async() - record several devices through a writer thread
+ * @fp: file pointer to write the events to
+ * @fds: file descriptor array of kernel devices to read from
+ * @count: number of devices in fds
+ * @ms: maximum time to wait for an event to appear before reading (ms)
+ * @stats: filled with the writer counters when recording ends, or NULL
+ *
+ * Writes the same output as evemu_record_all(), but the reading thread
+ * only copies the events into a ring and a writer thread formats them, so
+ * a slow disk does not stall the reading of the devices. If the ring
+ * fills up, events are dropped in whole batches and counted in @stats.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_record_all_async(FILE *fp, int *fds, int count, int ms,
+			   struct evemu_writer_stats *stats);
+
+/**
+ * evemu_record_all_async_filtered() - record only the events a filter accepts
+ * @fp: file pointer to write the events to
+ * @fds: file descriptor array of kernel devices to read from
+ * @count: number of devices in fds
+ * @ms: maximum time to wait for an event to appear before reading (ms)
+ * @filter: the events to write, or NULL for all events
+ * @stats: filled with the writer counters when recording ends, or NULL
+ *
+ * Works like evemu_record_all_async(), with the filter of
+ * evemu_record_filtered() applied to every device. Rejected events are
+ * dropped before they reach the ring.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int evemu_record_all_async_filtered(FILE *fp, int *fds, int count, int ms,
+				    const struct evemu_filter *filter,
+				    struct evemu_writer_stats *stats);
+
+/**
+ * struct evemu_stats - library-wide operation counters
+ * @devices_parsed: device descriptions read by evemu_read()
+ * @devices_written: device descriptions written by evemu_write()
+ * @events_parsed: events read from files
+ * @bytes_parsed: bytes of the event lines read
+ * @events_formatted: events written to files
+ * @bytes_formatted: bytes of the event lines written
+ * @events_read: events read from kernel devices
+ * @read_calls: read() calls on kernel devices
+ * @events_played: events written to kernel devices
+ * @write_calls: write() calls on kernel devices
+ * @sleeps: waits between replayed events
+ * @incompatible_events: replayed events the device does not support
+ * @dropped_events: events dropped by asynchronous writers
+ * @filtered_events: events dropped by a filter while recording or replaying
+ * @parse_ns: time spent reading descriptions and events from files
+ * @format_ns: time spent writing descriptions and events to files
+ * @read_ns: time spent in read() on kernel devices
+ * @write_ns: time spent in write() on kernel devices
+ * @sleep_ns: time spent waiting between replayed events
+ *
+ * The counters are kept per context by the record, play and parse
+ * functions, see evemu_context_use(). The timers only advance while
+ * enabled with evemu_stats_enable_timers() or evemu_context_enable_timers(),
+ * counting costs a relaxed atomic add.
+ */
+struct evemu_stats {
+	uint64_t devices_parsed;
+	uint64_t devices_written;
+	uint64_t events_parsed;
+	uint64_t bytes_parsed;
+	uint64_t events_formatted;
+	uint64_t bytes_formatted;
+	uint64_t events_read;
+	uint64_t read_calls;
+	uint64_t events_played;
+	uint64_t write_calls;
+	uint64_t sleeps;
+	uint64_t incompatible_events;
+	uint64_t dropped_events;
+	uint64_t filtered_events;
+
+	uint64_t parse_ns;
+	uint64_t format_ns;
+	uint64_t read_ns;
+	uint64_t write_ns;
+	uint64_t sleep_ns;
+};
+
+/**
+ * evemu_stats_snapshot() - copy the counters of the default context
+ * @stats: filled with the counters
+ *
+ * May be called from any thread, also while other threads record or play.
+ * Same as evemu_context_get_stats(NULL, stats).
+ */
+void evemu_stats_snapshot(struct evemu_stats *stats);
+
+/**
+ * evemu_stats_reset() - set all counters of the default context to zero
+ */
+void evemu_stats_reset(void);
+
+/**
+ * evemu_stats_enable_timers() - turn the timers of the default context on or off
+ * @enable: nonzero to read the clock around the timed operations
+ *
+ * The timers are off by default, so only the counters cost anything.
+ */
+void evemu_stats_enable_timers(int enable);
+
+/**
+ * evemu_stats_print() - print a counter snapshot in human readable form
+ * @fp: file pointer to print to
+ * @stats: the counters to print
+ */
+void evemu_stats_print(FILE *fp, const struct evemu_stats *stats);
+
+/**
+ * enum evemu_log_priority - importance of a library message
+ * @EVEMU_LOG_ERROR: the operation failed, e.g. on an invalid line
+ * @EVEMU_LOG_WARNING: the operation goes on, but probably not as intended
+ * @EVEMU_LOG_INFO: everything else
+ */
+enum evemu_log_priority {
+	EVEMU_LOG_ERROR = 10,
+	EVEMU_LOG_WARNING = 20,
+	EVEMU_LOG_INFO = 30,
+};
+
+struct evemu_context;
+
+/**
+ * evemu_log_func_t - receives the messages of a context
+ * @ctx: the context the message was logged in
+ * @priority: importance of the message
+ * @data: the pointer given to evemu_context_set_log_func()
+ * @format: printf format of the message, which ends in a newline
+ * @args: arguments of the format
+ */
+typedef void (*evemu_log_func_t)(struct evemu_context *ctx,
+				 enum evemu_log_priority priority,
+				 void *data, const char *format, va_list args);
+
+/**
+ * evemu_context_new() - allocate a new library context
+ *
+ * A context holds the log handler, the rate limits of repeated warnings
+ * and the statistics of everything done under it. A new context logs to
+ * stderr like the default one, warns about three events a device does not
+ * support and then stays quiet.
+ *
+ * Work in different contexts shares no library state, so independent
+ * devices and streams can be driven from different threads in parallel.
+ * Work in the same context only shares atomic counters.
+ *
+ * Returns NULL in case of memory failure.
+ */
+struct evemu_context *evemu_context_new(void);
+
+/**
+ * evemu_context_delete() - free a context
+ * @ctx: the context to free, it must not be in use by any thread or device
+ */
+void evemu_context_delete(struct evemu_context *ctx);
+
+/**
+ * evemu_context_use() - select the context of the calling thread
+ * @ctx: the context to use, or NULL for the default context
+ *
+ * All functions called later from this thread work in @ctx, devices
+ * allocated with evemu_new() stay in the context they were allocated in.
+ * Threads start in the default context. Asynchronous writers run in the
+ * context of the thread that created them.
+ *
+ * Returns the previous context of the thread, NULL for the default one.
+ */
+struct evemu_context *evemu_context_use(struct evemu_context *ctx);
+
+/**
+ * evemu_context_set_log_func() - redirect the messages of a context
+ * @ctx: the context, or NULL for the default context
+ * @func: the handler, or NULL to drop all messages
+ * @data: passed to every call of @func
+ *
+ * The handler is called from the thread that logged the message.
+ */
+void evemu_context_set_log_func(struct evemu_context *ctx,
+				evemu_log_func_t func, void *data);
+
+/**
+ * evemu_context_set_log_priority() - set the least important message logged
+ * @ctx: the context, or NULL for the default context
+ * @priority: messages less important than this are dropped
+ */
+void evemu_context_set_log_priority(struct evemu_context *ctx,
+				    enum evemu_log_priority priority);
+
+/**
+ * evemu_context_get_log_priority() - get the least important message logged
+ * @ctx: the context, or NULL for the default context
+ */
+enum evemu_log_priority evemu_context_get_log_priority(struct evemu_context *ctx);
+
+/**
+ * evemu_context_set_ratelimit() - limit repeated warnings
+ * @ctx: the context, or NULL for the default context
+ * @interval_ms: length of a rate limit interval, 0 for the whole lifetime
+ * @burst: number of warnings logged per interval
+ *
+ * Applies to warnings that may repeat for every event, like replaying
+ * events the device does not support. The defaults are 0 and 3.
+ */
+void evemu_context_set_ratelimit(struct evemu_context *ctx,
+				 unsigned int interval_ms, unsigned int burst);
+
+/**
+ * evemu_context_get_stats() - copy the counters of a context
+ * @ctx: the context, or NULL for the default context
+ * @stats: filled with the counters
+ */
+void evemu_context_get_stats(struct evemu_context *ctx,
+			     struct evemu_stats *stats);
+
+/**
+ * evemu_context_reset_stats() - set all counters of a context to zero
+ * @ctx: the context, or NULL for the default context
+ */
+void evemu_context_reset_stats(struct evemu_context *ctx);
+
+/**
+ * evemu_context_enable_timers() - turn the timers of a context on or off
+ * @ctx: the context, or NULL for the default context
+ * @enable: nonzero to read the clock around the timed operations
+ */
+void evemu_context_enable_timers(struct evemu_context *ctx, int enable);
+
+struct evemu_db;
+struct evemu_db_query;
+
+/**
+ * enum evemu_db_abs_field - absinfo field a query constrains
+ * @EVEMU_DB_ABS_MINIMUM: the minimum of the axis
+ * @EVEMU_DB_ABS_MAXIMUM: the maximum of the axis
+ * @EVEMU_DB_ABS_FUZZ: the fuzz of the axis
+ * @EVEMU_DB_ABS_FLAT: the flat of the axis
+ * @EVEMU_DB_ABS_RESOLUTION: the resolution of the axis
+ * @EVEMU_DB_ABS_RANGE: maximum - minimum + 1, e.g. the number of slots
+ * of ABS_MT_SLOT
+ */
+enum evemu_db_abs_field {
+	EVEMU_DB_ABS_MINIMUM,
+	EVEMU_DB_ABS_MAXIMUM,
+	EVEMU_DB_ABS_FUZZ,
+	EVEMU_DB_ABS_FLAT,
+	EVEMU_DB_ABS_RESOLUTION,
+	EVEMU_DB_ABS_RANGE,
+};
+
+/**
+ * evemu_db_build() - index a directory of device descriptions
+ * @dir: the directory to index, subdirectories are not searched
+ * @path: the index file to write
+ * @threads: number of parsing threads, 0 for one per online CPU
+ *
+ * Parses every file of the directory with evemu_desc_read_buffer(), in
+ * parallel, and writes the capabilities of every device to the index,
+ * in file name order. Files that are not device descriptions are skipped
+ * with a warning; recordings are indexed by their description. The index
+ * replaces @path atomically.
+ *
+ * Returns the number of devices indexed, or a negative error.
+ */
+int evemu_db_build(const char *dir, const char *path, int threads);
+
+/**
+ * evemu_db_open() - map an index written by evemu_db_build()
+ * @path: the index file
+ *
+ * The index is used in place, nothing is parsed or copied. An index
+ * written by a library with a different set of event codes is rejected,
+ * it needs to be built again.
+ *
+ * Returns NULL and sets errno in case of failure.
+ */
+struct evemu_db *evemu_db_open(const char *path);
+
+/**
+ * evemu_db_close() - unmap an index
+ * @db: the index to close
+ */
+void evemu_db_close(struct evemu_db *db);
+
+/**
+ * evemu_db_get_count() - get the number of devices of an index
+ * @db: the index in use
+ */
+unsigned int evemu_db_get_count(const struct evemu_db *db);
+
+/**
+ * evemu_db_get_path() - get the file a device was read from
+ * @db: the index in use
+ * @index: the device, from 0 to evemu_db_get_count() - 1
+ *
+ * Returns the file name relative to the indexed directory, or NULL for
+ * an invalid index.
+ */
+const char *evemu_db_get_path(const struct evemu_db *db, unsigned int index);
+
+/**
+ * evemu_db_get_name() - get the name of a device
+ * @db: the index in use
+ * @index: the device, from 0 to evemu_db_get_count() - 1
+ *
+ * Returns the device name, or NULL for an invalid index.
+ */
+const char *evemu_db_get_name(const struct evemu_db *db, unsigned int index);
+
+/**
+ * evemu_db_query_new() - allocate a query that matches every device
+ *
+ * Returns NULL in case of memory failure.
+ */
+struct evemu_db_query *evemu_db_query_new(void);
+
+/**
+ * evemu_db_query_delete() - free a query
+ * @q: the query to free
+ */
+void evemu_db_query_delete(struct evemu_db_query *q);
+
+/**
+ * evemu_db_query_require_prop() - match on an input property
+ * @q: the query to change
+ * @prop: the INPUT_PROP_* property
+ * @present: nonzero to match devices with the property, zero without
+ *
+ * Returns zero if successful, or -EINVAL for an unknown property.
+ */
+int evemu_db_query_require_prop(struct evemu_db_query *q, unsigned int prop,
+				int present);
+
+/**
+ * evemu_db_query_require_event() - match on an event type or code
+ * @q: the query to change
+ * @type: the event type
+ * @code: the event code, or -1 for the type itself
+ * @present: nonzero to match devices with the type or code, zero without
+ *
+ * Returns zero if successful, or -EINVAL for an unknown type or code.
+ */
+int evemu_db_query_require_event(struct evemu_db_query *q, unsigned int type,
+				 int code, int present);
+
+/**
+ * evemu_db_query_require_abs() - match on the absinfo of an axis
+ * @q: the query to change
+ * @code: the ABS_* axis, which matching devices have
+ * @field: the absinfo field to test
+ * @min: the lowest value that matches
+ * @max: the highest value that matches
+ *
+ * Ranges add up, a device matches if it is within all of them.
+ *
+ * Returns zero if successful, -EINVAL for an unknown axis or field, or
+ * -ENOMEM.
+ */
+int evemu_db_query_require_abs(struct evemu_db_query *q, unsigned int code,
+			       enum evemu_db_abs_field field,
+			       int32_t min, int32_t max);
+
+/**
+ * evemu_db_match() - find the devices of an index that match a query
+ * @db: the index in use
+ * @q: the query to run
+ * @matches: set to an array of the matching device indices, in index
+ * order, which the caller frees
+ *
+ * The capability tests of the query are compared against the bitset of
+ * every device in a single branch-free pass, the absinfo ranges are only
+ * checked for the devices that pass them.
+ *
+ * Returns the number of matching devices, or -ENOMEM.
+ */
+ssize_t evemu_db_match(const struct evemu_db *db,
+		       const struct evemu_db_query *q, unsigned int **matches);
+
 #ifdef __cplusplus
 }
 #endif
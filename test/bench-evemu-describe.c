@@ -0,0 +1,150 @@
+/*
+ * Benchmark reading and writing device descriptions: every .prop file of
+ * the data directory is parsed, from a stream and from memory, and written
+ * back, over and over. The same again without a device, through
+ * struct evemu_desc, and through the binary description cache.
+ *
+ * Usage: bench-evemu-describe [devices] [file.prop...]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glob.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include "evemu.h"
+
+#define DEFAULT_DEVICES 5000
+
+struct description {
+	char *data;
+	size_t size;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void load(const char *path, struct description *desc)
+{
+	FILE *fp = fopen(path, "r");
+
+	assert(fp);
+	desc->data = NULL;
+	desc->size = 0;
+	assert(getdelim(&desc->data, &desc->size, '\0', fp) > 0);
+	desc->size = strlen(desc->data);
+	fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	struct description *descs;
+	glob_t files;
+	char **paths;
+	size_t count, i;
+	long devices = DEFAULT_DEVICES;
+	double read_time = 0, buffer_time = 0, write_time = 0;
+	double desc_read_time = 0, desc_write_time = 0, cached_time = 0;
+	char cache_dir[] = "/tmp/evemu-bench.XXXXXX";
+	char cache[PATH_MAX];
+	struct evemu_desc plain;
+	FILE *out;
+	long n;
+
+	if (argc > 1)
+		devices = atol(argv[1]);
+	if (argc > 2) {
+		paths = argv + 2;
+		count = argc - 2;
+	} else {
+		assert(glob(DATA_DIR "/*.prop", 0, NULL, &files) == 0);
+		paths = files.gl_pathv;
+		count = files.gl_pathc;
+	}
+
+	descs = calloc(count, sizeof(*descs));
+	assert(descs);
+	for (i = 0; i < count; i++)
+		load(paths[i], &descs[i]);
+
+	out = fopen("/dev/null", "w");
+	assert(out);
+	assert(mkdtemp(cache_dir));
+
+	for (n = 0; n < devices; n++) {
+		struct description *desc = &descs[n % count];
+		struct evemu_device *dev;
+		FILE *fp;
+		double start;
+
+		fp = fmemopen(desc->data, desc->size, "r");
+		assert(fp);
+		dev = evemu_new(NULL);
+		assert(dev);
+
+		start = now();
+		assert(evemu_read(dev, fp) > 0);
+		read_time += now() - start;
+
+		start = now();
+		assert(evemu_write(dev, out) == 0);
+		fflush(out);
+		write_time += now() - start;
+
+		evemu_delete(dev);
+		fclose(fp);
+
+		dev = evemu_new(NULL);
+		assert(dev);
+		start = now();
+		assert(evemu_read_buffer(dev, desc->data, desc->size) > 0);
+		buffer_time += now() - start;
+		evemu_delete(dev);
+
+		start = now();
+		assert(evemu_desc_read_buffer(&plain, desc->data, desc->size) > 0);
+		desc_read_time += now() - start;
+
+		start = now();
+		assert(evemu_desc_write(&plain, out) == 0);
+		fflush(out);
+		desc_write_time += now() - start;
+
+		snprintf(cache, sizeof(cache), "%s/%zu", cache_dir, n % count);
+		start = now();
+		assert(evemu_desc_read_cached(&plain, desc->data, desc->size,
+					      cache) > 0);
+		cached_time += now() - start;
+	}
+
+	printf("%ld descriptions from %zu files\n", devices, count);
+	printf("  read   %8.2f us per device\n", read_time * 1e6 / devices);
+	printf("  buffer %8.2f us per device\n", buffer_time * 1e6 / devices);
+	printf("  write  %8.2f us per device\n", write_time * 1e6 / devices);
+	printf("plain descriptions, no device\n");
+	printf("  read   %8.2f us per device\n", desc_read_time * 1e6 / devices);
+	printf("  write  %8.2f us per device\n", desc_write_time * 1e6 / devices);
+	printf("  cached %8.2f us per device\n", cached_time * 1e6 / devices);
+
+	fclose(out);
+	for (i = 0; i < count; i++) {
+		snprintf(cache, sizeof(cache), "%s/%zu", cache_dir, i);
+		unlink(cache);
+		free(descs[i].data);
+	}
+	rmdir(cache_dir);
+	free(descs);
+	if (argc <= 2)
+		globfree(&files);
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Benchmark the gesture generator: frames of every gesture are generated
+ * for a device, over and over, as fast as the generator goes.
+ *
+ * Usage: bench-evemu-gen [frames] [file.prop] [fingers]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+#include "evemu.h"
+
+#define DEFAULT_FRAMES 2000000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "tap", "swipe", "pinch", "palm" };
+	struct input_event frame[EVEMU_GENERATOR_FRAME_SIZE];
+	const char *path = DATA_DIR "/synaptics.prop";
+	long frames = DEFAULT_FRAMES;
+	int fingers = 2;
+	struct evemu_device *dev;
+	FILE *fp;
+	int g;
+
+	if (argc > 1)
+		frames = atol(argv[1]);
+	if (argc > 2)
+		path = argv[2];
+	if (argc > 3)
+		fingers = atoi(argv[3]);
+
+	fp = fopen(path, "r");
+	assert(fp);
+	dev = evemu_new(NULL);
+	assert(dev && evemu_read(dev, fp) > 0);
+	fclose(fp);
+
+	printf("%ld frames of %d fingers on %s\n", frames, fingers,
+	       evemu_get_name(dev));
+	for (g = EVEMU_GESTURE_TAP; g <= EVEMU_GESTURE_PALM; g++) {
+		struct evemu_generator *gen;
+		long n, events = 0;
+		double start, time;
+
+		gen = evemu_generator_new(dev, g, fingers, 1000, 50);
+		assert(gen);
+
+		start = now();
+		for (n = 0; n < frames; n++)
+			events += evemu_generator_next_frame(gen, frame,
+							     EVEMU_GENERATOR_FRAME_SIZE);
+		time = now() - start;
+
+		printf("  %-6s %8.2f M frames/s %8.2f M events/s\n", names[g],
+		       frames / time / 1e6, events / time / 1e6);
+		evemu_generator_delete(gen);
+	}
+
+	evemu_delete(dev);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Test that the record and replay loops do not allocate once they are
+ * set up, by counting the calls to malloc and friends.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+#define NEVENTS 1000
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static int counting;
+static unsigned long allocations;
+
+void *malloc(size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (counting)
+		allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+static unsigned long replay(FILE *fp, int fd)
+{
+	struct input_event ev;
+	unsigned long n = 0;
+
+	while (evemu_read_event_realtime(fp, &ev, NULL) > 0) {
+		assert(evemu_play_one(fd, &ev) == 0);
+		n++;
+	}
+
+	return n;
+}
+
+static void check_replay(void)
+{
+	struct evemu_device *dev;
+	unsigned long n;
+	long events;
+	FILE *fp;
+	int fd;
+
+	fp = fopen(DATA_DIR "/3m.event", "r");
+	assert(fp);
+	fd = open("/dev/null", O_WRONLY);
+	assert(fd >= 0);
+
+	dev = evemu_new(NULL);
+	assert(dev);
+	assert(evemu_read(dev, fp) > 0);
+	events = ftell(fp);
+
+	/* the first pass sees the longest line */
+	replay(fp, fd);
+	fseek(fp, events, SEEK_SET);
+
+	allocations = 0;
+	counting = 1;
+	n = replay(fp, fd);
+	counting = 0;
+
+	assert(n > 40000);
+	assert(allocations == 0);
+
+	evemu_delete(dev);
+	close(fd);
+	fclose(fp);
+}
+
+static void feed(int fd)
+{
+	struct input_event ev;
+	int i;
+
+	for (i = 0; i < NEVENTS; i++) {
+		evemu_create_event(&ev, i % 2 ? EV_SYN : EV_REL,
+				   i % 2 ? SYN_REPORT : REL_X, i % 2 ? 0 : 1);
+		ev.time.tv_sec = 100 + i / 1000;
+		ev.time.tv_usec = i % 1000 * 1000;
+		assert(write(fd, &ev, sizeof(ev)) == sizeof(ev));
+	}
+}
+
+/* a pipe stands in for the device, recording ends when it runs dry */
+static void check_record(void)
+{
+	FILE *out;
+	int fds[2];
+
+	assert(pipe(fds) == 0);
+	out = fopen("/dev/null", "w");
+	assert(out);
+
+	feed(fds[1]);
+	assert(evemu_record(out, fds[0], 50) == 0);
+
+	feed(fds[1]);
+	allocations = 0;
+	counting = 1;
+	assert(evemu_record(out, fds[0], 50) == 0);
+	counting = 0;
+
+	assert(allocations == 0);
+
+	fclose(out);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+int main(void)
+{
+	check_replay();
+	check_record();
+	return 0;
+}
@@ -2,6 +2,7 @@
  * Test that device creation works.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -67,11 +68,101 @@ static void println(int fd, int flags, const char *format, ...)
 	va_end(args);
 }
 
+static struct evemu_device *new_device(enum flags flags, const char **device_name)
+{
+	struct evemu_device *dev;
+
+	if (flags & WITHNAME) {
+		dev = evemu_new(CUSTOM_NAME);
+		*device_name = CUSTOM_NAME;
+	} else {
+		dev = evemu_new(NULL);
+		*device_name = NAME;
+	}
+	assert(dev);
+	return dev;
+}
+
+static void check_device(struct evemu_device *dev, const char *device_name,
+			 enum flags flags)
+{
+	assert(strcmp(device_name, evemu_get_name(dev)) == 0);
+	assert(evemu_get_id_bustype(dev) == 0x0003);
+	assert(evemu_get_id_vendor(dev) == 0x0004);
+	assert(evemu_get_id_product(dev) == 0x0005);
+	assert(evemu_get_id_version(dev) == 0x0006);
+
+#ifdef INPUT_PROP_MAX
+	if (flags & PROPS) {
+		int i;
+		for (i = 0; i < INPUT_PROP_CNT; i++)
+			assert(evemu_has_prop(dev, i));
+	}
+#endif
+
+	if (flags & BITS) {
+		int i, j;
+		for (i = 1; i < EV_CNT; i++) {
+			if (!evemu_has_bit(dev, i))
+				continue;
+
+			for (j = 0; j < max[i]; j++)
+				assert(evemu_has_event(dev, i, j));
+		}
+	}
+
+	if (flags & ABSINFO) {
+		int i;
+		for (i = 0; i < ABS_CNT; i++) {
+			if (!evemu_has_event(dev, EV_ABS, i))
+				continue;
+			assert(evemu_get_abs_minimum(dev, i) == i + 1);
+			assert(evemu_get_abs_maximum(dev, i) == i + 2);
+			assert(evemu_get_abs_fuzz(dev, i) == i + 3);
+			assert(evemu_get_abs_flat(dev, i) == i + 4);
+		}
+	}
+}
+
+static char *describe(struct evemu_device *dev, const struct evemu_desc *desc)
+{
+	char *text = NULL;
+	size_t size;
+	FILE *fp;
+
+	fp = open_memstream(&text, &size);
+	assert(fp);
+	if (dev)
+		assert(evemu_write(dev, fp) == 0);
+	else
+		assert(evemu_desc_write(desc, fp) == 0);
+	fclose(fp);
+
+	return text;
+}
+
+static void check_same_description(struct evemu_device *dev,
+				   struct evemu_device *other,
+				   const struct evemu_desc *desc)
+{
+	char *expected = describe(dev, NULL);
+	char *text = describe(other, desc);
+
+	assert(strcmp(expected, text) == 0);
+	free(expected);
+	free(text);
+}
+
 void check_evemu_read(int fd, const char *file, enum flags flags)
 {
 	FILE *fp;
-	struct evemu_device *dev;
+	struct evemu_device *dev, *mdev;
+	struct evemu_desc desc;
 	const char *device_name;
+	char *buf = NULL;
+	size_t size = 0;
+	char cache[64];
+	int pass;
 
 	ftruncate(fd, 0);
 	lseek(fd, 0, SEEK_SET);
@@ -148,55 +239,48 @@ void check_evemu_read(int fd, const char *file, enum flags flags)
 
 	fp = fopen(file, "r");
 	assert(fp);
-
-	if (flags & WITHNAME) {
-		dev = evemu_new(CUSTOM_NAME);
-		device_name = CUSTOM_NAME;
-	} else {
-		dev = evemu_new(NULL);
-		device_name = NAME;
-	}
-	assert(dev);
+	dev = new_device(flags, &device_name);
 	assert(evemu_read(dev, fp) >= 0);
-	assert(strcmp(device_name, evemu_get_name(dev)) == 0);
-	assert(evemu_get_id_bustype(dev) == 0x0003);
-	assert(evemu_get_id_vendor(dev) == 0x0004);
-	assert(evemu_get_id_product(dev) == 0x0005);
-	assert(evemu_get_id_version(dev) == 0x0006);
-
-#ifdef INPUT_PROP_MAX
-	if (flags & PROPS) {
-		int i;
-		for (i = 0; i < INPUT_PROP_CNT; i++)
-			assert(evemu_has_prop(dev, i));
-	}
-#endif
+	check_device(dev, device_name, flags);
+	fclose(fp);
 
-	if (flags & BITS) {
-		int i, j;
-		for (i = 1; i < EV_CNT; i++) {
-			if (!evemu_has_bit(dev, i))
-				continue;
+	/* the same description parsed from memory */
+	fp = fopen(file, "r");
+	assert(fp);
+	assert(getdelim(&buf, &size, '\0', fp) > 0);
+	fclose(fp);
+	mdev = new_device(flags, &device_name);
+	assert(evemu_read_buffer(mdev, buf, strlen(buf)) >= 0);
+	check_device(mdev, device_name, flags);
+	check_same_description(dev, mdev, NULL);
 
-			for (j = 0; j < max[i]; j++)
-				assert(evemu_has_event(dev, i, j));
-		}
-	}
+	/* and into a plain description, then into a device again */
+	assert(evemu_desc_read_buffer(&desc, buf, strlen(buf)) >= 0);
+	/* the description has the name of the file, never the custom one */
+	assert(strcmp(desc.name, NAME) == 0);
+	strcpy(desc.name, device_name);
+	check_same_description(dev, NULL, &desc);
+	evemu_delete(mdev);
+	mdev = new_device(flags, &device_name);
+	evemu_desc_to_device(&desc, mdev);
+	check_device(mdev, device_name, flags);
+	check_same_description(dev, mdev, NULL);
 
-	if (flags & ABSINFO) {
-		int i;
-		for (i = 0; i < ABS_CNT; i++) {
-			if (!evemu_has_event(dev, EV_ABS, i))
-				continue;
-			assert(evemu_get_abs_minimum(dev, i) == i + 1);
-			assert(evemu_get_abs_maximum(dev, i) == i + 2);
-			assert(evemu_get_abs_fuzz(dev, i) == i + 3);
-			assert(evemu_get_abs_flat(dev, i) == i + 4);
-		}
+	/* through the binary cache, compiled on the first read and loaded on
+	   the second; the cache of the previous format is stale by now */
+	for (pass = 0; pass < 2; pass++) {
+		evemu_delete(mdev);
+		mdev = new_device(flags, &device_name);
+		assert(evemu_read_cached(mdev, file) > 0);
+		check_device(mdev, device_name, flags);
+		check_same_description(dev, mdev, NULL);
 	}
+	snprintf(cache, sizeof(cache), "%s.cache", file);
+	assert(access(cache, R_OK) == 0);
 
+	evemu_delete(mdev);
 	evemu_delete(dev);
-	fclose(fp);
+	free(buf);
 }
 
 static void check_valid_formats(int fd, const char *file)
@@ -210,6 +294,7 @@ int main(int argc UNUSED, char **argv UNUSED) {
 	int fd = 0;
 
 	char tmpname[] = "evemu.tmp.XXXXXXX";
+	char cache[64];
 
 	if ((fd = mkstemp(tmpname)) == -1) {
 		perror("");
@@ -220,5 +305,7 @@ int main(int argc UNUSED, char **argv UNUSED) {
 
 	close(fd);
 	unlink(tmpname);
+	snprintf(cache, sizeof(cache), "%s.cache", tmpname);
+	unlink(cache);
 	return 0;
 }
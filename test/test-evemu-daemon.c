@@ -0,0 +1,213 @@
+/*
+ * Test the protocol of evemu-daemon on one end of a socketpair. The device
+ * writes to a pipe instead of a uinput node, so the test sees exactly what
+ * the daemon writes for the events it is sent.
+ */
+
+#define main daemon_main
+#include "evemu-daemon.c"
+#include "evemu-counters.c"
+#undef main
+
+#include <assert.h>
+
+#define EVENTS_MAX 64
+
+static int peer;		/* the client's end of the socket */
+static struct client *client;
+
+static void send_all(const void *data, size_t size)
+{
+	assert(write(peer, data, size) == (ssize_t)size);
+}
+
+static void send_str(const char *s)
+{
+	send_all(s, strlen(s));
+}
+
+/* lets the daemon handle what was sent, returns its answers */
+static const char *handle(void)
+{
+	static char answer[OUT_SIZE + 1];
+	ssize_t n;
+
+	assert(read_client(client) == 0);
+	assert(send_replies(client) == 0);
+	n = read(peer, answer, sizeof(answer) - 1);
+	answer[n > 0 ? n : 0] = '\0';
+	return answer;
+}
+
+/* a device on handle 0, returns the read end of its "device node" */
+static int add_device(void)
+{
+	struct vdev *v;
+	int fds[2];
+
+	assert(pipe2(fds, O_NONBLOCK) == 0);
+	v = calloc(1, sizeof(*v));
+	assert(v);
+	v->dev = evemu_new(NULL);
+	assert(v->dev);
+	v->fd = fds[1];
+
+	devices = calloc(1, sizeof(*devices));
+	dirty = calloc(1, sizeof(*dirty));
+	assert(devices && dirty);
+	devices[0] = v;
+	device_count = 1;
+
+	return fds[0];
+}
+
+static int read_events(int fd, struct input_event *evs)
+{
+	ssize_t n = read(fd, evs, EVENTS_MAX * sizeof(*evs));
+
+	if (n < 0 && errno == EAGAIN)
+		return 0;
+	assert(n >= 0 && n % sizeof(*evs) == 0);
+	return n / sizeof(*evs);
+}
+
+static void assert_event(const struct input_event *ev, unsigned int type,
+			 unsigned int code, int value)
+{
+	assert(ev->type == type && ev->code == code && ev->value == value);
+}
+
+/* lines of ev-record, comments and all, are written as read */
+static void test_text_events(int node)
+{
+	struct input_event expected[EVENTS_MAX], written[EVENTS_MAX];
+	char *line = NULL;
+	size_t size = 0;
+	FILE *fp;
+	int i, n = 0;
+
+	fp = fopen(DATA_DIR "/3m.event", "r");
+	assert(fp);
+	while (n < EVENTS_MAX && getline(&line, &size, fp) > 0) {
+		char cmd[512];
+
+		if (strncmp(line, "E: ", 3) != 0)
+			continue;
+		assert(evemu_create_event(&expected[n], 0, 0, 0) == 0);
+		assert(sscanf(line, "E: %*u.%*u %hx %hx %d", &expected[n].type,
+			      &expected[n].code, &expected[n].value) == 3);
+		assert(strchr(line, '#'));
+		snprintf(cmd, sizeof(cmd), "E: 0 %s", line + 3);
+		send_str(cmd);
+		n++;
+	}
+	free(line);
+	fclose(fp);
+	assert(n > 0);
+
+	send_str("sync\n");
+	assert(strcmp(handle(), "ok\n") == 0);
+
+	assert(read_events(node, written) == n);
+	for (i = 0; i < n; i++)
+		assert_event(&written[i], expected[i].type, expected[i].code,
+			     expected[i].value);
+}
+
+static void test_binary_events(int node)
+{
+	struct daemon_event evs[] = {
+		{ EV_ABS, ABS_X, 100 },
+		{ EV_KEY, BTN_TOUCH, 1 },
+		{ EV_SYN, SYN_REPORT, 0 },
+	};
+	struct input_event written[EVENTS_MAX];
+
+	/* the events may arrive in pieces */
+	send_str("B 0 3\n");
+	send_all(evs, 5);
+	assert(strcmp(handle(), "") == 0);
+	send_all((char *)evs + 5, sizeof(evs) - 5);
+	send_str("sync\n");
+	assert(strcmp(handle(), "ok\n") == 0);
+
+	assert(read_events(node, written) == 3);
+	assert_event(&written[0], EV_ABS, ABS_X, 100);
+	assert_event(&written[1], EV_KEY, BTN_TOUCH, 1);
+	assert_event(&written[2], EV_SYN, SYN_REPORT, 0);
+}
+
+static void test_errors(int node)
+{
+	struct daemon_event ev = { EV_KEY, BTN_TOUCH, 1 };
+	struct input_event written[EVENTS_MAX];
+
+	send_str("E: 0 1.000000 0003 0000 12 trailing garbage\n");
+	assert(strncmp(handle(), "error invalid event", 19) == 0);
+	send_str("E: 0 1.000000 0003\n0000 12\n");
+	assert(strncmp(handle(), "error invalid event", 19) == 0);
+	send_str("E: 7 1.000000 0003 0000 12\n");
+	assert(strcmp(handle(), "error no device 7\n") == 0);
+	/* a handle out of range is no device, and its events go nowhere */
+	send_str("B 4294967296 1\n");
+	send_all(&ev, sizeof(ev));
+	assert(strcmp(handle(), "error no device 4294967296\n") == 0);
+	send_str("bogus\n");
+	assert(strncmp(handle(), "error unknown command bogus", 27) == 0);
+	send_str("create 5\nbogus");
+	assert(strcmp(handle(), "error invalid description\n") == 0);
+
+	send_str("sync\n");
+	assert(strcmp(handle(), "ok\n") == 0);
+	assert(read_events(node, written) == 0);
+}
+
+/* queued events are written before the device goes */
+static void test_destroy(int node)
+{
+	struct input_event written[EVENTS_MAX];
+
+	send_str("E: 0 1.000000 0001 014a 1\n");
+	send_str("destroy 0\n");
+	assert(strcmp(handle(), "ok\n") == 0);
+	assert(devices[0] == NULL);
+
+	assert(read_events(node, written) == 1);
+	assert_event(&written[0], EV_KEY, BTN_TOUCH, 1);
+	/* the daemon closed its end */
+	assert(read(node, written, sizeof(written)) == 0);
+
+	send_str("destroy 0\n");
+	assert(strcmp(handle(), "error no device 0\n") == 0);
+}
+
+int main(void)
+{
+	int sv[2], node;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+	client = calloc(1, sizeof(*client));
+	assert(client);
+	client->fd = sv[0];
+	peer = sv[1];
+
+	node = add_device();
+
+	test_text_events(node);
+	test_binary_events(node);
+	test_errors(node);
+	test_destroy(node);
+
+	/* a client that breaks the protocol is dropped */
+	send_str("B 0 -1\n");
+	assert(read_client(client) < 0);
+
+	close(node);
+	close(peer);
+	close(client->fd);
+	free(client);
+	free(devices);
+	free(dirty);
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * Test that the device database indexes the data directory and that its
+ * queries match the same devices as asking every parsed device directly.
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+struct predicate {
+	int type;		/* -1 for a property */
+	int code;		/* -1 for the type itself */
+	int present;
+	int abs_field;		/* -1 for none */
+	int min, max;
+};
+
+static struct evemu_device *load(const char *path)
+{
+	struct evemu_device *dev;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	assert(fp);
+	dev = evemu_new(NULL);
+	assert(dev);
+	assert(evemu_read(dev, fp) > 0);
+	fclose(fp);
+
+	return dev;
+}
+
+static int abs_value(struct evemu_device *dev, int code, int field)
+{
+	switch (field) {
+	case EVEMU_DB_ABS_MINIMUM: return evemu_get_abs_minimum(dev, code);
+	case EVEMU_DB_ABS_MAXIMUM: return evemu_get_abs_maximum(dev, code);
+	case EVEMU_DB_ABS_FUZZ: return evemu_get_abs_fuzz(dev, code);
+	case EVEMU_DB_ABS_FLAT: return evemu_get_abs_flat(dev, code);
+	case EVEMU_DB_ABS_RESOLUTION: return evemu_get_abs_resolution(dev, code);
+	default:
+		return evemu_get_abs_maximum(dev, code) -
+		       evemu_get_abs_minimum(dev, code) + 1;
+	}
+}
+
+static int matches(struct evemu_device *dev, const struct predicate *p, int n)
+{
+	int i, has;
+
+	for (i = 0; i < n; i++) {
+		if (p[i].type < 0)
+			has = evemu_has_prop(dev, p[i].code);
+		else if (p[i].code < 0)
+			has = evemu_has_bit(dev, p[i].type);
+		else
+			has = evemu_has_event(dev, p[i].type, p[i].code);
+		if (has != p[i].present)
+			return 0;
+
+		if (p[i].abs_field >= 0) {
+			int value = abs_value(dev, p[i].code, p[i].abs_field);
+
+			if (value < p[i].min || value > p[i].max)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void check_query(struct evemu_db *db, const struct predicate *p, int n)
+{
+	struct evemu_db_query *q;
+	unsigned int *found;
+	unsigned int i, next = 0;
+	ssize_t nfound;
+	int j;
+
+	q = evemu_db_query_new();
+	assert(q);
+	for (j = 0; j < n; j++) {
+		if (p[j].abs_field >= 0)
+			assert(evemu_db_query_require_abs(q, p[j].code, p[j].abs_field,
+							  p[j].min, p[j].max) == 0);
+		else if (p[j].type < 0)
+			assert(evemu_db_query_require_prop(q, p[j].code,
+							   p[j].present) == 0);
+		else
+			assert(evemu_db_query_require_event(q, p[j].type, p[j].code,
+							    p[j].present) == 0);
+	}
+
+	nfound = evemu_db_match(db, q, &found);
+	assert(nfound >= 0);
+
+	for (i = 0; i < evemu_db_get_count(db); i++) {
+		char path[PATH_MAX];
+		struct evemu_device *dev;
+		int expected;
+
+		snprintf(path, sizeof(path), "%s/%s", DATA_DIR,
+			 evemu_db_get_path(db, i));
+		dev = load(path);
+		assert(strcmp(evemu_get_name(dev), evemu_db_get_name(db, i)) == 0);
+
+		expected = matches(dev, p, n);
+		if (expected) {
+			assert(next < nfound && found[next] == i);
+			next++;
+		}
+		evemu_delete(dev);
+	}
+	assert(next == nfound);
+
+	free(found);
+	evemu_db_query_delete(q);
+}
+
+/* walks everything an index points to */
+static void use_index(const char *path)
+{
+	struct evemu_db_query *q;
+	struct evemu_db *db;
+	unsigned int *found;
+	unsigned int i;
+
+	db = evemu_db_open(path);
+	if (!db)
+		return;
+	for (i = 0; i < evemu_db_get_count(db); i++)
+		assert(strlen(evemu_db_get_path(db, i)) +
+		       strlen(evemu_db_get_name(db, i)) < 1 << 20);
+
+	q = evemu_db_query_new();
+	assert(q);
+	assert(evemu_db_query_require_abs(q, ABS_MT_SLOT, EVEMU_DB_ABS_RANGE,
+					  0, 1 << 30) == 0);
+	if (evemu_db_match(db, q, &found) >= 0)
+		free(found);
+	evemu_db_query_delete(q);
+	evemu_db_close(db);
+}
+
+/* a truncated or scribbled on index is refused or stays in bounds */
+static void check_corrupt(const char *index)
+{
+	char path[] = "evemu.tmp.XXXXXX";
+	char *buf;
+	long size, off;
+	FILE *fp;
+	int fd;
+
+	fp = fopen(index, "r");
+	assert(fp);
+	assert(fseek(fp, 0, SEEK_END) == 0);
+	size = ftell(fp);
+	rewind(fp);
+	buf = malloc(size);
+	assert(buf && fread(buf, 1, size, fp) == (size_t)size);
+	fclose(fp);
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+
+	for (off = 0; off < size; off += 4) {
+		uint32_t word, bad = 0xfffffff0;
+		uint64_t offset, wrap = (uint64_t)-8;
+
+		memcpy(&word, buf + off, 4);
+		memcpy(buf + off, &bad, 4);
+		assert(pwrite(fd, buf, size, 0) == size);
+		use_index(path);
+		memcpy(buf + off, &word, 4);
+
+		/* offsets close to 2^64 wrap around when added to */
+		if (off % 8 == 0 && off + 8 <= size) {
+			memcpy(&offset, buf + off, 8);
+			memcpy(buf + off, &wrap, 8);
+			assert(pwrite(fd, buf, size, 0) == size);
+			use_index(path);
+			memcpy(buf + off, &offset, 8);
+		}
+
+		assert(ftruncate(fd, off) == 0);
+		use_index(path);
+	}
+
+	close(fd);
+	unlink(path);
+	free(buf);
+}
+
+int main(void)
+{
+	const struct predicate touchscreen[] = {
+		{ EV_ABS, -1, 1, -1, 0, 0 },
+		{ EV_KEY, BTN_TOUCH, 1, -1, 0, 0 },
+		{ EV_KEY, BTN_TOOL_FINGER, 0, -1, 0, 0 },
+	};
+	const struct predicate slots[] = {
+		{ EV_ABS, ABS_MT_SLOT, 1, EVEMU_DB_ABS_RANGE, 6, 1 << 30 },
+	};
+	const struct predicate buttonpad[] = {
+		{ -1, INPUT_PROP_BUTTONPAD, 1, -1, 0, 0 },
+		{ EV_ABS, ABS_MT_POSITION_X, 1, -1, 0, 0 },
+	};
+	const struct predicate wide[] = {
+		{ EV_ABS, ABS_X, 1, EVEMU_DB_ABS_MAXIMUM, 4096, 1 << 30 },
+		{ EV_ABS, ABS_X, 1, EVEMU_DB_ABS_MINIMUM, 0, 0 },
+	};
+	char index[] = "evemu.tmp.XXXXXX";
+	struct evemu_db *db;
+	int fd, n;
+
+	fd = mkstemp(index);
+	assert(fd >= 0);
+	close(fd);
+
+	n = evemu_db_build(DATA_DIR, index, 0);
+	assert(n > 0);
+	/* a single thread indexes the same devices */
+	assert(evemu_db_build(DATA_DIR, index, 1) == n);
+
+	db = evemu_db_open(index);
+	assert(db);
+	assert(evemu_db_get_count(db) == (unsigned int)n);
+	assert(evemu_db_get_path(db, n) == NULL);
+
+	check_query(db, NULL, 0);
+	check_query(db, touchscreen, 3);
+	check_query(db, slots, 1);
+	check_query(db, buttonpad, 2);
+	check_query(db, wide, 2);
+
+	evemu_db_close(db);
+
+	check_corrupt(index);
+	unlink(index);
+
+	return 0;
+}
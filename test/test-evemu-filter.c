@@ -0,0 +1,195 @@
+/*
+ * Test the event filters, on pipes instead of kernel devices: a pipe has
+ * no EVIOCSMASK, so the filters are applied by the library.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+static const struct input_event events[] = {
+	{ { 0, 0 }, EV_ABS, ABS_MT_TRACKING_ID, 1 },
+	{ { 0, 0 }, EV_ABS, ABS_MT_POSITION_X, 100 },
+	{ { 0, 0 }, EV_KEY, BTN_TOUCH, 1 },
+	{ { 0, 0 }, EV_REL, REL_X, 5 },
+	{ { 0, 0 }, EV_SYN, SYN_REPORT, 0 },
+};
+#define NEVENTS (sizeof(events) / sizeof(events[0]))
+
+/* everything but EV_KEY and REL_X */
+static int expected(const struct input_event *ev)
+{
+	return ev->type != EV_KEY && !(ev->type == EV_REL && ev->code == REL_X);
+}
+
+static struct evemu_filter *new_filter(void)
+{
+	struct evemu_filter *filter = evemu_filter_new(NULL);
+
+	assert(filter);
+	assert(evemu_filter_set(filter, EV_KEY, -1, 0) == 0);
+	assert(evemu_filter_set(filter, EV_REL, REL_X, 0) == 0);
+	return filter;
+}
+
+static void test_set(void)
+{
+	struct evemu_filter *filter = evemu_filter_new(NULL);
+	unsigned int i;
+
+	assert(filter);
+	for (i = 0; i < NEVENTS; i++)
+		assert(evemu_filter_accepts(filter, events[i].type, events[i].code));
+
+	assert(evemu_filter_set(filter, EV_ABS, -1, 0) == 0);
+	assert(!evemu_filter_accepts(filter, EV_ABS, ABS_X));
+	assert(!evemu_filter_accepts(filter, EV_ABS, ABS_MAX));
+	assert(evemu_filter_set(filter, EV_ABS, ABS_X, 1) == 0);
+	assert(evemu_filter_accepts(filter, EV_ABS, ABS_X));
+	assert(!evemu_filter_accepts(filter, EV_ABS, ABS_Y));
+	assert(evemu_filter_accepts(filter, EV_KEY, KEY_MAX));
+
+	assert(evemu_filter_set(filter, EV_CNT, -1, 0) == -EINVAL);
+	assert(evemu_filter_set(filter, EV_ABS, ABS_CNT, 0) == -EINVAL);
+	assert(evemu_filter_set(filter, EV_ABS, -2, 0) == -EINVAL);
+
+	evemu_filter_delete(filter);
+}
+
+static void test_device(void)
+{
+	struct evemu_filter *filter;
+	struct evemu_device *dev;
+	FILE *fp;
+
+	fp = fopen(DATA_DIR "/3m.prop", "r");
+	assert(fp);
+	dev = evemu_new(NULL);
+	assert(dev && evemu_read(dev, fp) > 0);
+	fclose(fp);
+
+	filter = evemu_filter_new(dev);
+	assert(filter);
+	assert(evemu_filter_accepts(filter, EV_ABS, ABS_MT_POSITION_X));
+	assert(evemu_filter_accepts(filter, EV_KEY, BTN_TOUCH));
+	assert(evemu_filter_accepts(filter, EV_SYN, SYN_MT_REPORT));
+	assert(!evemu_filter_accepts(filter, EV_REL, REL_X));
+	assert(!evemu_filter_accepts(filter, EV_KEY, KEY_A));
+
+	evemu_filter_delete(filter);
+	evemu_delete(dev);
+}
+
+/* the kernel cannot mask a pipe, the library drops what was read */
+static void test_read(void)
+{
+	struct input_event batch[NEVENTS];
+	struct evemu_filter *filter = new_filter();
+	struct evemu_stats stats;
+	unsigned int i, n = 0;
+	int fds[2];
+
+	assert(pipe(fds) == 0);
+	assert(evemu_filter_apply(filter, fds[0]) < 0);
+
+	evemu_stats_reset();
+	assert(write(fds[1], events, sizeof(events)) == sizeof(events));
+	assert(evemu_read_batch(fds[0], batch, NEVENTS, filter) == 3);
+	for (i = 0; i < NEVENTS; i++) {
+		if (!expected(&events[i]))
+			continue;
+		assert(batch[n].type == events[i].type &&
+		       batch[n].code == events[i].code &&
+		       batch[n].value == events[i].value);
+		n++;
+	}
+
+	evemu_stats_snapshot(&stats);
+	assert(stats.read_calls == 1);
+	assert(stats.events_read == NEVENTS);
+	assert(stats.filtered_events == NEVENTS - 3);
+
+	close(fds[0]);
+	close(fds[1]);
+	evemu_filter_delete(filter);
+}
+
+static void test_record(void)
+{
+	struct evemu_filter *filter = new_filter();
+	struct input_event ev;
+	unsigned int i;
+	int fds[2];
+	FILE *fp;
+
+	assert(pipe(fds) == 0);
+	fp = tmpfile();
+	assert(fp);
+
+	assert(write(fds[1], events, sizeof(events)) == sizeof(events));
+	assert(evemu_record_filtered(fp, fds[0], 100, filter) == 0);
+
+	rewind(fp);
+	for (i = 0; i < NEVENTS; i++) {
+		if (!expected(&events[i]))
+			continue;
+		assert(evemu_read_event(fp, &ev) > 0);
+		assert(ev.type == events[i].type && ev.code == events[i].code &&
+		       ev.value == events[i].value);
+	}
+	assert(evemu_read_event(fp, &ev) == 0);
+
+	fclose(fp);
+	close(fds[0]);
+	close(fds[1]);
+	evemu_filter_delete(filter);
+}
+
+static void test_play(void)
+{
+	struct evemu_filter *filter = new_filter();
+	struct input_event written[NEVENTS];
+	unsigned int i, n = 0;
+	int fds[2];
+	FILE *fp;
+
+	fp = tmpfile();
+	assert(fp);
+	for (i = 0; i < NEVENTS; i++)
+		assert(evemu_write_event(fp, &events[i]) > 0);
+	rewind(fp);
+
+	assert(pipe(fds) == 0);
+	assert(evemu_play_filtered(fp, fds[1], filter) == 0);
+	close(fds[1]);
+
+	assert(read(fds[0], written, sizeof(written)) == 3 * sizeof(written[0]));
+	for (i = 0; i < NEVENTS; i++) {
+		if (!expected(&events[i]))
+			continue;
+		assert(written[n].type == events[i].type &&
+		       written[n].code == events[i].code &&
+		       written[n].value == events[i].value);
+		n++;
+	}
+
+	close(fds[0]);
+	fclose(fp);
+	evemu_filter_delete(filter);
+}
+
+int main(void)
+{
+	test_set();
+	test_device();
+	test_read();
+	test_record();
+	test_play();
+
+	return 0;
+}
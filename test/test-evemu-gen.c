@@ -0,0 +1,192 @@
+/*
+ * Test that the generated streams are what the kernel expects: protocol
+ * B for devices with slots, every event supported by the device, values
+ * inside the axis ranges, and every gesture released at its end.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+#define GESTURES 10
+#define MAX_SLOTS 64
+
+struct state {
+	const struct evemu_device *dev;
+	int slots;		/* 0 without protocol B */
+	int slot;		/* -1 until one is selected */
+	int tracking_id[MAX_SLOTS];
+	int keys[KEY_CNT];
+	long time;
+};
+
+static int has_slots(const struct evemu_device *dev)
+{
+	return evemu_has_event(dev, EV_ABS, ABS_MT_SLOT) &&
+	       evemu_has_event(dev, EV_ABS, ABS_MT_POSITION_X) &&
+	       evemu_has_event(dev, EV_ABS, ABS_MT_TRACKING_ID);
+}
+
+static int active_slots(const struct state *s)
+{
+	int i, n = 0;
+
+	for (i = 0; i < s->slots; i++)
+		n += s->tracking_id[i] != -1;
+	return n;
+}
+
+static void check_abs(struct state *s, const struct input_event *ev)
+{
+	const struct evemu_device *dev = s->dev;
+	int i;
+
+	switch (ev->code) {
+	case ABS_MT_SLOT:
+		assert(ev->value >= 0 && ev->value < s->slots);
+		assert(ev->value != s->slot);
+		s->slot = ev->value;
+		return;
+	case ABS_MT_TRACKING_ID:
+		assert(s->slot >= 0);
+		if (ev->value == -1) {
+			assert(s->tracking_id[s->slot] != -1);
+		} else {
+			/* a new contact, with an id no other contact has */
+			assert(s->tracking_id[s->slot] == -1);
+			assert(ev->value >= evemu_get_abs_minimum(dev, ev->code));
+			for (i = 0; i < s->slots; i++)
+				assert(s->tracking_id[i] != ev->value);
+		}
+		s->tracking_id[s->slot] = ev->value;
+		return;
+	}
+
+	if (ev->code >= ABS_MT_SLOT) {
+		/* contact data only for the contact of the current slot */
+		assert(s->slots > 0 && s->slot >= 0);
+		assert(s->tracking_id[s->slot] != -1);
+	}
+	assert(ev->value >= evemu_get_abs_minimum(dev, ev->code));
+	assert(ev->value <= evemu_get_abs_maximum(dev, ev->code));
+}
+
+/* checks one frame, returns whether the device is touched after it, or
+ * -1 if the device cannot tell */
+static int check_frame(struct state *s, const struct input_event *frame, int n)
+{
+	int i;
+
+	assert(n > 0 && n <= EVEMU_GENERATOR_FRAME_SIZE);
+	assert(frame[n - 1].type == EV_SYN && frame[n - 1].code == SYN_REPORT);
+
+	for (i = 0; i < n; i++) {
+		const struct input_event *ev = &frame[i];
+		long time = ev->time.tv_sec * 1000000L + ev->time.tv_usec;
+
+		assert(time >= s->time);
+		s->time = time;
+		if (ev->type == EV_SYN) {
+			/* the only EV_SYN is the one that ends the frame */
+			assert(i == n - 1);
+			continue;
+		}
+
+		assert(evemu_has_event(s->dev, ev->type, ev->code));
+		if (ev->type == EV_KEY) {
+			/* the kernel drops keys that do not change */
+			assert(ev->value == !s->keys[ev->code]);
+			s->keys[ev->code] = ev->value;
+		} else {
+			assert(ev->type == EV_ABS);
+			check_abs(s, ev);
+		}
+	}
+
+	if (s->slots && evemu_has_event(s->dev, EV_KEY, BTN_TOUCH))
+		assert(s->keys[BTN_TOUCH] == (active_slots(s) > 0));
+	if (s->slots)
+		return active_slots(s) > 0;
+	return evemu_has_event(s->dev, EV_KEY, BTN_TOUCH) ? s->keys[BTN_TOUCH] : -1;
+}
+
+static void check_stream(const struct evemu_device *dev,
+			 enum evemu_gesture gesture, int fingers)
+{
+	struct input_event frame[EVEMU_GENERATOR_FRAME_SIZE];
+	struct evemu_generator *gen;
+	struct state s;
+	int i, j, frames;
+
+	gen = evemu_generator_new(dev, gesture, fingers, 1000, 20);
+	if (!evemu_has_event(dev, EV_ABS, ABS_X) &&
+	    !evemu_has_event(dev, EV_ABS, ABS_MT_POSITION_X)) {
+		assert(!gen);
+		return;
+	}
+	assert(gen);
+
+	memset(&s, 0, sizeof(s));
+	s.dev = dev;
+	s.slots = has_slots(dev) ? evemu_get_abs_maximum(dev, ABS_MT_SLOT) + 1 : 0;
+	assert(s.slots <= MAX_SLOTS);
+	s.slot = -1;
+	for (i = 0; i < MAX_SLOTS; i++)
+		s.tracking_id[i] = -1;
+
+	frames = evemu_generator_get_frames(gen);
+	assert(frames == (gesture == EVEMU_GESTURE_TAP ? 2 : 20));
+
+	for (i = 0; i < GESTURES; i++) {
+		for (j = 0; j < frames; j++) {
+			int n = evemu_generator_next_frame(gen, frame,
+							   EVEMU_GENERATOR_FRAME_SIZE);
+			int touching = check_frame(&s, frame, n);
+
+			/* down on the first frame, up after the last */
+			assert(touching == -1 || touching == (j < frames - 1));
+		}
+		for (j = 0; j < KEY_CNT; j++)
+			assert(!s.keys[j]);
+	}
+
+	/* a frame that does not fit is refused */
+	assert(evemu_generator_next_frame(gen, frame, 1) == -ENOSPC);
+
+	evemu_generator_delete(gen);
+}
+
+int main(void)
+{
+	const enum evemu_gesture gestures[] = {
+		EVEMU_GESTURE_TAP, EVEMU_GESTURE_SWIPE,
+		EVEMU_GESTURE_PINCH, EVEMU_GESTURE_PALM,
+	};
+	glob_t files;
+	size_t i, g;
+	int fingers;
+
+	assert(glob(DATA_DIR "/*.prop", 0, NULL, &files) == 0);
+	for (i = 0; i < files.gl_pathc; i++) {
+		struct evemu_device *dev = evemu_new(NULL);
+		FILE *fp = fopen(files.gl_pathv[i], "r");
+
+		assert(dev && fp);
+		assert(evemu_read(dev, fp) > 0);
+		fclose(fp);
+
+		for (g = 0; g < sizeof(gestures) / sizeof(gestures[0]); g++)
+			for (fingers = 1; fingers <= 5; fingers++)
+				check_stream(dev, gestures[g], fingers);
+
+		evemu_delete(dev);
+	}
+	globfree(&files);
+
+	return 0;
+}
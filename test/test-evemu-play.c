@@ -0,0 +1,95 @@
+/*
+ * Test that evemu-play --fanout replays every event of a recording that
+ * holds both the description and the events, the first one included.
+ * The clones write to pipes instead of uinput nodes.
+ */
+
+#define main play_main
+#include "evemu-play.c"
+#include "evemu-rt.c"
+#include "evemu-histogram.c"
+#include "evemu-counters.c"
+#undef main
+
+#include <assert.h>
+
+#define CLONES 2
+#define EVENTS_MAX 64
+/* the description and the first two frames of 3m.event */
+#define RECORDING_LINES 119
+
+/* writes the start of 3m.event to a file, returns the number of events */
+static int write_recording(FILE *out, struct input_event *expected)
+{
+	char *line = NULL;
+	size_t size = 0;
+	FILE *fp;
+	int i, n = 0;
+
+	fp = fopen(DATA_DIR "/3m.event", "r");
+	assert(fp);
+	for (i = 0; i < RECORDING_LINES; i++) {
+		assert(getline(&line, &size, fp) > 0);
+		fputs(line, out);
+		if (strncmp(line, "E: ", 3) != 0)
+			continue;
+		assert(n < EVENTS_MAX);
+		assert(evemu_create_event(&expected[n], 0, 0, 0) == 0);
+		assert(sscanf(line, "E: %*u.%*u %hx %hx %d", &expected[n].type,
+			      &expected[n].code, &expected[n].value) == 3);
+		n++;
+	}
+	free(line);
+	fclose(fp);
+	fflush(out);
+
+	return n;
+}
+
+int main(void)
+{
+	struct input_event expected[EVENTS_MAX], written[EVENTS_MAX];
+	long offsets[CLONES] = { 0, 1000 };
+	int fds[CLONES], nodes[CLONES];
+	struct evemu_device *dev;
+	FILE *fp;
+	int i, j, n;
+
+	fp = tmpfile();
+	assert(fp);
+	n = write_recording(fp, expected);
+	assert(n > 0);
+	assert(expected[0].code == ABS_MT_TRACKING_ID);
+	rewind(fp);
+
+	dev = evemu_new(NULL);
+	assert(dev);
+	assert(read_recording(dev, fp) == 0);
+	assert(strcmp(evemu_get_name(dev), "3M-3M-MicroTouch-USB-controller Virtual Device") == 0);
+
+	for (i = 0; i < CLONES; i++) {
+		int p[2];
+
+		assert(pipe(p) == 0);
+		nodes[i] = p[0];
+		fds[i] = p[1];
+	}
+
+	assert(evemu_play_fanout(fp, fds, offsets, CLONES) == 0);
+
+	for (i = 0; i < CLONES; i++) {
+		close(fds[i]);
+		assert(read(nodes[i], written, sizeof(written)) ==
+		       (ssize_t)(n * sizeof(*written)));
+		for (j = 0; j < n; j++)
+			assert(written[j].type == expected[j].type &&
+			       written[j].code == expected[j].code &&
+			       written[j].value == expected[j].value);
+		close(nodes[i]);
+	}
+
+	evemu_delete(dev);
+	fclose(fp);
+
+	return 0;
+}
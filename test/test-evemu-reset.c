@@ -0,0 +1,107 @@
+/*
+ * Test the frame evemu_reset_state() writes for every device of the data
+ * directory: all touches lifted, all keys released, axes at rest.
+ */
+
+#define _GNU_SOURCE
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+static int rest_value(struct evemu_device *dev, int code)
+{
+	int min = evemu_get_abs_minimum(dev, code);
+	int max = evemu_get_abs_maximum(dev, code);
+
+	switch (code) {
+	case ABS_X: case ABS_Y: case ABS_Z:
+	case ABS_RX: case ABS_RY: case ABS_RZ:
+	case ABS_TILT_X: case ABS_TILT_Y:
+		return min + (max - min) / 2;
+	default:
+		if (code >= ABS_HAT0X && code <= ABS_HAT3Y)
+			return min + (max - min) / 2;
+		return min;
+	}
+}
+
+static void check_reset(const char *path)
+{
+	struct input_event frame[4096];
+	struct evemu_device *dev;
+	unsigned char seen[KEY_CNT] = { 0 };
+	int fds[2], i, n, code, slot = -1, lifted = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	assert(fp);
+	dev = evemu_new(NULL);
+	assert(dev);
+	assert(evemu_read(dev, fp) > 0);
+	fclose(fp);
+
+	assert(pipe(fds) == 0);
+	assert(evemu_reset_state(dev, fds[1]) == 0);
+	close(fds[1]);
+	n = read(fds[0], frame, sizeof(frame));
+	close(fds[0]);
+	assert(n > 0 && n % sizeof(frame[0]) == 0);
+	n /= sizeof(frame[0]);
+
+	assert(frame[n - 1].type == EV_SYN && frame[n - 1].code == SYN_REPORT);
+	for (i = 0; i < n - 1; i++) {
+		const struct input_event *ev = &frame[i];
+
+		assert(ev->type != EV_SYN);
+		assert(evemu_has_event(dev, ev->type, ev->code));
+		if (ev->type == EV_KEY) {
+			assert(ev->value == 0);
+			assert(!seen[ev->code]);
+			seen[ev->code] = 1;
+		} else if (ev->type == EV_ABS && ev->code == ABS_MT_SLOT) {
+			slot = ev->value;
+		} else if (ev->type == EV_ABS && ev->code == ABS_MT_TRACKING_ID) {
+			assert(ev->value == -1);
+			assert(slot == evemu_get_abs_minimum(dev, ABS_MT_SLOT) + lifted);
+			lifted++;
+		} else if (ev->type == EV_ABS) {
+			assert(ev->code < ABS_MT_SLOT);
+			assert(ev->value == rest_value(dev, ev->code));
+		} else {
+			assert(ev->type == EV_SW || ev->type == EV_LED);
+			assert(ev->value == 0);
+		}
+	}
+
+	for (code = 0; code < KEY_CNT; code++)
+		assert(seen[code] == !!evemu_has_event(dev, EV_KEY, code));
+	if (evemu_has_event(dev, EV_ABS, ABS_MT_SLOT) &&
+	    evemu_has_event(dev, EV_ABS, ABS_MT_TRACKING_ID)) {
+		assert(lifted == evemu_get_abs_maximum(dev, ABS_MT_SLOT) -
+				 evemu_get_abs_minimum(dev, ABS_MT_SLOT) + 1);
+		/* and back to the first slot */
+		assert(slot == evemu_get_abs_minimum(dev, ABS_MT_SLOT));
+	} else {
+		assert(lifted == 0);
+	}
+
+	evemu_delete(dev);
+}
+
+int main(void)
+{
+	glob_t files;
+	size_t i;
+
+	assert(glob(DATA_DIR "/*.prop", 0, NULL, &files) == 0);
+	for (i = 0; i < files.gl_pathc; i++)
+		check_reset(files.gl_pathv[i]);
+	globfree(&files);
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Test that independent streams can be parsed and written from several
+ * threads in parallel, each in its own context.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+#define UNUSED __attribute__((unused))
+
+#define NTHREADS 8
+#define NEVENTS 20000
+
+static const char *description =
+	"# EVEMU 1.2\n"
+	"N: evemu thread test device\n"
+	"I: 0003 0004 0005 0006\n"
+	"B: 00 0b 00 00 00 00 00 00 00\n"
+	"A: 00 0 1000 0 0 0\n"
+	"A: 01 0 1000 0 0 0\n";
+
+struct job {
+	int id;
+	const char *input;
+	size_t input_size;
+	char *output;
+	size_t output_size;
+	int errors;
+	struct evemu_stats stats;
+};
+
+static void count_errors(struct evemu_context *ctx UNUSED,
+			 enum evemu_log_priority priority,
+			 void *data, const char *format UNUSED,
+			 va_list args UNUSED)
+{
+	struct job *job = data;
+
+	if (priority == EVEMU_LOG_ERROR)
+		job->errors++;
+}
+
+/* NEVENTS events, then one broken event line */
+static char *make_events(size_t *size)
+{
+	char *buf = NULL;
+	FILE *fp = open_memstream(&buf, size);
+	int i;
+
+	assert(fp);
+	for (i = 0; i < NEVENTS; i++) {
+		struct input_event ev;
+
+		evemu_create_event(&ev, i % 3 == 2 ? EV_SYN : EV_ABS,
+				   i % 3 == 2 ? SYN_REPORT : i % 3, i);
+		ev.time.tv_sec = i / 1000;
+		ev.time.tv_usec = i % 1000 * 1000;
+		evemu_write_event(fp, &ev);
+	}
+	fputs("E: broken\n", fp);
+	fclose(fp);
+
+	return buf;
+}
+
+static void run(struct job *job)
+{
+	struct evemu_device *dev;
+	struct input_event ev;
+	FILE *desc, *in, *out;
+
+	desc = fmemopen((void *)description, strlen(description), "r");
+	in = fmemopen((void *)job->input, job->input_size, "r");
+	out = open_memstream(&job->output, &job->output_size);
+	assert(desc && in && out);
+
+	dev = evemu_new(NULL);
+	assert(dev);
+	assert(evemu_read(dev, desc) > 0);
+	evemu_write(dev, out);
+	while (evemu_read_event(in, &ev) > 0)
+		evemu_write_event(out, &ev);
+
+	evemu_delete(dev);
+	fclose(out);
+	fclose(in);
+	fclose(desc);
+}
+
+static void *thread(void *data)
+{
+	struct job *job = data;
+	struct evemu_context *ctx;
+
+	ctx = evemu_context_new();
+	assert(ctx);
+	evemu_context_set_log_func(ctx, count_errors, job);
+	evemu_context_enable_timers(ctx, 1);
+	assert(evemu_context_use(ctx) == NULL);
+
+	run(job);
+
+	evemu_context_get_stats(ctx, &job->stats);
+	assert(evemu_context_use(NULL) == ctx);
+	evemu_context_delete(ctx);
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[NTHREADS];
+	struct job jobs[NTHREADS + 1];
+	struct evemu_stats stats;
+	char *input;
+	size_t size;
+	int i;
+
+	input = make_events(&size);
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i <= NTHREADS; i++) {
+		jobs[i].id = i;
+		jobs[i].input = input;
+		jobs[i].input_size = size;
+	}
+
+	/* the reference run, in the default context with messages dropped */
+	evemu_context_set_log_func(NULL, NULL, NULL);
+	evemu_stats_reset();
+	run(&jobs[NTHREADS]);
+	evemu_stats_snapshot(&stats);
+	assert(stats.devices_parsed == 1);
+	assert(stats.events_parsed == NEVENTS);
+
+	for (i = 0; i < NTHREADS; i++)
+		assert(pthread_create(&threads[i], NULL, thread, &jobs[i]) == 0);
+	for (i = 0; i < NTHREADS; i++)
+		assert(pthread_join(threads[i], NULL) == 0);
+
+	for (i = 0; i < NTHREADS; i++) {
+		const struct job *job = &jobs[i];
+
+		assert(job->output_size == jobs[NTHREADS].output_size);
+		assert(memcmp(job->output, jobs[NTHREADS].output,
+			      job->output_size) == 0);
+		assert(job->errors == 1);
+		assert(job->stats.devices_parsed == 1);
+		assert(job->stats.devices_written == 1);
+		assert(job->stats.events_parsed == NEVENTS);
+		assert(job->stats.events_formatted == NEVENTS);
+		assert(job->stats.bytes_formatted > 0);
+		assert(job->stats.parse_ns > 0);
+		free(jobs[i].output);
+	}
+
+	/* nothing the threads did ended up in the default context */
+	evemu_stats_snapshot(&stats);
+	assert(stats.devices_parsed == 1);
+	assert(stats.events_parsed == NEVENTS);
+	assert(stats.parse_ns == 0);
+
+	free(jobs[NTHREADS].output);
+	free(input);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Test the ring of the asynchronous writer. The writer thread is held up
+ * by locking its output file, so the ring fills up, drops and wraps
+ * around exactly as the test pushes.
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "evemu.h"
+#include <linux/input.h>
+
+#define CAPACITY 8
+#define NEVENTS 64
+
+static struct input_event events[NEVENTS];
+static int ids[NEVENTS];	/* device of each event, -1 if dropped */
+static int pushed;
+
+static int push(struct evemu_writer *w, int count, int id)
+{
+	int ret, i;
+
+	ret = evemu_writer_push(w, &events[pushed], count, id);
+	for (i = 0; i < count; i++)
+		ids[pushed + i] = ret == 0 ? id : -1;
+	pushed += count;
+	return ret;
+}
+
+static void wait_empty(struct evemu_writer *w)
+{
+	struct evemu_writer_stats stats;
+
+	do {
+		usleep(1000);
+		evemu_writer_get_stats(w, &stats);
+	} while (stats.occupancy > 0);
+}
+
+/* the file holds the accepted events in order, on the first event's clock */
+static void check_output(FILE *fp)
+{
+	unsigned int sec, usec, type, code;
+	int id, value, i;
+
+	rewind(fp);
+	for (i = 0; i < pushed; i++) {
+		long time;
+
+		if (ids[i] < 0)
+			continue;
+		assert(fscanf(fp, "E: %d %u.%u %x %x %d %*[^\n]\n", &id, &sec,
+			      &usec, &type, &code, &value) == 6);
+		time = sec * 1000000L + usec;
+		assert(id == ids[i]);
+		assert(time == (events[i].time.tv_sec - events[0].time.tv_sec) * 1000000L);
+		assert(type == events[i].type && code == events[i].code &&
+		       value == events[i].value);
+	}
+	assert(fgetc(fp) == EOF);
+}
+
+int main(void)
+{
+	struct evemu_writer_stats stats;
+	struct evemu_writer *w;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < NEVENTS; i++) {
+		events[i].time.tv_sec = 1000 + i;
+		events[i].type = EV_ABS;
+		events[i].code = ABS_X;
+		events[i].value = i;
+	}
+
+	fp = tmpfile();
+	assert(fp);
+	w = evemu_writer_new(fp, CAPACITY, 1);
+	assert(w);
+
+	/* the writer thread cannot write, so nothing leaves the ring */
+	flockfile(fp);
+	assert(push(w, 5, 0) == 0);
+	assert(push(w, 3, 1) == 0);
+	assert(push(w, 1, 0) == -ENOSPC);
+	assert(push(w, 4, 1) == -ENOSPC);
+	evemu_writer_get_stats(w, &stats);
+	assert(stats.capacity == CAPACITY);
+	assert(stats.occupancy == CAPACITY);
+	assert(stats.max_occupancy == CAPACITY);
+	assert(stats.batches == 4);
+	assert(stats.events == 8);
+	assert(stats.dropped_batches == 2);
+	assert(stats.dropped_events == 5);
+	funlockfile(fp);
+
+	/* pushed past the end of the ring, the events wrap around */
+	wait_empty(w);
+	for (i = 0; i < 4; i++) {
+		assert(push(w, 3, i) == 0);
+		wait_empty(w);
+	}
+	assert(push(w, 0, 0) == 0);
+
+	evemu_writer_get_stats(w, &stats);
+	assert(stats.occupancy == 0);
+	assert(stats.max_occupancy == CAPACITY);
+	assert(stats.batches == 8);
+	assert(stats.events == 20);
+	assert(stats.dropped_events == 5);
+
+	evemu_writer_delete(w);
+	check_output(fp);
+	fclose(fp);
+
+	return 0;
+}
@@ -49,13 +49,18 @@
 #include <signal.h>
 #include <time.h>
 
+#include "evemu-counters.h"
+#include "evemu-filter-opt.h"
 #include "evemu-opt.h"
+#include "evemu-rotate.h"
+#include "evemu-rt.h"
 
 #define INFINITE -1
 
 
 
 FILE *output;
+static struct evemu_filter* filter = NULL;
 
 static int describe_device(int fd, FILE* fp)
 {
@@ -158,7 +163,11 @@ int dev_describe_mouse(int id, int fd, char* dev_name, int x, int y, FILE* fp) {
   int ret = describe_device(fd, fp);
   fprintf(fp, "[Device End]\n");
 
-  // initialize mouse position if there have
+  return ret;
+}
+
+// initialize mouse position if there have
+void dev_position_mouse(int fd, int x, int y) {
   for (int i =0 ; i < x; i++) {
     write_event(fd, EV_REL, REL_X, 1);
     write_event(fd, EV_SYN, SYN_REPORT, 0);
@@ -169,8 +178,6 @@ int dev_describe_mouse(int id, int fd, char* dev_name, int x, int y, FILE* fp) {
     write_event(fd, EV_SYN, SYN_REPORT, 0);
     usleep(500);
   }
-    
-  return ret;
 }
 
 int dev_describe_device(int id, int fd, char* dev_name, FILE* fp) {
@@ -248,6 +255,36 @@ int dev_grab_all(int* fds, struct EvemuOptions* opts) {
   return 0;
 }
 
+struct SegmentHeader {
+  int*                 fds;
+  struct EvemuOptions* opts;
+};
+
+// every segment repeats the device sections, so it can be replayed alone
+static int write_segment_header(FILE* fp, void* data) {
+  struct SegmentHeader* header = data;
+  int ret = dev_describe_all(header->fds, header->opts, fp);
+
+  fprintf(fp, "[Events]\n");
+  return ret;
+}
+
+static int record_rotating(int* fds, int count, struct EvemuOptions* opts) {
+  struct SegmentHeader header = { fds, opts };
+  struct rotation rotate;
+
+  memset(&rotate, 0, sizeof(rotate));
+  rotate.prefix = opts->output;
+  rotate.max_bytes = opts->rotate_size * 1024L * 1024L;
+  rotate.max_usec = opts->rotate_time * 60 * 1000000L;
+  rotate.with_id = 1;
+  rotate.filter = filter;
+  rotate.write_header = write_segment_header;
+  rotate.data = &header;
+
+  return rotation_record(&rotate, fds, count);
+}
+
 int main(int argc, char *argv[])
 {
   // Parse options
@@ -256,6 +293,29 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  // The library's writer thread does the reads, there is no read loop
+  // here whose latency could be measured
+  if (opts.latency) {
+    fprintf(stderr, "error: --latency is only supported by ev-replay\n");
+    return -1;
+  }
+  if (opts.drop_unsupported) {
+    fprintf(stderr, "error: --drop-unsupported is only supported by ev-replay\n");
+    return -1;
+  }
+
+  // Event filters, applied in the kernel where it supports EVIOCSMASK
+  for (int i = 0; i < opts.filter_count; i++) {
+    if (filter_option(&filter, opts.filters[i].event, opts.filters[i].accept)) {
+      fprintf(stderr, "error: invalid event '%s'\n", opts.filters[i].event);
+      return -1;
+    }
+  }
+
+  // Before the writer thread starts, so it leaves SIGUSR1 to us
+  if (opts.stats && counters_report(1))
+    fprintf(stderr, "error: could not set up statistics\n");
+
   // Create device fd, and initialize it
   int fds[MAX_DEVICES+1];
   memset(fds, 0, sizeof(fds));
@@ -273,21 +333,46 @@ int main(int argc, char *argv[])
   
   
   // Write fds to stdout, make sure it can be read back during replay 
-  if (dev_describe_all(fds, &opts, stdout))
+  if (opts.output == NULL && dev_describe_all(fds, &opts, stdout))
     goto out;
 
+  if (opts.mouse != NULL)
+    dev_position_mouse(fds[0], opts.mouseX, opts.mouseY);
+
   // Install sig handler
   output = stdout;
   if (sig_handler_install())
     goto out;
 
+  // Scheduling applies to the reading thread, the writer thread that
+  // formats the events keeps the default policy
+  struct rt_options rt = { opts.rt_priority, opts.mlock, opts.cpus, 0 };
+  if (rt_apply(&rt))
+    goto out;
+
   // We now start recording
   int count = opts.mouse == NULL? opts.device_count : opts.device_count +1;
-  if (evemu_record_all(stdout, fds, count, INFINITE))
+  if (opts.output != NULL) {
+    if (record_rotating(fds, count, &opts))
+      fprintf(stderr, "error: could not record to %s\n", opts.output);
     goto out;
+  }
+
+  // Formatting runs on a writer thread, so a stalled disk does not make
+  // the kernel drop events. Report when the writer could not keep up.
+  struct evemu_writer_stats stats;
+  if (evemu_record_all_async_filtered(stdout, fds, count, INFINITE, filter, &stats))
+    goto out;
+
+  if (stats.dropped_batches)
+    fprintf(stderr, "warning: dropped %lu events in %lu batches, "
+            "writer buffer peaked at %lu of %lu events\n",
+            stats.dropped_events, stats.dropped_batches,
+            stats.max_occupancy, stats.capacity);
 
 out:
   dev_clean_all(fds, MAX_DEVICES+1);
+  evemu_filter_delete(filter);
 	
 	return 0;
 }
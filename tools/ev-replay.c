@@ -8,7 +8,9 @@
 #include <unistd.h>
 
 #include "evemu.h"
+#include "evemu-counters.h"
 #include "evemu-opt.h"
+#include "evemu-rt.h"
 
 
 // a line is empty if
@@ -195,12 +197,14 @@ struct UinputDevice {
   int                  fd;
   char*                node_name;
   char*                device_name;
+  struct evemu_filter* filter;
 };
 
 // current context, should be handled more graceful, currently use 'static'
 static struct UinputDevice udevice[MAX_DEVICES+1];
 static int device_id = -1;
 static char* device_type = NULL;
+static int drop_unsupported = 0;
 
 int read_device_id(char* value, struct EvemuOptions* opts) {
   int ret = 0;
@@ -326,21 +330,50 @@ void device_tmpfiles_dump() {
   }
 }
 
-int create_uinput_device(struct UinputDevice* ud) {
+// the spooled section, in memory
+static int read_descriptor(FILE* fp, char** text, size_t* size) {
+  long len;
+
+  *text = NULL;
+  if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0)
+    return -1;
+  rewind(fp);
+
+  *text = malloc(len + 1);
+  if (*text == NULL)
+    return -1;
+  *size = fread(*text, 1, len, fp);
+  return *size == (size_t)len ? 0 : -1;
+}
+
+// how long the devnodes of the created devices may take to show up
+#define DEVNODE_TIMEOUT_MS 5000
+
+int load_uinput_device(struct UinputDevice* ud) {
   int ret =0;
-  
+  struct evemu_desc desc;
+  char* text = NULL;
+  size_t size = 0;
+
+  ud->fd = -1;
   ud->device = evemu_new(NULL);
   if (!ud->device) {
     ret = -1;
     goto out;
   }
 
-  rewind(ud->descriptor);
-  ret = evemu_read(ud->device, ud->descriptor);
+  // the same sections come back run after run, load them from the binary
+  // cache keyed by their text instead of parsing them every time
+  ret = read_descriptor(ud->descriptor, &text, &size);
+  if (ret == 0)
+    ret = evemu_desc_read_cached(&desc, text, size, NULL);
+  free(text);
   if (ret <=0) {
     ret = -1;
     goto out;
   }
+  evemu_desc_to_device(&desc, ud->device);
+  ret = 0;
 
   if (strlen(evemu_get_name(ud->device)) == 0) {
 		char name[64];
@@ -348,10 +381,13 @@ int create_uinput_device(struct UinputDevice* ud) {
 		evemu_set_name(ud->device, name);
 	}
   ud->device_name = (char*)evemu_get_name(ud->device);
-  
-  ret = evemu_create_managed(ud->device);
-	if (ret < 0)
-		goto out;
+
+ out:
+  return ret;
+}
+
+int open_uinput_device(struct UinputDevice* ud) {
+  int ret =0;
 
   const char *device_node = evemu_get_devnode(ud->device);
 	if (!device_node) {
@@ -369,16 +405,38 @@ int create_uinput_device(struct UinputDevice* ud) {
 	  goto out;
 	}
   ud->fd = fd;
+
+  // what the device supports, so replay doesn't ask per event
+  ud->filter = evemu_filter_new(ud->device);
   
  out:
   return ret;
 }
 
+// all devices are submitted at once and their devnodes waited for
+// together, so startup does not grow with a wait per device
 int create_uinput_devices(struct EvemuOptions* opts, struct UinputDevice* uds) {
+  struct evemu_device* devs[MAX_DEVICES +1];
   int ret = 0;
   
   for (int i =0; i < opts->device_count; i++) {
-    ret = create_uinput_device(uds +i);
+    ret = load_uinput_device(uds +i);
+    if (ret) return ret;
+    devs[i] = uds[i].device;
+  }
+
+  ret = evemu_create_all(devs, opts->device_count, 0);
+  if (ret < 0) {
+    fprintf(stderr, "error: could not create devices: %s\n", strerror(-ret));
+    return ret;
+  }
+
+  ret = evemu_wait_devnodes(devs, opts->device_count, DEVNODE_TIMEOUT_MS);
+  if (ret < 0)
+    fprintf(stderr, "warning: devices not ready: %s\n", strerror(-ret));
+
+  for (int i =0; i < opts->device_count; i++) {
+    ret = open_uinput_device(uds +i);
     if (ret) break;
   }
   
@@ -389,8 +447,10 @@ int destroy_uinput_device(struct UinputDevice* ud) {
   int ret =0;
 
   if (ud->device != NULL) {
-    evemu_destroy(ud->device);
+    evemu_delete(ud->device);
     ud->device = NULL;
+    evemu_filter_delete(ud->filter);
+    ud->filter = NULL;
     if (ud->fd != -1) {
       close(ud->fd);
     }
@@ -426,19 +486,24 @@ void uinput_devices_dump(struct EvemuOptions* opts, struct UinputDevice* uds) {
   }
 }
 
+// line buffer of evemu_read_event_with_id(), reused for every event so
+// the replay loop does not allocate once it has seen the longest line
+static char* event_line = NULL;
+static size_t event_line_size = 0;
+
 int evemu_read_event_with_id(FILE *fp, struct input_event *ev)
 {
 	unsigned long sec;
 	unsigned usec, type, code;
 	int value;
 	int matched = 0;
-	char *line = NULL;
-	size_t size = 0;
+	char *line;
   int id = -1;
   
 	do {
-		if (!read_line(&line, &size, fp))
+		if (!read_line(&event_line, &event_line_size, fp))
 			goto out;
+		line = event_line;
 	} while(strlen(line) > 2 && strncmp(line, "E:", 2) != 0);
 
 	if (strlen(line) <= 2 || strncmp(line, "E:", 2) != 0)
@@ -448,7 +513,8 @@ int evemu_read_event_with_id(FILE *fp, struct input_event *ev)
                    &id, &sec, &usec, &type, &code, &value);
 	if (matched != 6) {
 		fprintf(stderr, "Invalid event format: %s\n", line);
-		return -1;
+		id = -1;
+		goto out;
 	}
 
 	ev->time.tv_sec = sec;
@@ -458,10 +524,25 @@ int evemu_read_event_with_id(FILE *fp, struct input_event *ev)
 	ev->value = value;
 
 out:
-	free(line);
 	return id;
 }
 
+// set with --latency, counts how late each sleep ended
+static struct histogram* latency = NULL;
+
+static void sleep_usec(unsigned long usec) {
+  struct timespec target;
+
+  clock_gettime(CLOCK_MONOTONIC, &target);
+  target.tv_sec += usec / 1000000;
+  target.tv_nsec += usec % 1000000 * 1000;
+  if (target.tv_nsec >= 1000000000) {
+    target.tv_sec++;
+    target.tv_nsec -= 1000000000;
+  }
+  rt_sleep_until(&target, latency);
+}
+
 int evemu_read_event_with_id_realtime(FILE *fp, struct input_event *ev,
 			      struct timeval *evtime)
 {
@@ -478,7 +559,8 @@ int evemu_read_event_with_id_realtime(FILE *fp, struct input_event *ev,
 		usec = 1000000L * (ev->time.tv_sec - evtime->tv_sec);
 		usec += ev->time.tv_usec - evtime->tv_usec;
 		if (usec >= 0) {
-			usleep(usec);
+			if (usec > 0)
+				sleep_usec(usec);
 			*evtime = ev->time;
 		}
 	}
@@ -491,18 +573,19 @@ int evemu_play_with_id(FILE *fp, struct UinputDevice* uds)
 	struct input_event ev;
 	struct timeval evtime;
 	int ret;
-	struct evemu_device *dev;
+	const struct evemu_filter *filter;
   int fd;
   int id;
   
 	memset(&evtime, 0, sizeof(evtime));
 	while ((id = evemu_read_event_with_id_realtime(fp, &ev, &evtime)) >= 0) {
-    dev = uds[id].device;
+    filter = uds[id].filter;
     fd = uds[id].fd;
-		if (dev &&
-		    (ev.type != EV_SYN || ev.code != SYN_MT_REPORT) &&
-		    !evemu_has_event(dev, ev.type, ev.code))
+		if (filter && !evemu_filter_accepts(filter, ev.type, ev.code)) {
+			if (drop_unsupported)
+				continue;
 			fprintf(stderr, "Warn: incompatible event: %d, %d\n",ev.type, ev.code);
+		}
 		ret = write(fd, &ev, sizeof(ev));
 	}
 
@@ -550,6 +633,9 @@ int read_play_events(FILE* fp, struct EvemuOptions* opts, struct UinputDevice* u
   
  out:
   free(line);
+  free(event_line);
+  event_line = NULL;
+  event_line_size = 0;
   return ret;
 }
 
@@ -562,10 +648,31 @@ int main(int argc, char* argv[])
   struct EvemuOptions opts;
   memset(&opts, 0, sizeof(opts));
 
+  // only the scheduling, stats and -D options apply, devices come from the recording
+  if (argc > 1 && !evemu_parse_options(argc, argv, &opts))
+    return -1;
+  if (opts.mouse || opts.mouseX || opts.mouseY || opts.device_count ||
+      opts.output || opts.rotate_size || opts.rotate_time || opts.filter_count) {
+    fprintf(stderr, "error: ev-replay only takes -P, -M, -C, -L, -S and -D\n");
+    return -1;
+  }
+  struct rt_options rt = { opts.rt_priority, opts.mlock, opts.cpus, opts.latency };
+  static struct histogram wakeups;
+  if (rt.latency)
+    latency = &wakeups;
+  if (opts.stats && counters_report(1))
+    fprintf(stderr, "error: could not set up statistics\n");
+  drop_unsupported = opts.drop_unsupported;
+  memset(&opts, 0, sizeof(opts));
+
   // read devices section
   static char Devices_Begin[] = "[Devices Begin]\n";
   static char Devices_End[]   = "[Devices End]\n";
   read_section(fp, &opts, read_devices_content, Devices_Begin, Devices_End);
+  if (opts.device_count < 0 || opts.device_count > MAX_DEVICES +1) {
+    fprintf(stderr, "error: at most %d devices can be replayed\n", MAX_DEVICES +1);
+    return -1;
+  }
 
   // read device sections
   static char Device_Begin[] = "[Device Begin]\n";
@@ -577,7 +684,10 @@ int main(int argc, char* argv[])
   // Now all device related descriptions are loaded into temp file device_tmpfiles
   // and the number devices was stored in opts.device_count. Time to create uinput
   // device... Remember if opts.mouse != NULL, the first device should be mouse
-  create_uinput_devices(&opts, udevice);
+  if (create_uinput_devices(&opts, udevice)) {
+    destroy_uinput_devices(&opts, udevice);
+    return -1;
+  }
   // dump udevices
   if (verbose)
     uinput_devices_dump(&opts, udevice);
@@ -585,7 +695,11 @@ int main(int argc, char* argv[])
   
   // Read all recorded events and replay
   static char Events[] = "[Events]\n";
-  read_play_events(fp, &opts, udevice, Events);
+  if (rt_apply(&rt) == 0)
+    read_play_events(fp, &opts, udevice, Events);
+
+  if (latency)
+    rt_latency_report("replay wakeup", latency);
 
   
   // Destroy all udevices
@@ -0,0 +1,71 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "evemu-counters.h"
+
+static void print_counters(void)
+{
+	struct evemu_stats stats;
+
+	evemu_stats_snapshot(&stats);
+	evemu_stats_print(stderr, &stats);
+}
+
+static void *signal_thread(void *data)
+{
+	sigset_t *mask = data;
+	int sig;
+
+	while (sigwait(mask, &sig) == 0)
+		print_counters();
+
+	return NULL;
+}
+
+int counters_report(int on_signal)
+{
+	static sigset_t mask;
+	pthread_t thread;
+	int rc;
+
+	evemu_stats_enable_timers(1);
+	if (atexit(print_counters))
+		return -ENOMEM;
+
+	if (!on_signal)
+		return 0;
+
+	/* every thread started later inherits the blocked signal */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	rc = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	if (rc == 0)
+		rc = pthread_create(&thread, NULL, signal_thread, &mask);
+	if (rc == 0)
+		rc = pthread_detach(thread);
+
+	return -rc;
+}
@@ -0,0 +1,36 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_COUNTERS_H
+#define EVEMU_COUNTERS_H
+
+/**
+ * counters_report() - print the library statistics of this process
+ * @on_signal: also print them every time SIGUSR1 arrives
+ *
+ * Turns the library timers on and prints evemu_stats_print() to stderr
+ * when the process exits through exit() or a return from main(). With
+ * @on_signal, SIGUSR1 is blocked in the calling thread and a helper
+ * thread waits for it, so call this before starting any other thread.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int counters_report(int on_signal);
+
+#endif
@@ -0,0 +1,691 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * One process holding many virtual devices, driven over a Unix domain
+ * socket. Clients send newline terminated commands:
+ *
+ *   create <size>          followed by <size> bytes of device description,
+ *                          answered "ok <handle> <devnode>" once the
+ *                          device node is ready
+ *   destroy <handle>       answered "ok"
+ *   sync                   answered "ok" once all events sent before are
+ *                          written to their devices
+ *   E: <handle> <sec>.<usec> <type> <code> <value>
+ *                          an event, in the format of ev-record, no answer
+ *   B <handle> <count>     followed by <count> binary events of struct
+ *                          daemon_event, no answer
+ *
+ * Failures are answered "error <message>". Devices belong to the daemon,
+ * not to the client that created them, and live until destroyed or until
+ * the daemon exits.
+ *
+ * Events are queued per device and written with one write() per device
+ * after every read from a client, or when the queue is full. A client is
+ * read from only while its input buffer has room and its answers are
+ * being read, so a client that sends faster than its devices take the
+ * events, or that does not read its answers, blocks in its own send().
+ * A client that creates a device is not read from until the device node
+ * is ready, while the other clients go on being served.
+ */
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evemu-counters.h"
+
+#define CLIENT_MAX 64
+#define IN_SIZE (64 * 1024)
+#define OUT_SIZE 4096
+#define REPLY_MAX 512
+#define BATCH_SIZE 256
+#define DEVNODE_TIMEOUT_MS 5000
+/* how often device nodes being created are looked for */
+#define DEVNODE_INTERVAL_MS 10
+
+/* how much of a bad line an error answer repeats */
+#define ECHO_LEN(len) ((int)((len) - 1 < 64 ? (len) - 1 : 64))
+
+/* an event of the binary stream, in native byte order */
+struct daemon_event {
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+struct vdev {
+	struct evemu_device *dev;
+	int fd;
+	struct client *creator;	/* waits for the device node, if set */
+	long deadline;		/* of the wait, in ms */
+	int queued;		/* listed in dirty */
+	int count;
+	struct input_event batch[BATCH_SIZE];
+};
+
+struct client {
+	int fd;
+	size_t in_len;
+	size_t out_len;
+	int creating;		/* waits for a device node */
+	long bin_handle;
+	long bin_left;		/* binary events still to come */
+	char in[IN_SIZE];
+	char out[OUT_SIZE];
+};
+
+static struct vdev **devices;
+static int device_count;
+static int *dirty;		/* handles of the devices with queued events */
+static int dirty_count;
+
+static struct client *clients[CLIENT_MAX];
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = sig;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [--stats] <socket>\n",
+		program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Creates virtual devices and writes events to them on\n"
+			"behalf of the clients of the Unix domain socket, see\n"
+			"the README for the protocol.\n");
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* a device that is still being created is not handed out */
+static struct vdev *get_device(long handle)
+{
+	if (handle < 0 || handle >= device_count ||
+	    !devices[handle] || devices[handle]->creator)
+		return NULL;
+	return devices[handle];
+}
+
+static int flush_device(struct vdev *v)
+{
+	int ret = 0;
+
+	if (v->count > 0)
+		ret = evemu_play_frame(v->fd, v->batch, v->count);
+	if (ret < 0)
+		fprintf(stderr, "error: could not write to %s: %s\n",
+			evemu_get_devnode(v->dev), strerror(errno));
+	v->count = 0;
+	return ret;
+}
+
+static void flush_devices(void)
+{
+	int i;
+
+	for (i = 0; i < dirty_count; i++) {
+		struct vdev *v = get_device(dirty[i]);
+
+		if (v) {
+			flush_device(v);
+			v->queued = 0;
+		}
+	}
+	dirty_count = 0;
+}
+
+static void queue_event(long handle, struct vdev *v, unsigned int type,
+			unsigned int code, int value)
+{
+	struct input_event *ev;
+
+	if (v->count == BATCH_SIZE)
+		flush_device(v);
+	if (!v->queued) {
+		dirty[dirty_count++] = handle;
+		v->queued = 1;
+	}
+
+	ev = &v->batch[v->count++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	ev->code = code;
+	ev->value = value;
+}
+
+static void reply(struct client *c, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf(c->out + c->out_len, OUT_SIZE - c->out_len, fmt, args);
+	va_end(args);
+	/* commands are only handled with REPLY_MAX bytes of room */
+	if (n > 0 && (size_t)n < OUT_SIZE - c->out_len)
+		c->out_len += n;
+}
+
+static void free_device(long handle)
+{
+	struct vdev *v = devices[handle];
+
+	if (v->fd >= 0)
+		close(v->fd);
+	evemu_delete(v->dev);
+	free(v);
+	devices[handle] = NULL;
+}
+
+/* answers the creator once the device node is ready, or will not be */
+static int finish_device(long handle)
+{
+	struct vdev *v = devices[handle];
+	struct client *c = v->creator;
+	const char *devnode;
+	int ret;
+
+	ret = evemu_wait_devnodes(&v->dev, 1, 0);
+	if (ret == -ETIMEDOUT && now_ms() < v->deadline)
+		return 0;
+
+	devnode = ret == 0 ? evemu_get_devnode(v->dev) : NULL;
+	if (devnode) {
+		v->fd = open(devnode, O_WRONLY | O_CLOEXEC);
+		ret = v->fd < 0 ? -errno : 0;
+	}
+
+	v->creator = NULL;
+	c->creating = 0;
+	if (!devnode || ret < 0) {
+		reply(c, "error could not create device: %s\n",
+		      strerror(ret < 0 ? -ret : ENODEV));
+		free_device(handle);
+	} else {
+		reply(c, "ok %ld %s\n", handle, devnode);
+	}
+	return 1;
+}
+
+static int create_device(struct client *c, const char *text, size_t size)
+{
+	struct evemu_desc desc;
+	struct vdev *v, **grown;
+	int *grown_dirty;
+	int handle, ret;
+
+	/* the text is the client's, it is parsed and not cached on disk */
+	ret = evemu_desc_read_buffer(&desc, text, size);
+	if (ret <= 0) {
+		reply(c, "error invalid description\n");
+		return 0;
+	}
+
+	for (handle = 0; handle < device_count; handle++)
+		if (!devices[handle])
+			break;
+	if (handle == device_count) {
+		grown = realloc(devices, (device_count + 1) * sizeof(*devices));
+		if (grown)
+			devices = grown;
+		grown_dirty = realloc(dirty, (device_count + 1) * sizeof(*dirty));
+		if (grown_dirty)
+			dirty = grown_dirty;
+		if (!grown || !grown_dirty) {
+			reply(c, "error %s\n", strerror(ENOMEM));
+			return 0;
+		}
+		devices[device_count++] = NULL;
+	}
+
+	v = calloc(1, sizeof(*v));
+	if (!v || !(v->dev = evemu_new(NULL))) {
+		free(v);
+		reply(c, "error %s\n", strerror(ENOMEM));
+		return 0;
+	}
+	v->fd = -1;
+	evemu_desc_to_device(&desc, v->dev);
+	if (strlen(evemu_get_name(v->dev)) == 0) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "evemu-daemon-%d-%d", getpid(), handle);
+		evemu_set_name(v->dev, name);
+	}
+
+	ret = evemu_create_managed(v->dev);
+	if (ret < 0) {
+		reply(c, "error could not create device: %s\n", strerror(-ret));
+		evemu_delete(v->dev);
+		free(v);
+		return 0;
+	}
+
+	/* the poll loop answers once the device node is ready */
+	v->creator = c;
+	v->deadline = now_ms() + DEVNODE_TIMEOUT_MS;
+	c->creating = 1;
+	devices[handle] = v;
+	finish_device(handle);
+	return 0;
+}
+
+/* returns how many creations were answered, sets whether any still wait */
+static int finish_devices(int *waiting)
+{
+	int handle, finished = 0;
+
+	*waiting = 0;
+	for (handle = 0; handle < device_count; handle++) {
+		struct vdev *v = devices[handle];
+
+		if (!v || !v->creator)
+			continue;
+		if (finish_device(handle))
+			finished++;
+		else
+			*waiting = 1;
+	}
+	return finished;
+}
+
+static void destroy_device(struct client *c, long handle)
+{
+	struct vdev *v = get_device(handle);
+
+	if (!v) {
+		reply(c, "error no device %ld\n", handle);
+		return;
+	}
+
+	/* nothing queued may outlive the device, or go to the next one */
+	flush_devices();
+	free_device(handle);
+	reply(c, "ok\n");
+}
+
+/* E: <handle> <sec>.<usec> <type> <code> <value> [# ...], as ev-record writes it */
+static int parse_event(const char *line, const char *eol, long *handle,
+		       unsigned int *type, unsigned int *code, int *value)
+{
+	char *end;
+
+	*handle = strtol(line + 2, &end, 10);
+	strtoul(end, &end, 10);
+	if (*end++ != '.')
+		return -1;
+	strtoul(end, &end, 10);
+	*type = strtoul(end, &end, 16);
+	*code = strtoul(end, &end, 16);
+	*value = strtol(end, &end, 10);
+	while (*end == ' ' || *end == '\t')
+		end++;
+	/* ev-record names the event in a comment, as evemu_read_event() skips */
+	if (end < eol && *end == '#')
+		end = (char *)eol;
+	return end == eol ? 0 : -1;
+}
+
+/*
+ * Handles the command at the start of the input buffer. Returns the
+ * bytes it took, zero if more input is needed first, or negative if the
+ * client breaks the protocol.
+ */
+static long handle_command(struct client *c, const char *line, size_t avail)
+{
+	const char *eol = memchr(line, '\n', avail);
+	size_t len;
+	long handle, n;
+	char *end;
+
+	if (!eol)
+		return avail == IN_SIZE ? -1 : 0;
+	len = eol - line + 1;
+
+	if (strncmp(line, "E:", 2) == 0) {
+		unsigned int type, code;
+		struct vdev *v;
+		int value;
+
+		if (parse_event(line, eol, &handle, &type, &code, &value) < 0)
+			reply(c, "error invalid event %.*s\n", ECHO_LEN(len), line);
+		else if (!(v = get_device(handle)))
+			reply(c, "error no device %ld\n", handle);
+		else
+			queue_event(handle, v, type, code, value);
+	} else if (strncmp(line, "B ", 2) == 0) {
+		handle = strtol(line + 2, &end, 10);
+		n = strtol(end, &end, 10);
+		if (*end != '\n' || n < 0)
+			return -1;
+		/* a stream for a missing device is read all the same */
+		if (!get_device(handle))
+			reply(c, "error no device %ld\n", handle);
+		c->bin_handle = handle;
+		c->bin_left = n;
+	} else if (strncmp(line, "create ", 7) == 0) {
+		n = strtol(line + 7, &end, 10);
+		if (*end != '\n' || n <= 0 || n > IN_SIZE / 2)
+			return -1;
+		if (avail < len + n)
+			return 0;
+		create_device(c, eol + 1, n);
+		len += n;
+	} else if (strncmp(line, "destroy ", 8) == 0) {
+		handle = strtol(line + 8, &end, 10);
+		destroy_device(c, handle);
+	} else if (len == 5 && strncmp(line, "sync\n", 5) == 0) {
+		flush_devices();
+		reply(c, "ok\n");
+	} else if (len > 1) {
+		reply(c, "error unknown command %.*s\n", ECHO_LEN(len), line);
+	}
+
+	return len;
+}
+
+static size_t handle_events(struct client *c, const char *data, size_t avail)
+{
+	struct vdev *v = get_device(c->bin_handle);
+	long n = avail / sizeof(struct daemon_event);
+	long i;
+
+	if (n > c->bin_left)
+		n = c->bin_left;
+
+	for (i = 0; v && i < n; i++) {
+		struct daemon_event ev;
+
+		memcpy(&ev, data + i * sizeof(ev), sizeof(ev));
+		queue_event(c->bin_handle, v, ev.type, ev.code, ev.value);
+	}
+
+	c->bin_left -= n;
+	return n * sizeof(struct daemon_event);
+}
+
+/* handles what the client sent, as far as its answers fit */
+static int process_client(struct client *c)
+{
+	size_t pos = 0;
+	long n;
+
+	while (!c->creating && c->out_len + REPLY_MAX <= OUT_SIZE) {
+		if (c->bin_left > 0) {
+			n = handle_events(c, c->in + pos, c->in_len - pos);
+		} else {
+			n = handle_command(c, c->in + pos, c->in_len - pos);
+			if (n < 0)
+				return -1;
+		}
+		if (n == 0)
+			break;
+		pos += n;
+	}
+
+	memmove(c->in, c->in + pos, c->in_len - pos);
+	c->in_len -= pos;
+	flush_devices();
+	return 0;
+}
+
+static int send_replies(struct client *c)
+{
+	ssize_t n;
+
+	if (c->out_len == 0)
+		return 0;
+
+	n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	memmove(c->out, c->out + n, c->out_len - n);
+	c->out_len -= n;
+	return 0;
+}
+
+static void close_client(int i)
+{
+	int handle;
+
+	/* nobody is left to learn the handle of a device it was creating */
+	for (handle = 0; handle < device_count; handle++)
+		if (devices[handle] && devices[handle]->creator == clients[i])
+			free_device(handle);
+
+	close(clients[i]->fd);
+	free(clients[i]);
+	clients[i] = NULL;
+}
+
+static void accept_client(int sock)
+{
+	int fd, i;
+
+	fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	for (i = 0; i < CLIENT_MAX; i++)
+		if (!clients[i])
+			break;
+	if (i == CLIENT_MAX || !(clients[i] = calloc(1, sizeof(struct client)))) {
+		fprintf(stderr, "error: too many clients\n");
+		close(fd);
+		return;
+	}
+	clients[i]->fd = fd;
+}
+
+/* reads more of a client, returns negative once the client is gone */
+static int read_client(struct client *c)
+{
+	ssize_t n;
+
+	if (c->in_len == IN_SIZE)
+		return process_client(c);
+	n = read(c->fd, c->in + c->in_len, IN_SIZE - c->in_len);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	if (n == 0)
+		return -1;
+
+	c->in_len += n;
+	return process_client(c);
+}
+
+/* goes on with the clients whose devices were created meanwhile */
+static void resume_clients(void)
+{
+	int i;
+
+	for (i = 0; i < CLIENT_MAX; i++) {
+		struct client *c = clients[i];
+		int ret;
+
+		if (!c || c->creating)
+			continue;
+		ret = process_client(c);
+		if (ret == 0)
+			ret = send_replies(c);
+		if (ret < 0)
+			close_client(i);
+	}
+}
+
+static int serve(int sock)
+{
+	struct pollfd pfds[CLIENT_MAX + 1];
+	int map[CLIENT_MAX + 1];
+	int i, n, waiting = 0;
+
+	while (!stop) {
+		n = 0;
+		pfds[n].fd = sock;
+		pfds[n].events = POLLIN;
+		map[n++] = -1;
+
+		for (i = 0; i < CLIENT_MAX; i++) {
+			struct client *c = clients[i];
+
+			if (!c)
+				continue;
+			pfds[n].fd = c->fd;
+			pfds[n].events = 0;
+			/* backpressure: nothing more is read than can be handled */
+			if (!c->creating && c->in_len < IN_SIZE &&
+			    c->out_len + REPLY_MAX <= OUT_SIZE)
+				pfds[n].events |= POLLIN;
+			if (c->out_len > 0)
+				pfds[n].events |= POLLOUT;
+			map[n++] = i;
+		}
+
+		if (poll(pfds, n, waiting ? DEVNODE_INTERVAL_MS : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		if (pfds[0].revents & POLLIN)
+			accept_client(sock);
+
+		for (i = 1; i < n; i++) {
+			struct client *c = clients[map[i]];
+			int ret = 0;
+
+			if (pfds[i].revents & POLLOUT) {
+				ret = send_replies(c);
+				/* room for answers again, go on with what is buffered */
+				if (ret == 0)
+					ret = process_client(c);
+			}
+			if (ret == 0 && pfds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				ret = read_client(c);
+			if (ret == 0)
+				ret = send_replies(c);
+			if (ret < 0)
+				close_client(map[i]);
+		}
+
+		if (finish_devices(&waiting) > 0)
+			resume_clients();
+	}
+
+	return 0;
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "error: socket path too long\n");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sock < 0)
+		return -1;
+
+	/* a socket left over by an earlier daemon, and nothing else */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(sock, CLIENT_MAX) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sigaction act;
+	int sock, ret, i;
+
+	if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+		if (counters_report(1))
+			fprintf(stderr, "error: could not set up statistics\n");
+		argc--;
+		argv++;
+	}
+	if (argc != 2) {
+		usage();
+		return -1;
+	}
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = on_signal;
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+
+	sock = listen_on(argv[1]);
+	if (sock < 0) {
+		fprintf(stderr, "error: could not listen on %s: %s\n",
+			argv[1], strerror(errno));
+		return -1;
+	}
+
+	ret = serve(sock);
+	if (ret < 0)
+		fprintf(stderr, "error: %s\n", strerror(-ret));
+
+	for (i = 0; i < CLIENT_MAX; i++)
+		if (clients[i])
+			close_client(i);
+	for (i = 0; i < device_count; i++)
+		if (devices[i])
+			free_device(i);
+	free(devices);
+	free(dirty);
+	close(sock);
+	unlink(argv[1]);
+
+	return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,317 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+#define _GNU_SOURCE
+
+#include "evemu.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libevdev/libevdev.h>
+
+static struct option opts[] = {
+	{ "jobs", required_argument, 0, 'j'},
+	{ "count", no_argument, 0, 'c'},
+	{ 0, 0, 0, 0 }
+};
+
+static const struct {
+	const char *prefix;
+	unsigned int type;
+} code_prefixes[] = {
+	{ "KEY_", EV_KEY },
+	{ "BTN_", EV_KEY },
+	{ "REL_", EV_REL },
+	{ "ABS_", EV_ABS },
+	{ "MSC_", EV_MSC },
+	{ "SW_", EV_SW },
+	{ "LED_", EV_LED },
+	{ "SND_", EV_SND },
+	{ "REP_", EV_REP },
+	{ "FF_", EV_FF },
+};
+
+static const char *abs_fields[] = {
+	[EVEMU_DB_ABS_MINIMUM] = "min",
+	[EVEMU_DB_ABS_MAXIMUM] = "max",
+	[EVEMU_DB_ABS_FUZZ] = "fuzz",
+	[EVEMU_DB_ABS_FLAT] = "flat",
+	[EVEMU_DB_ABS_RESOLUTION] = "res",
+	[EVEMU_DB_ABS_RANGE] = "range",
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s build [--jobs <n>] <directory> <index>\n"
+			"       %s query [--count] <index> [predicate...]\n",
+			program_invocation_short_name,
+			program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "build parses every device description or recording in the\n"
+			"directory, with one thread per CPU unless --jobs says otherwise,\n"
+			"and writes their capabilities to the index file.\n"
+			"\n"
+			"query lists the indexed devices that match all predicates:\n"
+			"  INPUT_PROP_BUTTONPAD    the device has the property\n"
+			"  EV_ABS                  the device has the event type\n"
+			"  ABS_MT_SLOT             the device has the event code\n"
+			"  !BTN_TOOL_PEN           the device does not have it\n"
+			"  ABS_MT_SLOT.range>5     the axis exists and its field compares,\n"
+			"                          fields are min, max, fuzz, flat, res and\n"
+			"                          range (max - min + 1, e.g. the slots),\n"
+			"                          comparisons are =, <, <=, > and >=\n"
+			"--count prints the number of matches only.\n");
+}
+
+static long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static int parse_jobs(const char *arg)
+{
+	char *endp;
+	long jobs = strtol(arg, &endp, 0);
+
+	if (*arg == '\0' || *endp != '\0' || jobs <= 0) {
+		fprintf(stderr, "error: invalid argument '%s'\n", arg);
+		return -1;
+	}
+	return jobs;
+}
+
+static int build(int argc, char *argv[])
+{
+	int jobs = 0;
+	long start;
+	int rc;
+
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "j:", opts, &option_index);
+
+		if (c == -1)
+			break;
+		if (c != 'j') {
+			usage();
+			return -1;
+		}
+		jobs = parse_jobs(optarg);
+		if (jobs < 0)
+			return -1;
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		return -1;
+	}
+
+	start = now_usec();
+	rc = evemu_db_build(argv[optind], argv[optind + 1], jobs);
+	if (rc < 0) {
+		fprintf(stderr, "error: could not index %s: %s\n",
+			argv[optind], strerror(-rc));
+		return -1;
+	}
+
+	fprintf(stderr, "indexed %d devices in %.1f ms\n", rc,
+		(now_usec() - start) / 1000.0);
+	return 0;
+}
+
+/* the type of an event code name, from its prefix */
+static int code_type(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(code_prefixes)/sizeof(code_prefixes[0]); i++)
+		if (strncmp(name, code_prefixes[i].prefix,
+			    strlen(code_prefixes[i].prefix)) == 0)
+			return code_prefixes[i].type;
+	return -1;
+}
+
+static int parse_range(struct evemu_db_query *q, int code, const char *spec)
+{
+	size_t len, i;
+	long value;
+	int32_t min = INT32_MIN, max = INT32_MAX;
+	char *endp;
+
+	for (i = 0; i < sizeof(abs_fields)/sizeof(abs_fields[0]); i++) {
+		len = strlen(abs_fields[i]);
+		if (strncmp(spec, abs_fields[i], len) == 0 &&
+		    strchr("=<>", spec[len]))
+			break;
+	}
+	if (i == sizeof(abs_fields)/sizeof(abs_fields[0]))
+		return -1;
+	spec += len;
+
+	value = strtol(spec + (spec[1] == '=' ? 2 : 1), &endp, 0);
+	if (*endp != '\0' || value < INT32_MIN || value > INT32_MAX)
+		return -1;
+
+	if (spec[0] == '=' && spec[1] != '=')
+		min = max = value;
+	else if (strncmp(spec, "<=", 2) == 0)
+		max = value;
+	else if (spec[0] == '<')
+		max = value - 1;
+	else if (strncmp(spec, ">=", 2) == 0)
+		min = value;
+	else if (spec[0] == '>')
+		min = value + 1;
+	else
+		return -1;
+
+	return evemu_db_query_require_abs(q, code, i, min, max);
+}
+
+static int parse_predicate(struct evemu_db_query *q, const char *arg)
+{
+	int present = 1;
+	char *name, *field;
+	int type, code, rc = -1;
+
+	if (*arg == '!') {
+		present = 0;
+		arg++;
+	}
+
+	name = strdup(arg);
+	if (!name)
+		return -1;
+	field = strchr(name, '.');
+	if (field)
+		*field++ = '\0';
+
+	if (strncmp(name, "INPUT_PROP_", 11) == 0) {
+		code = libevdev_property_from_name(name);
+		if (code >= 0 && !field)
+			rc = evemu_db_query_require_prop(q, code, present);
+	} else if (strncmp(name, "EV_", 3) == 0) {
+		type = libevdev_event_type_from_name(name);
+		if (type >= 0 && !field)
+			rc = evemu_db_query_require_event(q, type, -1, present);
+	} else if ((type = code_type(name)) >= 0) {
+		code = libevdev_event_code_from_name(type, name);
+		if (code < 0)
+			rc = -1;
+		else if (!field)
+			rc = evemu_db_query_require_event(q, type, code, present);
+		else if (type == EV_ABS && present)
+			rc = parse_range(q, code, field);
+	}
+
+	if (rc < 0)
+		fprintf(stderr, "error: invalid predicate '%s'\n", arg);
+	free(name);
+	return rc;
+}
+
+static int query(int argc, char *argv[])
+{
+	struct evemu_db_query *q = NULL;
+	struct evemu_db *db;
+	unsigned int *matches = NULL;
+	int count_only = 0;
+	long start, elapsed;
+	ssize_t n, i;
+	int ret = -1;
+
+	while (1) {
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "c", opts, &option_index);
+
+		if (c == -1)
+			break;
+		if (c != 'c') {
+			usage();
+			return -1;
+		}
+		count_only = 1;
+	}
+
+	if (argc - optind < 1) {
+		usage();
+		return -1;
+	}
+
+	db = evemu_db_open(argv[optind]);
+	if (!db) {
+		fprintf(stderr, "error: could not open index %s: %s\n",
+			argv[optind], strerror(errno));
+		return -1;
+	}
+
+	q = evemu_db_query_new();
+	if (!q)
+		goto out;
+	for (i = optind + 1; i < argc; i++)
+		if (parse_predicate(q, argv[i]) < 0)
+			goto out;
+
+	start = now_usec();
+	n = evemu_db_match(db, q, &matches);
+	elapsed = now_usec() - start;
+	if (n < 0) {
+		fprintf(stderr, "error: query failed: %s\n", strerror(-n));
+		goto out;
+	}
+
+	if (count_only)
+		printf("%zd\n", n);
+	else
+		for (i = 0; i < n; i++)
+			printf("%s: %s\n", evemu_db_get_path(db, matches[i]),
+			       evemu_db_get_name(db, matches[i]));
+
+	fprintf(stderr, "%zd of %u devices match, in %.3f ms\n",
+		n, evemu_db_get_count(db), elapsed / 1000.0);
+	ret = 0;
+
+out:
+	free(matches);
+	evemu_db_query_delete(q);
+	evemu_db_close(db);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		usage();
+		return -1;
+	}
+
+	/* the subcommand parses its options from the arguments after it */
+	if (strcmp(argv[1], "build") == 0)
+		return build(argc - 1, argv + 1);
+	if (strcmp(argv[1], "query") == 0)
+		return query(argc - 1, argv + 1);
+
+	usage();
+	return -1;
+}
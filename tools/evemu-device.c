@@ -39,6 +39,7 @@
  *
  ****************************************************************************/
 
+#define _GNU_SOURCE
 #include "evemu.h"
 #include <dirent.h>
 #include <errno.h>
@@ -50,6 +51,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "evemu-counters.h"
+
 /*
  * Finds the newly created device node and holds it open.
  */
@@ -113,8 +116,15 @@ int main(int argc, char *argv[])
 {
 	FILE *fp;
 	int ret;
+	if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+		if (counters_report(1))
+			fprintf(stderr, "error: could not set up statistics\n");
+		argc--;
+		argv++;
+	}
 	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <dev.prop>\n", argv[0]);
+		fprintf(stderr, "Usage: %s [--stats] <dev.prop>\n",
+			program_invocation_short_name);
 		return -1;
 	}
 	fp = fopen(argv[1], "r");
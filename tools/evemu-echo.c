@@ -44,6 +44,8 @@
 #include <fcntl.h>
 #include <string.h>
 
+#include "evemu-counters.h"
+
 static int evemu_echo_describe(FILE *fp)
 {
 	struct evemu_device *dev;
@@ -76,8 +78,14 @@ static int evemu_echo_event(FILE *fp)
 int main(int argc, char *argv[])
 {
 	FILE *fp;
+	if (argc > 1 && strcmp(argv[1], "--stats") == 0) {
+		if (counters_report(0))
+			fprintf(stderr, "error: could not set up statistics\n");
+		argc--;
+		argv++;
+	}
 	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <dev.prop>\n", argv[0]);
+		fprintf(stderr, "Usage: %s [--stats] <dev.prop>\n", argv[0]);
 		return -1;
 	}
 	fp = fopen(argv[1], "r");
@@ -31,12 +31,16 @@
 #include <linux/input.h>
 #include <libevdev/libevdev.h>
 
+#include "evemu-counters.h"
+
 static struct option opts[] = {
 	{ "type", required_argument, 0, 't'},
 	{ "code", required_argument, 0, 'c'},
 	{ "value", required_argument, 0, 'v'},
 	{ "sync", no_argument, 0, 's'},
-	{ "device", required_argument, 0, 'd'}
+	{ "device", required_argument, 0, 'd'},
+	{ "stats", no_argument, 0, 'S'},
+	{ 0, 0, 0, 0 }
 };
 
 static int parse_arg(const char *arg, long int *value)
@@ -69,7 +73,7 @@ static int parse_code(long int type, const char *arg, long int *value)
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: %s [--sync] <device> --type <type> --code <code> --value <value>\n", program_invocation_short_name);
+	fprintf(stderr, "Usage: %s [--sync] [--stats] <device> --type <type> --code <code> --value <value>\n", program_invocation_short_name);
 }
 
 int main(int argc, char *argv[])
@@ -114,6 +118,10 @@ int main(int argc, char *argv[])
 			case 's': /* sync */
 				sync = 1;
 				break;
+			case 'S': /* stats */
+				if (counters_report(0))
+					fprintf(stderr, "error: could not set up statistics\n");
+				break;
 			default:
 				usage();
 				goto out;
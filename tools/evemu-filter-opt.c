@@ -0,0 +1,81 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libevdev/libevdev.h>
+
+#include "evemu-filter-opt.h"
+
+static long parse_number(const char *arg)
+{
+	char *endp;
+	long value = strtol(arg, &endp, 0);
+
+	return (*arg == '\0' || *endp != '\0') ? -1 : value;
+}
+
+static struct evemu_filter *filter_create(int accept)
+{
+	struct evemu_filter *filter = evemu_filter_new(NULL);
+	unsigned int type;
+
+	/* keep options start from nothing but EV_SYN */
+	for (type = EV_SYN + 1; filter && accept && type < EV_CNT; type++)
+		evemu_filter_set(filter, type, -1, 0);
+
+	return filter;
+}
+
+int filter_option(struct evemu_filter **filter, const char *event, int accept)
+{
+	char type_name[64];
+	const char *colon = strchr(event, ':');
+	size_t len = colon ? (size_t)(colon - event) : strlen(event);
+	long type, code = -1;
+
+	if (len >= sizeof(type_name))
+		return -EINVAL;
+	memcpy(type_name, event, len);
+	type_name[len] = '\0';
+
+	type = libevdev_event_type_from_name(type_name);
+	if (type == -1)
+		type = parse_number(type_name);
+	if (type < 0)
+		return -EINVAL;
+
+	if (colon) {
+		code = libevdev_event_code_from_name(type, colon + 1);
+		if (code == -1)
+			code = parse_number(colon + 1);
+		if (code < 0)
+			return -EINVAL;
+	}
+
+	if (!*filter) {
+		*filter = filter_create(accept);
+		if (!*filter)
+			return -ENOMEM;
+	}
+	return evemu_filter_set(*filter, type, code, accept);
+}
@@ -0,0 +1,38 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_FILTER_OPT_H
+#define EVEMU_FILTER_OPT_H
+
+struct evemu_filter;
+
+/**
+ * filter_option() - add an event option like --only or --drop to a filter
+ * @filter: the filter to change, created on the first call
+ * @event: <type>[:<code>], as symbolic names from linux/input.h or numbers
+ * @accept: nonzero to keep the events, zero to drop them
+ *
+ * The options apply in order. A filter created by a drop option starts
+ * with all events, one created by a keep option with EV_SYN only.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int filter_option(struct evemu_filter **filter, const char *event, int accept);
+
+#endif
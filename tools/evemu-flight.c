@@ -0,0 +1,473 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Flight recorder: each device has a ring of raw events, allocated and
+ * touched once at startup, so a busy device cannot push the history of a
+ * quiet one out. The record loop only copies structs. A dump forks, so the
+ * child formats a copy-on-write snapshot of the ring while the parent
+ * keeps draining the devices.
+ */
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evemu-flight.h"
+#include "evemu-opt.h"
+
+/* a multi-device dump must stay within what ev-replay can play */
+#define MAX_FLIGHT_DEVICES (MAX_DEVICES + 1)
+#define READ_BATCH 64
+
+struct ring {
+	struct input_event *events;
+	size_t capacity;
+	size_t head;		/* next slot to write */
+	size_t count;
+};
+
+struct flight {
+	char **devices;
+	int count;
+	int fds[MAX_FLIGHT_DEVICES];
+	struct evemu_device *devs[MAX_FLIGHT_DEVICES];
+	clockid_t clock;
+	struct ring rings[MAX_FLIGHT_DEVICES];
+	const struct flight_config *config;
+	int dumps;
+
+	int fifo;
+	char command[64];
+	size_t command_len;
+};
+
+static volatile sig_atomic_t dump_requested;
+static volatile sig_atomic_t quit_requested;
+
+static void dump_handler(int sig __attribute__((unused)))
+{
+	dump_requested = 1;
+}
+
+static void quit_handler(int sig __attribute__((unused)))
+{
+	quit_requested = 1;
+}
+
+static inline void ring_push(struct ring *ring, const struct input_event *ev)
+{
+	ring->events[ring->head] = *ev;
+	if (++ring->head == ring->capacity)
+		ring->head = 0;
+	if (ring->count < ring->capacity)
+		ring->count++;
+}
+
+/* i-th oldest event in the ring */
+static const struct input_event *ring_get(const struct ring *ring, size_t i)
+{
+	return &ring->events[(ring->head + ring->capacity - ring->count + i) %
+			     ring->capacity];
+}
+
+static long event_usec(const struct input_event *ev)
+{
+	return ev->time.tv_sec * 1000000L + ev->time.tv_usec;
+}
+
+/* Merges the rings by timestamp, there are few enough to scan them all */
+static void write_events(FILE *fp, const struct flight *f, long cutoff)
+{
+	size_t pos[MAX_FLIGHT_DEVICES] = { 0 };
+	long first = -1;
+	int i;
+
+	for (i = 0; i < f->count; i++)
+		while (pos[i] < f->rings[i].count &&
+		       event_usec(ring_get(&f->rings[i], pos[i])) < cutoff)
+			pos[i]++;
+
+	for (;;) {
+		struct input_event ev;
+		int next = -1;
+		long time;
+
+		for (i = 0; i < f->count; i++) {
+			if (pos[i] == f->rings[i].count)
+				continue;
+			if (next < 0 ||
+			    event_usec(ring_get(&f->rings[i], pos[i])) <
+			    event_usec(ring_get(&f->rings[next], pos[next])))
+				next = i;
+		}
+		if (next < 0)
+			break;
+
+		ev = *ring_get(&f->rings[next], pos[next]++);
+		time = event_usec(&ev);
+		if (first < 0)
+			first = time;
+
+		time -= first;
+		ev.time.tv_sec = time / 1000000;
+		ev.time.tv_usec = time % 1000000;
+		if (f->count == 1)
+			evemu_write_event(fp, &ev);
+		else
+			evemu_write_event_with_id(fp, &ev, next);
+	}
+}
+
+static int write_dump(const struct flight *f, const char *path, long cutoff)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	if (f->count == 1) {
+		evemu_write(f->devs[0], fp);
+		fprintf(fp, "################################\n");
+		fprintf(fp, "#      Waiting for events      #\n");
+		fprintf(fp, "################################\n");
+	} else {
+		fprintf(fp, "[Devices Begin]\n");
+		fprintf(fp, "count = %d\n", f->count);
+		fprintf(fp, "[Devices End]\n");
+		for (i = 0; i < f->count; i++) {
+			fprintf(fp, "\n[Device Begin]\n");
+			fprintf(fp, "id = %d\n", i);
+			fprintf(fp, "type = unknown\n");
+			fprintf(fp, "name = %s\n", f->devices[i]);
+			evemu_write(f->devs[i], fp);
+			fprintf(fp, "\n[Device End]\n");
+		}
+		fprintf(fp, "[Events]\n");
+	}
+
+	write_events(fp, f, cutoff);
+
+	return fclose(fp) ? -errno : 0;
+}
+
+static void dump(struct flight *f)
+{
+	char path[PATH_MAX], stamp[32];
+	struct timespec now;
+	time_t t = time(NULL);
+	long cutoff;
+	pid_t pid;
+	int rc;
+
+	clock_gettime(f->clock, &now);
+	cutoff = now.tv_sec * 1000000L + now.tv_nsec / 1000 -
+		 f->config->seconds * 1000000L;
+
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+	snprintf(path, sizeof(path), "%s-%s-%d.event",
+		 f->config->prefix, stamp, f->dumps++);
+
+	pid = fork();
+	if (pid > 0)
+		return;
+
+	/* without a child, dump synchronously and lose some events */
+	rc = write_dump(f, path, cutoff);
+	if (rc)
+		fprintf(stderr, "error: could not write %s: %s\n", path, strerror(-rc));
+	else
+		fprintf(stderr, "%s\n", path);
+
+	if (pid == 0)
+		_exit(rc ? 1 : 0);
+}
+
+static void read_fifo(struct flight *f)
+{
+	char *nl;
+	ssize_t n;
+
+	n = read(f->fifo, f->command + f->command_len,
+		 sizeof(f->command) - f->command_len);
+	if (n <= 0)
+		return;
+	f->command_len += n;
+
+	while ((nl = memchr(f->command, '\n', f->command_len))) {
+		*nl = '\0';
+		if (strcmp(f->command, "dump") == 0)
+			dump_requested = 1;
+		else if (strcmp(f->command, "quit") == 0)
+			quit_requested = 1;
+		else
+			fprintf(stderr, "unknown command: %s\n", f->command);
+
+		f->command_len -= nl + 1 - f->command;
+		memmove(f->command, nl + 1, f->command_len);
+	}
+
+	/* a line that does not fit is garbage */
+	if (f->command_len == sizeof(f->command))
+		f->command_len = 0;
+}
+
+/* All rings are merged and trimmed on one clock. Devices stamp
+ * CLOCK_REALTIME unless they are switched, so if one of them cannot
+ * be switched to CLOCK_MONOTONIC, all go back to CLOCK_REALTIME. */
+static int set_clocks(struct flight *f)
+{
+#ifdef EVIOCSCLOCKID
+	int monotonic[MAX_FLIGHT_DEVICES] = { 0 };
+	int i, clockid;
+
+	f->clock = CLOCK_MONOTONIC;
+	for (i = 0; i < f->count; i++) {
+		clockid = CLOCK_MONOTONIC;
+		monotonic[i] = ioctl(f->fds[i], EVIOCSCLOCKID, &clockid) == 0;
+		if (!monotonic[i])
+			f->clock = CLOCK_REALTIME;
+	}
+	if (f->clock == CLOCK_MONOTONIC)
+		return 0;
+
+	for (i = 0; i < f->count; i++) {
+		clockid = CLOCK_REALTIME;
+		if (monotonic[i] &&
+		    ioctl(f->fds[i], EVIOCSCLOCKID, &clockid) < 0) {
+			fprintf(stderr, "error: could not put %s on the clock of the other devices\n",
+				f->devices[i]);
+			return -errno;
+		}
+	}
+#else
+	f->clock = CLOCK_REALTIME;
+#endif
+	return 0;
+}
+
+static int open_devices(struct flight *f)
+{
+	int i;
+
+	for (i = 0; i < f->count; i++) {
+		f->fds[i] = open(f->devices[i], O_RDONLY | O_NONBLOCK);
+		if (f->fds[i] < 0) {
+			fprintf(stderr, "error: could not open device %s\n", f->devices[i]);
+			return -errno;
+		}
+
+		/* a grabbed device would only ever fill the ring with nothing */
+		if (ioctl(f->fds[i], EVIOCGRAB, (void*)1) < 0) {
+			fprintf(stderr, "error: %s is grabbed and I cannot record events\n",
+				f->devices[i]);
+			fprintf(stderr, "see the evemu-record man page for more information\n");
+			return -1;
+		}
+		ioctl(f->fds[i], EVIOCGRAB, (void*)0);
+
+		f->devs[i] = evemu_new(NULL);
+		if (!f->devs[i])
+			return -ENOMEM;
+		if (evemu_extract(f->devs[i], f->fds[i])) {
+			fprintf(stderr, "error: could not describe device %s\n", f->devices[i]);
+			return -1;
+		}
+
+		if (f->config->filter)
+			evemu_filter_apply(f->config->filter, f->fds[i]);
+	}
+
+	return set_clocks(f);
+}
+
+static int install_handlers(sigset_t *origmask)
+{
+	struct sigaction act;
+	sigset_t mask;
+
+	memset(&act, '\0', sizeof(act));
+	act.sa_handler = &dump_handler;
+	if (sigaction(SIGUSR1, &act, NULL) < 0)
+		return -1;
+	act.sa_handler = &quit_handler;
+	if (sigaction(SIGINT, &act, NULL) < 0 ||
+	    sigaction(SIGTERM, &act, NULL) < 0)
+		return -1;
+	/* dump children reap themselves */
+	act.sa_handler = SIG_IGN;
+	if (sigaction(SIGCHLD, &act, NULL) < 0)
+		return -1;
+
+	/* signals are only delivered inside ppoll, so none is missed */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	return sigprocmask(SIG_BLOCK, &mask, origmask);
+}
+
+static int run(struct flight *f, const sigset_t *origmask)
+{
+	struct pollfd pfds[MAX_FLIGHT_DEVICES + 1];
+	struct input_event batch[READ_BATCH];
+	int npfds = f->count;
+	int i, j;
+
+	for (i = 0; i < f->count; i++) {
+		pfds[i].fd = f->fds[i];
+		pfds[i].events = POLLIN;
+	}
+	if (f->fifo >= 0) {
+		pfds[npfds].fd = f->fifo;
+		pfds[npfds].events = POLLIN;
+		npfds++;
+	}
+
+	while (!quit_requested) {
+		if (ppoll(pfds, npfds, NULL, origmask) < 0 && errno != EINTR)
+			return -errno;
+
+		for (i = 0; i < f->count; i++) {
+			ssize_t n;
+
+			if (!(pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+
+			n = read(f->fds[i], batch, sizeof(batch));
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+				/* unplugged, keep what we have */
+				fprintf(stderr, "%s: %s\n", f->devices[i],
+					n ? strerror(errno) : "end of file");
+				pfds[i].fd = -1;
+				continue;
+			}
+
+			for (j = 0; j < n / (ssize_t)sizeof(batch[0]); j++) {
+				if (f->config->filter &&
+				    !evemu_filter_accepts(f->config->filter,
+							  batch[j].type, batch[j].code))
+					continue;
+				ring_push(&f->rings[i], &batch[j]);
+			}
+		}
+
+		if (f->fifo >= 0 && (pfds[npfds - 1].revents & POLLIN))
+			read_fifo(f);
+
+		if (dump_requested) {
+			dump_requested = 0;
+			dump(f);
+		}
+	}
+
+	return 0;
+}
+
+int flight_record(char **devices, int count, const struct flight_config *config)
+{
+	struct flight f;
+	sigset_t origmask;
+	int ret = -EINVAL;
+	int i;
+
+	if (count > MAX_FLIGHT_DEVICES) {
+		fprintf(stderr, "error: at most %d devices can be recorded\n",
+			MAX_FLIGHT_DEVICES);
+		return ret;
+	}
+	if (count < 1 || config->seconds <= 0 || config->rate <= 0)
+		return ret;
+
+	memset(&f, 0, sizeof(f));
+	f.devices = devices;
+	f.count = count;
+	f.config = config;
+	f.fifo = -1;
+	for (i = 0; i < MAX_FLIGHT_DEVICES; i++)
+		f.fds[i] = -1;
+
+	ret = open_devices(&f);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		struct ring *ring = &f.rings[i];
+
+		ring->capacity = (size_t)config->seconds * config->rate;
+		ring->events = malloc(ring->capacity * sizeof(*ring->events));
+		if (!ring->events) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		/* fault every page in now rather than on the record path */
+		memset(ring->events, 0, ring->capacity * sizeof(*ring->events));
+	}
+
+	if (config->fifo) {
+		if (mkfifo(config->fifo, 0600) < 0 && errno != EEXIST) {
+			ret = -errno;
+			fprintf(stderr, "error: could not create %s\n", config->fifo);
+			goto out;
+		}
+		/* O_RDWR keeps the FIFO from reporting EOF between writers */
+		f.fifo = open(config->fifo, O_RDWR | O_NONBLOCK);
+		if (f.fifo < 0) {
+			ret = -errno;
+			fprintf(stderr, "error: could not open %s\n", config->fifo);
+			goto out;
+		}
+	}
+
+	if (install_handlers(&origmask) < 0) {
+		ret = -errno;
+		fprintf(stderr, "Could not attach signal handlers.\n");
+		goto out;
+	}
+
+	fprintf(stderr, "recording the last %d seconds (%zu events per device), "
+		"SIGUSR1 to dump\n", config->seconds, f.rings[0].capacity);
+
+	ret = run(&f, &origmask);
+
+out:
+	if (f.fifo >= 0)
+		close(f.fifo);
+	for (i = 0; i < count; i++) {
+		if (f.fds[i] >= 0)
+			close(f.fds[i]);
+		if (f.devs[i])
+			evemu_delete(f.devs[i]);
+		free(f.rings[i].events);
+	}
+	return ret;
+}
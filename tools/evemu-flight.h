@@ -0,0 +1,49 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_FLIGHT_H
+#define EVEMU_FLIGHT_H
+
+struct evemu_filter;
+
+struct flight_config {
+	int seconds;		/* length of the window kept in memory */
+	int rate;		/* events per second per device the ring holds */
+	const char *fifo;	/* control FIFO, or NULL */
+	const char *prefix;	/* dumps go to <prefix>-<time>-<n>.event */
+	const struct evemu_filter *filter;	/* events to keep, NULL for all */
+};
+
+/**
+ * flight_record() - keep the last events of the devices in memory
+ * @devices: event nodes to record
+ * @count: number of devices
+ * @config: window size, ring size, control FIFO and dump prefix
+ *
+ * Records into preallocated rings until SIGINT or SIGTERM. SIGUSR1, or
+ * a "dump" line on the control FIFO, writes the last config->seconds of
+ * events to a new file: an evemu-record file for a single device, the
+ * ev-record format for several. A "quit" line on the FIFO stops
+ * recording.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int flight_record(char **devices, int count, const struct flight_config *config);
+
+#endif
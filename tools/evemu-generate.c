@@ -0,0 +1,152 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+#define _GNU_SOURCE
+
+#include "evemu.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evemu-counters.h"
+
+static struct option opts[] = {
+	{ "gesture", required_argument, 0, 'g'},
+	{ "fingers", required_argument, 0, 'n'},
+	{ "rate", required_argument, 0, 'r'},
+	{ "frames", required_argument, 0, 'f'},
+	{ "count", required_argument, 0, 'c'},
+	{ "stats", no_argument, 0, 'S'},
+	{ 0, 0, 0, 0 }
+};
+
+static const char *gestures[] = {
+	[EVEMU_GESTURE_TAP] = "tap",
+	[EVEMU_GESTURE_SWIPE] = "swipe",
+	[EVEMU_GESTURE_PINCH] = "pinch",
+	[EVEMU_GESTURE_PALM] = "palm",
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [--gesture tap|swipe|pinch|palm] [--fingers <n>] "
+			"[--rate <hz>] [--frames <n>] [--count <n>] [--stats] <dev.prop>\n",
+			program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Writes a recording of <count> synthetic gestures for the device\n"
+			"to stdout. Each gesture takes <frames> frames at <rate> Hz.\n"
+			"--stats prints library statistics to stderr at exit.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct evemu_device *dev = NULL;
+	struct evemu_generator *gen = NULL;
+	struct input_event frame[EVEMU_GENERATOR_FRAME_SIZE];
+	enum evemu_gesture gesture = EVEMU_GESTURE_SWIPE;
+	long fingers = 2, rate = 100, frames = 50, count = 1, total;
+	FILE *fp;
+	int stats = 0;
+	int rc = -1;
+
+	while (1) {
+		int option_index = 0;
+		long *value;
+		char *endp;
+		int c, i;
+
+		c = getopt_long(argc, argv, "", opts, &option_index);
+		if (c == -1) /* we only do long options */
+			break;
+
+		switch (c) {
+			case 'n': value = &fingers; break;
+			case 'r': value = &rate; break;
+			case 'f': value = &frames; break;
+			case 'c': value = &count; break;
+			case 'g':
+				for (i = 0; i < (int)(sizeof(gestures)/sizeof(gestures[0])); i++)
+					if (strcmp(optarg, gestures[i]) == 0)
+						break;
+				if (i == (int)(sizeof(gestures)/sizeof(gestures[0]))) {
+					fprintf(stderr, "error: invalid gesture '%s'\n", optarg);
+					return -1;
+				}
+				gesture = i;
+				continue;
+			case 'S':
+				stats = 1;
+				continue;
+			default:
+				usage();
+				return -1;
+		}
+
+		*value = strtol(optarg, &endp, 0);
+		if (*optarg == '\0' || *endp != '\0' || *value <= 0) {
+			fprintf(stderr, "error: invalid argument '%s'\n", optarg);
+			return -1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return -1;
+	}
+
+	if (stats && counters_report(0))
+		fprintf(stderr, "error: could not set up statistics\n");
+
+	fp = fopen(argv[optind], "r");
+	if (!fp) {
+		fprintf(stderr, "error: could not open file\n");
+		return -1;
+	}
+
+	dev = evemu_new(NULL);
+	if (!dev || evemu_read(dev, fp) <= 0) {
+		fprintf(stderr, "error: could not read device description\n");
+		goto out;
+	}
+
+	gen = evemu_generator_new(dev, gesture, fingers, rate, frames);
+	if (!gen) {
+		fprintf(stderr, "error: device has no absolute axes\n");
+		goto out;
+	}
+
+	total = count * evemu_generator_get_frames(gen);
+
+	evemu_write(dev, stdout);
+	while (total--) {
+		int i, n = evemu_generator_next_frame(gen, frame, EVEMU_GENERATOR_FRAME_SIZE);
+
+		for (i = 0; i < n; i++)
+			evemu_write_event(stdout, &frame[i]);
+	}
+	rc = 0;
+
+out:
+	evemu_generator_delete(gen);
+	if (dev)
+		evemu_delete(dev);
+	fclose(fp);
+	return rc;
+}
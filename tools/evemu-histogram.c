@@ -0,0 +1,89 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#include <string.h>
+
+#include "evemu-histogram.h"
+
+void histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+static unsigned int bucket_index(uint64_t value)
+{
+	unsigned int exp, sub;
+
+	if (value < (1 << HISTOGRAM_SUB_BITS))
+		return value;
+
+	exp = 63 - __builtin_clzll(value);
+	sub = (value >> (exp - HISTOGRAM_SUB_BITS + 1)) & (HISTOGRAM_SUB_COUNT - 1);
+	return (1 << HISTOGRAM_SUB_BITS) +
+	       (exp - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT + sub;
+}
+
+static uint64_t bucket_middle(unsigned int index)
+{
+	unsigned int exp, sub, shift;
+
+	if (index < (1 << HISTOGRAM_SUB_BITS))
+		return index;
+
+	index -= 1 << HISTOGRAM_SUB_BITS;
+	exp = index / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS;
+	sub = index % HISTOGRAM_SUB_COUNT;
+	shift = exp - HISTOGRAM_SUB_BITS + 1;
+	return ((uint64_t)(HISTOGRAM_SUB_COUNT + sub) << shift) +
+	       ((1ULL << shift) >> 1);
+}
+
+void histogram_add(struct histogram *h, uint64_t value)
+{
+	if (h->count == 0 || value < h->min)
+		h->min = value;
+	if (value > h->max)
+		h->max = value;
+	h->sum += value;
+	h->count++;
+	h->buckets[bucket_index(value)]++;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double percentile)
+{
+	uint64_t wanted, seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	wanted = (uint64_t)(h->count * percentile / 100.0);
+	if (wanted >= h->count)
+		return h->max;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen > wanted)
+			break;
+	}
+
+	if (i == HISTOGRAM_BUCKETS || bucket_middle(i) > h->max)
+		return h->max;
+	return bucket_middle(i) < h->min ? h->min : bucket_middle(i);
+}
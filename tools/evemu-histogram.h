@@ -0,0 +1,58 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_HISTOGRAM_H
+#define EVEMU_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Values below 2^HISTOGRAM_SUB_BITS are counted exactly, above that every
+ * power of two is split into 2^(HISTOGRAM_SUB_BITS - 1) buckets, so the
+ * relative error stays below 1% over the whole 64 bit range. */
+#define HISTOGRAM_SUB_BITS 8
+#define HISTOGRAM_SUB_COUNT (1 << (HISTOGRAM_SUB_BITS - 1))
+#define HISTOGRAM_BUCKETS ((1 << HISTOGRAM_SUB_BITS) + \
+			   (64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_COUNT)
+
+struct histogram {
+	uint64_t count;
+	uint64_t min, max, sum;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * histogram_init() - reset a histogram to empty
+ */
+void histogram_init(struct histogram *h);
+
+/**
+ * histogram_add() - count one value
+ */
+void histogram_add(struct histogram *h, uint64_t value);
+
+/**
+ * histogram_percentile() - get the value at the given percentile
+ * @percentile: 0 to 100
+ *
+ * Returns the midpoint of the bucket the percentile falls into, or 0 if
+ * the histogram is empty.
+ */
+uint64_t histogram_percentile(const struct histogram *h, double percentile);
+
+#endif
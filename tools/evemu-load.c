@@ -0,0 +1,468 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+#define _GNU_SOURCE
+
+#include "evemu.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "evemu-counters.h"
+
+#define SYSCALL(call) while (((call) == -1) && (errno == EINTR))
+
+#define MAX_FRAME 256
+
+static struct option opts[] = {
+	{ "from", required_argument, 0, 'f'},
+	{ "to", required_argument, 0, 't'},
+	{ "duration", required_argument, 0, 'd'},
+	{ "steps", required_argument, 0, 's'},
+	{ "gesture", required_argument, 0, 'g'},
+	{ "fingers", required_argument, 0, 'n'},
+	{ "stats", no_argument, 0, 'S'},
+	{ 0, 0, 0, 0 }
+};
+
+struct step {
+	long rate;	/* frames per second we aim for */
+	long start;	/* CLOCK_MONOTONIC usec */
+	long sent;
+	long received;
+	long dropped;
+	long lag_min, lag_max, lag_sum; /* usec */
+};
+
+struct load {
+	int fd;
+	int done;
+	int nsteps;
+	struct step *steps;
+	pthread_mutex_t lock;
+};
+
+/* Where the frames come from: a recording that we loop over, the
+ * gesture generator, or for relative devices a pattern that moves
+ * REL_X back and forth. */
+struct source {
+	struct input_event *events;
+	size_t nevents;
+	size_t pos;
+
+	struct evemu_generator *gen;
+	int toggle;
+};
+
+static const char *gestures[] = {
+	[EVEMU_GESTURE_TAP] = "tap",
+	[EVEMU_GESTURE_SWIPE] = "swipe",
+	[EVEMU_GESTURE_PINCH] = "pinch",
+	[EVEMU_GESTURE_PALM] = "palm",
+};
+
+static long now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_usec(long usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/* the lag is the kernel timestamp against now_usec(), on the same clock */
+static int set_monotonic(int fd)
+{
+#ifdef EVIOCSCLOCKID
+	int clockid = CLOCK_MONOTONIC;
+
+	return ioctl(fd, EVIOCSCLOCKID, &clockid);
+#else
+	errno = ENOTTY;
+	return -1;
+#endif
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [--from <hz>] [--to <hz>] [--duration <s>] "
+			"[--steps <n>] [--gesture tap|swipe|pinch|palm] "
+			"[--fingers <n>] [--stats] <description or recording>\n",
+			program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Creates a device from the description and writes frames to it\n"
+			"at a rate that ramps from --from to --to frames per second in\n"
+			"--steps steps over --duration seconds. If the file contains\n"
+			"events, its frames are replayed in a loop, otherwise synthetic\n"
+			"gestures are generated. --stats prints library statistics to\n"
+			"stderr at exit and on SIGUSR1.\n");
+}
+
+static int source_init(struct source *src, struct evemu_device *dev, FILE *fp,
+		       enum evemu_gesture gesture, int fingers)
+{
+	ssize_t n;
+
+	memset(src, 0, sizeof(*src));
+
+	n = evemu_read_events(fp, &src->events);
+	if (n < 0) {
+		fprintf(stderr, "error: could not read events\n");
+		return n;
+	}
+	src->nevents = n;
+	if (n > 0)
+		return 0;
+
+	/* the generator's timestamps are irrelevant, we write at our own rate */
+	src->gen = evemu_generator_new(dev, gesture, fingers, 1000, 32);
+	if (!src->gen && !evemu_has_event(dev, EV_REL, REL_X)) {
+		fprintf(stderr, "error: no synthetic pattern for this device, "
+				"please provide a recording\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Fill frame with the next frame, including its SYN_REPORT. Returns the
+ * number of events in the frame. */
+static int source_next_frame(struct source *src, struct input_event *frame)
+{
+	int n = 0;
+
+	if (src->gen)
+		return evemu_generator_next_frame(src->gen, frame, MAX_FRAME + 1);
+
+	if (src->nevents == 0) {
+		/* alternate the direction, so the kernel never filters
+		 * a frame as empty */
+		src->toggle = !src->toggle;
+		evemu_create_event(&frame[n++], EV_REL, REL_X, src->toggle ? 1 : -1);
+		evemu_create_event(&frame[n++], EV_SYN, SYN_REPORT, 0);
+		return n;
+	}
+
+	while (n < MAX_FRAME) {
+		const struct input_event *ev = &src->events[src->pos];
+
+		src->pos = (src->pos + 1) % src->nevents;
+		if (ev->type == EV_SYN && ev->code == SYN_MT_REPORT) {
+			frame[n++] = *ev;
+			continue;
+		}
+		if (ev->type == EV_SYN)
+			break;
+		frame[n++] = *ev;
+	}
+	evemu_create_event(&frame[n++], EV_SYN, SYN_REPORT, 0);
+
+	return n;
+}
+
+static struct step *find_step(struct load *load, long time)
+{
+	int i;
+
+	for (i = load->nsteps - 1; i > 0; i--)
+		if (load->steps[i].start && load->steps[i].start <= time)
+			break;
+	return &load->steps[i];
+}
+
+static void *reader(void *data)
+{
+	struct load *load = data;
+	struct pollfd pfd = { load->fd, POLLIN, 0 };
+	struct input_event evs[64];
+
+	while (1) {
+		long now;
+		int i, n, rc, done;
+
+		rc = poll(&pfd, 1, 100);
+
+		pthread_mutex_lock(&load->lock);
+		done = load->done;
+		pthread_mutex_unlock(&load->lock);
+
+		if (rc <= 0) {
+			if (done)
+				break;
+			continue;
+		}
+
+		SYSCALL(n = read(load->fd, evs, sizeof(evs)));
+		if (n <= 0)
+			continue;
+		now = now_usec();
+
+		pthread_mutex_lock(&load->lock);
+		for (i = 0; i < n / (int)sizeof(evs[0]); i++) {
+			const struct input_event *ev = &evs[i];
+			long stamp = ev->time.tv_sec * 1000000L + ev->time.tv_usec;
+			struct step *step;
+			long lag;
+
+			if (ev->type != EV_SYN)
+				continue;
+
+			step = find_step(load, stamp);
+			if (ev->code == SYN_DROPPED) {
+				step->dropped++;
+			} else if (ev->code == SYN_REPORT) {
+				lag = now - stamp;
+				if (step->received == 0 || lag < step->lag_min)
+					step->lag_min = lag;
+				if (lag > step->lag_max)
+					step->lag_max = lag;
+				step->lag_sum += lag;
+				step->received++;
+			}
+		}
+		pthread_mutex_unlock(&load->lock);
+	}
+
+	return NULL;
+}
+
+static int run_ramp(struct load *load, struct source *src, int wfd, long duration)
+{
+	struct input_event frame[MAX_FRAME + 1];
+	long step_usec = duration * 1000000L / load->nsteps;
+	int i;
+
+	for (i = 0; i < load->nsteps; i++) {
+		struct step *step = &load->steps[i];
+		long interval = step->rate < 1000000 ? 1000000L / step->rate : 1;
+		long start = now_usec(), next, sent = 0;
+
+		pthread_mutex_lock(&load->lock);
+		step->start = start;
+		pthread_mutex_unlock(&load->lock);
+
+		/* if we fall behind, we write back-to-back until we catch up */
+		for (next = start; next < start + step_usec; next += interval) {
+			int n = source_next_frame(src, frame);
+
+			if (n < 0) {
+				fprintf(stderr, "error: could not generate a frame: %s\n",
+					strerror(-n));
+				return -1;
+			}
+			sleep_until_usec(next);
+			if (evemu_play_frame(wfd, frame, n)) {
+				fprintf(stderr, "error: write failed: %s\n", strerror(errno));
+				return -1;
+			}
+			sent++;
+		}
+
+		pthread_mutex_lock(&load->lock);
+		step->sent = sent;
+		pthread_mutex_unlock(&load->lock);
+	}
+
+	return 0;
+}
+
+static void print_steps(const struct load *load)
+{
+	int i;
+
+	printf("# %8s %10s %10s %8s %10s %10s %10s\n",
+	       "rate(Hz)", "sent", "received", "dropped",
+	       "lag-min", "lag-avg", "lag-max");
+	for (i = 0; i < load->nsteps; i++) {
+		const struct step *s = &load->steps[i];
+
+		printf("  %8ld %10ld %10ld %8ld %10ld %10ld %10ld\n",
+		       s->rate, s->sent, s->received, s->dropped,
+		       s->lag_min,
+		       s->received ? s->lag_sum / s->received : 0,
+		       s->lag_max);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct evemu_device *dev = NULL;
+	struct source src;
+	struct load load;
+	pthread_t thread;
+	long from = 100, to = 20000, duration = 60, nsteps = 10, fingers = 2;
+	enum evemu_gesture gesture = EVEMU_GESTURE_SWIPE;
+	const char *device_node;
+	FILE *fp;
+	int wfd = -1, rc = -1;
+	int stats = 0;
+	int i;
+
+	while (1) {
+		int option_index = 0;
+		long *value;
+		char *endp;
+		int c;
+
+		c = getopt_long(argc, argv, "", opts, &option_index);
+		if (c == -1) /* we only do long options */
+			break;
+
+		switch (c) {
+			case 'f': value = &from; break;
+			case 't': value = &to; break;
+			case 'd': value = &duration; break;
+			case 's': value = &nsteps; break;
+			case 'n': value = &fingers; break;
+			case 'g':
+				for (i = 0; i < (int)(sizeof(gestures)/sizeof(gestures[0])); i++)
+					if (strcmp(optarg, gestures[i]) == 0)
+						break;
+				if (i == (int)(sizeof(gestures)/sizeof(gestures[0]))) {
+					fprintf(stderr, "error: invalid gesture '%s'\n", optarg);
+					return -1;
+				}
+				gesture = i;
+				continue;
+			case 'S':
+				stats = 1;
+				continue;
+			default:
+				usage();
+				return -1;
+		}
+
+		*value = strtol(optarg, &endp, 0);
+		if (*optarg == '\0' || *endp != '\0' || *value <= 0) {
+			fprintf(stderr, "error: invalid argument '%s'\n", optarg);
+			return -1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
+		return -1;
+	}
+
+	if (stats && counters_report(1))
+		fprintf(stderr, "error: could not set up statistics\n");
+
+	memset(&src, 0, sizeof(src));
+	memset(&load, 0, sizeof(load));
+	load.fd = -1;
+	load.nsteps = nsteps;
+	load.steps = calloc(nsteps, sizeof(*load.steps));
+	if (!load.steps)
+		return -1;
+	for (i = 0; i < nsteps; i++)
+		load.steps[i].rate = nsteps > 1 ?
+			from + (to - from) * i / (nsteps - 1) : from;
+	pthread_mutex_init(&load.lock, NULL);
+
+	fp = fopen(argv[optind], "r");
+	if (!fp) {
+		fprintf(stderr, "error: could not open file\n");
+		goto out;
+	}
+
+	dev = evemu_new(NULL);
+	if (!dev || evemu_read(dev, fp) <= 0) {
+		fprintf(stderr, "error: could not read device description\n");
+		goto out;
+	}
+	/* evemu_read() swallows the first event, read the events from the top */
+	if (fseek(fp, 0, SEEK_SET) < 0) {
+		fprintf(stderr, "error: recording must be a seekable file\n");
+		goto out;
+	}
+	if (source_init(&src, dev, fp, gesture, fingers))
+		goto out;
+
+	if (evemu_create_managed(dev) < 0) {
+		fprintf(stderr, "error: could not create device\n");
+		goto out;
+	}
+	device_node = evemu_get_devnode(dev);
+	if (!device_node) {
+		fprintf(stderr, "can not determine device node\n");
+		goto out;
+	}
+
+	wfd = open(device_node, O_WRONLY);
+	load.fd = open(device_node, O_RDONLY | O_NONBLOCK);
+	if (wfd < 0 || load.fd < 0) {
+		fprintf(stderr, "error %d opening %s: %s\n",
+			errno, device_node, strerror(errno));
+		goto out;
+	}
+	if (set_monotonic(load.fd) < 0) {
+		fprintf(stderr, "error: could not set %s to CLOCK_MONOTONIC: %s\n",
+			device_node, strerror(errno));
+		goto out;
+	}
+	printf("# %s: %s\n", evemu_get_name(dev), device_node);
+
+	if (pthread_create(&thread, NULL, reader, &load) != 0) {
+		fprintf(stderr, "error: could not start reader thread\n");
+		goto out;
+	}
+
+	rc = run_ramp(&load, &src, wfd, duration);
+
+	/* give the reader a moment to drain what is still queued */
+	usleep(200000);
+	pthread_mutex_lock(&load.lock);
+	load.done = 1;
+	pthread_mutex_unlock(&load.lock);
+	pthread_join(thread, NULL);
+
+	print_steps(&load);
+
+out:
+	if (wfd >= 0)
+		close(wfd);
+	if (load.fd >= 0)
+		close(load.fd);
+	if (dev)
+		evemu_delete(dev);
+	if (fp)
+		fclose(fp);
+	free(src.events);
+	evemu_generator_delete(src.gen);
+	free(load.steps);
+	pthread_mutex_destroy(&load.lock);
+	return rc;
+}
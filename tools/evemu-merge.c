@@ -0,0 +1,270 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+/*
+ * Merges evemu-record captures into the multi-device format read by
+ * ev-replay. Each input keeps one pending event; a binary heap ordered by
+ * timestamp picks the next one to write, so memory use depends on the
+ * number of inputs only.
+ */
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evemu-counters.h"
+#include "evemu-opt.h"
+
+/* ev-replay accepts a mouse plus MAX_DEVICES devices */
+#define MAX_INPUTS (MAX_DEVICES + 1)
+
+struct input {
+	int id;
+	const char *path;
+	FILE *fp;
+	char *line;
+	size_t size;
+	long offset;		/* usec added to every timestamp */
+	long time;		/* usec timestamp of ev, offset applied */
+	struct input_event ev;
+};
+
+static struct option opts[] = {
+	{ "offset", required_argument, 0, 'o'},
+	{ "stats", no_argument, 0, 'S'},
+	{ 0, 0, 0, 0 }
+};
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [--stats] [--offset <ms>]... <recording> [<recording>...]\n",
+		program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Merges up to %d evemu-record files into one ev-replay file.\n",
+		MAX_INPUTS);
+	fprintf(stderr, "The n-th --offset shifts the n-th recording by the given\n");
+	fprintf(stderr, "milliseconds, negative values move it earlier.\n");
+}
+
+static int is_event(const char *line)
+{
+	return strncmp(line, "E:", 2) == 0;
+}
+
+static int parse_event(struct input *in)
+{
+	unsigned long sec;
+	unsigned usec, type, code;
+	int value;
+
+	if (sscanf(in->line, "E: %lu.%06u %04x %04x %d",
+		   &sec, &usec, &type, &code, &value) != 5) {
+		fprintf(stderr, "error: %s: invalid event format: %s",
+			in->path, in->line);
+		return -1;
+	}
+
+	in->ev.type = type;
+	in->ev.code = code;
+	in->ev.value = value;
+	in->time = sec * 1000000 + usec + in->offset;
+	return 1;
+}
+
+/* Returns 1 if an event was read, 0 at the end of the file */
+static int next_event(struct input *in)
+{
+	while (getline(&in->line, &in->size, in->fp) != -1) {
+		if (is_event(in->line))
+			return parse_event(in);
+	}
+	return 0;
+}
+
+/*
+ * Copies the device description up to the first event, which is kept
+ * as the pending event of the input.
+ */
+static int copy_description(struct input *in, FILE *out)
+{
+	fprintf(out, "\n[Device Begin]\n");
+	fprintf(out, "id = %d\n", in->id);
+	fprintf(out, "type = unknown\n");
+	fprintf(out, "name = %s\n", in->path);
+
+	while (getline(&in->line, &in->size, in->fp) != -1) {
+		if (is_event(in->line)) {
+			fprintf(out, "\n[Device End]\n");
+			return parse_event(in);
+		}
+		fputs(in->line, out);
+	}
+
+	fprintf(out, "\n[Device End]\n");
+	return 0;
+}
+
+static int before(const struct input *a, const struct input *b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+	return a->id < b->id;
+}
+
+static void sift_down(struct input **heap, int count, int i)
+{
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, min = i;
+		struct input *tmp;
+
+		if (l < count && before(heap[l], heap[min]))
+			min = l;
+		if (r < count && before(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+static int merge(struct input *inputs, int count, FILE *out)
+{
+	struct input *heap[MAX_INPUTS];
+	long base = 0;
+	int i, n = 0, rc;
+
+	fprintf(out, "[Devices Begin]\n");
+	fprintf(out, "count = %d\n", count);
+	fprintf(out, "[Devices End]\n");
+
+	for (i = 0; i < count; i++) {
+		rc = copy_description(&inputs[i], out);
+		if (rc < 0)
+			return rc;
+		if (rc > 0)
+			heap[n++] = &inputs[i];
+		if (inputs[i].offset < base)
+			base = inputs[i].offset;
+	}
+
+	for (i = n / 2 - 1; i >= 0; i--)
+		sift_down(heap, n, i);
+
+	fprintf(out, "[Events]\n");
+
+	/* negative offsets shift the whole output so it starts at zero */
+	while (n > 0) {
+		struct input *in = heap[0];
+		long time = in->time - base;
+
+		in->ev.time.tv_sec = time / 1000000;
+		in->ev.time.tv_usec = time % 1000000;
+		evemu_write_event_with_id(out, &in->ev, in->id);
+
+		rc = next_event(in);
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			heap[0] = heap[--n];
+		sift_down(heap, n, 0);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct input inputs[MAX_INPUTS];
+	long offsets[MAX_INPUTS] = { 0 };
+	int noffsets = 0;
+	int count = 0;
+	int ret = -1;
+	int i;
+
+	while (1) {
+		int option_index = 0;
+		char *end;
+		int c;
+
+		c = getopt_long(argc, argv, "", opts, &option_index);
+		if (c == -1) /* we only do long options */
+			break;
+
+		switch (c) {
+			case 'o':
+				if (noffsets == MAX_INPUTS) {
+					usage();
+					return -1;
+				}
+				offsets[noffsets++] = (long)(strtod(optarg, &end) * 1000);
+				if (*end != '\0') {
+					usage();
+					return -1;
+				}
+				break;
+			case 'S':
+				if (counters_report(0))
+					fprintf(stderr, "error: could not set up statistics\n");
+				break;
+			default:
+				usage();
+				return -1;
+		}
+	}
+
+	count = argc - optind;
+	if (count < 1 || count > MAX_INPUTS || noffsets > count) {
+		usage();
+		return -1;
+	}
+
+	memset(inputs, 0, sizeof(inputs));
+	for (i = 0; i < count; i++) {
+		struct input *in = &inputs[i];
+
+		in->id = i;
+		in->path = argv[optind + i];
+		in->offset = offsets[i];
+		in->fp = fopen(in->path, "r");
+		if (!in->fp) {
+			fprintf(stderr, "error: could not open file %s (%m)\n",
+				in->path);
+			goto out;
+		}
+	}
+
+	ret = merge(inputs, count, stdout);
+
+out:
+	for (i = 0; i < count; i++) {
+		if (inputs[i].fp)
+			fclose(inputs[i].fp);
+		free(inputs[i].line);
+	}
+
+	return ret;
+}
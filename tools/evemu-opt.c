@@ -1,9 +1,11 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <getopt.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include "evemu-opt.h"
+#include "evemu-rt.h"
 #include "find_event_devices.h"
 
 struct option static evemu_options[] = {
@@ -13,6 +15,17 @@ struct option static evemu_options[] = {
   {"device",   required_argument, 0, 0},
   {"list",   required_argument, 0, 0},
   {"help",   required_argument, 0, 0},
+  {"output",   required_argument, 0, 0},
+  {"rotate-size", required_argument, 0, 0},
+  {"rotate-time", required_argument, 0, 0},
+  {"rt-priority", required_argument, 0, 0},
+  {"mlock",    no_argument,       0, 0},
+  {"cpus",     required_argument, 0, 0},
+  {"latency",  no_argument,       0, 0},
+  {"stats",    no_argument,       0, 0},
+  {"drop-unsupported", no_argument, 0, 0},
+  {"only",     required_argument, 0, 0},
+  {"drop",     required_argument, 0, 0},
   {0,          0,                 0, 0}
 };
 
@@ -43,6 +56,45 @@ void evemu_print_options() {
     "-h",
     "--help",
     "  Print this help.",
+    "-o",
+    "--output",
+    "  Record into rotating segments <output>-NNNN.event listed in",
+    "  <output>.manifest instead of writing to stdout. This and the",
+    "  options of the input devices and the events to record are only",
+    "  supported by ev-record.",
+    "-s",
+    "--rotate-size",
+    "  Start a new segment every given MB, requires --output.",
+    "-t",
+    "--rotate-time",
+    "  Start a new segment every given minutes, requires --output.",
+    "-P",
+    "--rt-priority",
+    "  Run the event loop under SCHED_FIFO with the given priority.",
+    "-M",
+    "--mlock",
+    "  Lock and prefault all memory.",
+    "-C",
+    "--cpus",
+    "  Pin to a CPU list, for example, 2,4-5",
+    "-L",
+    "--latency",
+    "  Report how late ev-replay woke up for each event. Not supported",
+    "  by ev-record.",
+    "-S",
+    "--stats",
+    "  Print library statistics at exit and on SIGUSR1.",
+    "-D",
+    "--drop-unsupported",
+    "  Do not replay events the created device does not support. Only",
+    "  supported by ev-replay.",
+    "-I",
+    "--only",
+    "  Record only the given events, <type>[:<code>] such as EV_KEY or",
+    "  EV_ABS:ABS_MT_POSITION_X. Can be repeated.",
+    "-X",
+    "--drop",
+    "  Do not record the given events, <type>[:<code>]. Can be repeated.",
     ""
   };
 
@@ -62,7 +114,18 @@ enum EvemuOptionType {
   MouseY,
   Device,
   List,
-  Help
+  Help,
+  Output,
+  RotateSize,
+  RotateTime,
+  RtPriority,
+  Mlock,
+  Cpus,
+  Latency,
+  Stats,
+  DropUnsupported,
+  Only,
+  Drop
 };
 
 static int evemu_option_type(int index, enum EvemuOptionType* opt_type)
@@ -92,9 +155,55 @@ static int evemu_option_type(int index, enum EvemuOptionType* opt_type)
   case 'h':
     *opt_type = Help;
     break;
+  case 6:
+  case 'o':
+    *opt_type = Output;
+    break;
+  case 7:
+  case 's':
+    *opt_type = RotateSize;
+    break;
+  case 8:
+  case 't':
+    *opt_type = RotateTime;
+    break;
+  case 9:
+  case 'P':
+    *opt_type = RtPriority;
+    break;
+  case 10:
+  case 'M':
+    *opt_type = Mlock;
+    break;
+  case 11:
+  case 'C':
+    *opt_type = Cpus;
+    break;
+  case 12:
+  case 'L':
+    *opt_type = Latency;
+    break;
+  case 13:
+  case 'S':
+    *opt_type = Stats;
+    break;
+  case 14:
+  case 'D':
+    *opt_type = DropUnsupported;
+    break;
+  case 15:
+  case 'I':
+    *opt_type = Only;
+    break;
+  case 16:
+  case 'X':
+    *opt_type = Drop;
+    break;
   default:
     return 0;
   }
+
+  return 1;
 }
 
 static int evemu_update_options(int index, char* arg, struct EvemuOptions* opts)
@@ -144,6 +253,48 @@ static int evemu_update_options(int index, char* arg, struct EvemuOptions* opts)
   case Help:
     evemu_print_options();
     return 0;
+  case Output:
+    opts->output = arg;
+    break;
+  case RotateSize:
+    opts->rotate_size = atoi(arg);
+    break;
+  case RotateTime:
+    opts->rotate_time = atoi(arg);
+    break;
+  case RtPriority:
+    if (rt_parse_priority(arg, &opts->rt_priority)) {
+      fprintf(stderr, "Invalid --rt-priority %s, must be %d to %d.\n", arg,
+              sched_get_priority_min(SCHED_FIFO),
+              sched_get_priority_max(SCHED_FIFO));
+      return 0;
+    }
+    break;
+  case Mlock:
+    opts->mlock = 1;
+    break;
+  case Cpus:
+    opts->cpus = arg;
+    break;
+  case Latency:
+    opts->latency = 1;
+    break;
+  case Stats:
+    opts->stats = 1;
+    break;
+  case DropUnsupported:
+    opts->drop_unsupported = 1;
+    break;
+  case Only:
+  case Drop:
+    if (opts->filter_count == MAX_FILTERS) {
+      fprintf(stderr, "You can not specify more than %d --only and --drop.\n", MAX_FILTERS);
+      return 0;
+    }
+    opts->filters[opts->filter_count].event = arg;
+    opts->filters[opts->filter_count].accept = opt_type == Only;
+    opts->filter_count++;
+    break;
   default:
     return 0;
   }
@@ -168,7 +319,7 @@ int evemu_parse_options(int argc, char* argv[], struct EvemuOptions* opts)
   int c = 0;
   do {
     int option_index = 0;
-    c = getopt_long(argc, argv, "m:d:x:y:lh", evemu_options, &option_index);
+    c = getopt_long(argc, argv, "m:d:x:y:lho:s:t:P:MC:LSDI:X:", evemu_options, &option_index);
 
     switch(c) {
     case 0:
@@ -181,6 +332,17 @@ int evemu_parse_options(int argc, char* argv[], struct EvemuOptions* opts)
     case 'y':
     case 'l':
     case 'h':
+    case 'o':
+    case 's':
+    case 't':
+    case 'P':
+    case 'M':
+    case 'C':
+    case 'L':
+    case 'S':
+    case 'D':
+    case 'I':
+    case 'X':
       if (!evemu_update_options(c, optarg, opts))
         return 0;
       break;
@@ -196,6 +358,11 @@ int evemu_parse_options(int argc, char* argv[], struct EvemuOptions* opts)
     evemu_print_options();
     return 0;
   } 
+
+  if ((opts->rotate_size || opts->rotate_time) && opts->output == NULL) {
+    fprintf(stderr, "--rotate-size and --rotate-time need --output.\n");
+    return 0;
+  }
   
   return 1;
 }
@@ -218,4 +385,9 @@ void evemu_dump_options(struct EvemuOptions* opts) {
     if (opts->devices[i] != NULL)
       printf("Device %d is %s\n", i, opts->devices[i]);
   }
+
+  if (opts->output) {
+    printf("Output is %s, rotating every %d MB / %d minutes\n",
+           opts->output, opts->rotate_size, opts->rotate_time);
+  }
 }
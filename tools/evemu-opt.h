@@ -2,6 +2,13 @@
 #define __EVEMU_OPT_H__
 
 #define MAX_DEVICES 10
+#define MAX_FILTERS 32
+
+// --only and --drop, in the order given
+struct EvemuFilterOption {
+  char* event;
+  int   accept;
+};
 
 struct EvemuOptions {
   char* mouse;
@@ -9,6 +16,17 @@ struct EvemuOptions {
   int   mouseY;
   int   device_count;
   char* devices[MAX_DEVICES]; 
+  char* output;
+  int   rotate_size;
+  int   rotate_time;
+  int   rt_priority;
+  int   mlock;
+  char* cpus;
+  int   latency;
+  int   stats;
+  int   drop_unsupported;
+  int   filter_count;
+  struct EvemuFilterOption filters[MAX_FILTERS];
 };
 
 /**
@@ -39,29 +39,257 @@
  *
  ****************************************************************************/
 
+#define _GNU_SOURCE
 #include "evemu.h"
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "evemu-counters.h"
+#include "evemu-rt.h"
+
+static struct option opts[] = {
+	{ "fanout", required_argument, 0, 'f'},
+	{ "offset", required_argument, 0, 'o'},
+	{ "rt-priority", required_argument, 0, 'p'},
+	{ "mlock", no_argument, 0, 'm'},
+	{ "cpus", required_argument, 0, 'c'},
+	{ "latency", no_argument, 0, 'l'},
+	{ "stats", no_argument, 0, 'S'},
+	{ "drop-unsupported", no_argument, 0, 'd'},
+	{ 0, 0, 0, 0 }
+};
+
+static struct rt_options rt;
+static struct histogram latency;
+static int drop_unsupported;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s <device>\n", program_invocation_short_name);
+	fprintf(stderr, "       %s --fanout <count> [--offset <ms>] <recording>\n",
+		program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Event data is read from standard input. With --drop-unsupported,\n"
+			"events the device does not support are not written.\n");
+	fprintf(stderr, "With --fanout, <count> devices are created from the description\n"
+			"in the recording and its events are replayed to all of them. Device\n"
+			"n is delayed by n * <ms> milliseconds.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Scheduling options, with any of them events are written\n"
+			"against absolute deadlines from the first event:\n"
+			"  --rt-priority <n>  replay under SCHED_FIFO with priority n\n"
+			"  --mlock            lock and prefault all memory\n"
+			"  --cpus <list>      pin to the CPU list, e.g. 2,4-5\n"
+			"  --latency          report how late the replay woke up\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  --stats            print library statistics at exit and on SIGUSR1\n");
+}
+
+static void count_wakeup(long late_ns, void *data)
+{
+	histogram_add(data, late_ns);
+}
+
+/*
+ * Reads the description and leaves fp at the start of the file again:
+ * evemu_read() swallows the first event line, and evemu_read_event()
+ * skips the description lines anyway.
+ */
+static int read_recording(struct evemu_device *dev, FILE *fp)
+{
+	if (evemu_read(dev, fp) <= 0) {
+		fprintf(stderr, "error: could not read device description\n");
+		return -1;
+	}
+	if (fseek(fp, 0, SEEK_SET) < 0) {
+		fprintf(stderr, "error: recording must be a seekable file\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int play_fanout(const char *path, int count, long offset_ms)
+{
+	struct evemu_device *dev = NULL;
+	struct evemu_device **clones;
+	int *fds;
+	long *offsets;
+	FILE *fp;
+	int i, ret = -1;
+
+	clones = calloc(count, sizeof(*clones));
+	fds = calloc(count, sizeof(*fds));
+	offsets = calloc(count, sizeof(*offsets));
+	if (!clones || !fds || !offsets)
+		goto out;
+	for (i = 0; i < count; i++)
+		fds[i] = -1;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "error: could not open file\n");
+		goto out;
+	}
+
+	dev = evemu_new(NULL);
+	if (!dev || read_recording(dev, fp) < 0)
+		goto out_close;
+
+	if (strlen(evemu_get_name(dev)) == 0) {
+		char name[64];
+		sprintf(name, "evemu-%d", getpid());
+		evemu_set_name(dev, name);
+	}
+
+	for (i = 0; i < count; i++) {
+		const char *device_node;
+
+		clones[i] = evemu_clone(dev);
+		if (!clones[i] || evemu_create_managed(clones[i]) < 0) {
+			fprintf(stderr, "error: could not create device %d\n", i);
+			goto out_destroy;
+		}
+
+		device_node = evemu_get_devnode(clones[i]);
+		if (!device_node) {
+			fprintf(stderr, "can not determine device node\n");
+			goto out_destroy;
+		}
+
+		fds[i] = open(device_node, O_WRONLY);
+		if (fds[i] < 0) {
+			fprintf(stderr, "error %d opening %s: %s\n",
+				errno, device_node, strerror(errno));
+			goto out_destroy;
+		}
+		offsets[i] = i * offset_ms * 1000;
+
+		fprintf(stdout, "%s: %s\n", evemu_get_name(clones[i]), device_node);
+	}
+	fflush(stdout);
+
+	if (rt_apply(&rt))
+		goto out_destroy;
+
+	ret = evemu_play_fanout(fp, fds, offsets, count);
+	if (ret)
+		fprintf(stderr, "error: could not replay events\n");
+
+out_destroy:
+	for (i = 0; i < count; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+		if (clones[i])
+			evemu_delete(clones[i]);
+	}
+out_close:
+	if (dev)
+		evemu_delete(dev);
+	fclose(fp);
+out:
+	free(offsets);
+	free(fds);
+	free(clones);
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int fd;
-	if (argc != 2) {
-		fprintf(stderr, "Usage: %s <device>\n", argv[0]);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Event data is read from standard input.\n");
+	long count = 0, offset = 0;
+	int stats = 0;
+	char *endp;
+
+	while (1) {
+		int option_index = 0;
+		int c;
+
+		c = getopt_long(argc, argv, "", opts, &option_index);
+		if (c == -1) /* we only do long options */
+			break;
+
+		switch (c) {
+			case 'f': /* fanout */
+				count = strtol(optarg, &endp, 0);
+				if (*endp != '\0' || count < 1) {
+					fprintf(stderr, "error: invalid fanout count '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'o': /* offset */
+				offset = strtol(optarg, &endp, 0);
+				if (*endp != '\0' || offset < 0) {
+					fprintf(stderr, "error: invalid offset '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'p':
+				if (rt_parse_priority(optarg, &rt.priority)) {
+					fprintf(stderr, "error: invalid priority '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'm':
+				rt.lock_memory = 1;
+				break;
+			case 'c':
+				rt.cpus = optarg;
+				break;
+			case 'l':
+				rt.latency = 1;
+				break;
+			case 'S':
+				stats = 1;
+				break;
+			case 'd':
+				drop_unsupported = 1;
+				break;
+			default:
+				usage();
+				return -1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage();
 		return -1;
 	}
-	fd = open(argv[1], O_WRONLY);
+
+	if (stats && counters_report(1))
+		fprintf(stderr, "error: could not set up statistics\n");
+
+	if (count > 0)
+		return play_fanout(argv[optind], count, offset) ? -1 : 0;
+
+	fd = open(argv[optind], O_WRONLY);
 	if (fd < 0) {
 		fprintf(stderr, "error: could not open device\n");
 		return -1;
 	}
-	if (evemu_play(stdin, fd)) {
+	if (rt_apply(&rt)) {
+		close(fd);
+		return -1;
+	}
+
+	/* scheduling options change when events are written, not which */
+	if (rt.priority || rt.lock_memory || rt.cpus || rt.latency) {
+		if (evemu_play_timed(stdin, fd, NULL, drop_unsupported,
+				     rt.latency ? count_wakeup : NULL, &latency))
+			fprintf(stderr, "error: could not replay events\n");
+	} else if (drop_unsupported) {
+		if (evemu_play_filtered(stdin, fd, NULL))
+			fprintf(stderr, "error: could not replay events\n");
+	} else if (evemu_play(stdin, fd)) {
 		fprintf(stderr, "error: could not describe device\n");
 	}
 	close(fd);
+
+	if (rt.latency)
+		rt_latency_report("replay wakeup", &latency);
 	return 0;
 }
@@ -41,6 +41,9 @@
 
 #define _GNU_SOURCE
 #include "evemu.h"
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -49,6 +52,11 @@
 #include <signal.h>
 #include <time.h>
 
+#include "evemu-counters.h"
+#include "evemu-filter-opt.h"
+#include "evemu-flight.h"
+#include "evemu-rotate.h"
+#include "evemu-rt.h"
 #include "find_event_devices.h"
 
 #define INFINITE -1
@@ -87,6 +95,169 @@ enum mode {
 	EVEMU_DESCRIBE
 };
 
+static struct option opts[] = {
+	{ "flight", required_argument, 0, 'f'},
+	{ "rate", required_argument, 0, 'r'},
+	{ "fifo", required_argument, 0, 'F'},
+	{ "prefix", required_argument, 0, 'p'},
+	{ "rotate-size", required_argument, 0, 's'},
+	{ "rotate-time", required_argument, 0, 't'},
+	{ "rt-priority", required_argument, 0, 'P'},
+	{ "mlock", no_argument, 0, 'm'},
+	{ "cpus", required_argument, 0, 'c'},
+	{ "latency", no_argument, 0, 'l'},
+	{ "stats", no_argument, 0, 'S'},
+	{ "drop", required_argument, 0, 'd'},
+	{ "only", required_argument, 0, 'o'},
+	{ 0, 0, 0, 0 }
+};
+
+static struct rt_options rt;
+static struct histogram latency;
+static struct evemu_filter *filter;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s <device> [output file]\n", program_invocation_short_name);
+	fprintf(stderr, "       %s [--rotate-size <MB>] [--rotate-time <minutes>] <device> <prefix>\n",
+		program_invocation_short_name);
+	fprintf(stderr, "       %s --flight <seconds> [--rate <events/s>] [--fifo <path>]\n"
+			"              [--prefix <path>] <device> [<device>...]\n",
+		program_invocation_short_name);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Scheduling options:\n"
+			"  --rt-priority <n>  read under SCHED_FIFO with priority n\n"
+			"  --mlock            lock and prefault all memory\n"
+			"  --cpus <list>      pin to the CPU list, e.g. 2,4-5\n"
+			"  --latency          report the delay between an event and its read\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  --stats            print library statistics at exit, and on SIGUSR1\n"
+			"                     unless in flight mode\n");
+	fprintf(stderr, "  --only <type>[:<code>]\n"
+			"                     record only these events, may be repeated\n"
+			"  --drop <type>[:<code>]\n"
+			"                     do not record these events, may be repeated\n");
+}
+
+/* evemu_record(), plus the time from each kernel timestamp to the read */
+static int record_measured(FILE *fp, int fd)
+{
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	struct input_event batch[64];
+	long offset = -1;
+	int i, n;
+
+	if (filter)
+		evemu_filter_apply(filter, fd);
+
+	while (poll(&pfd, 1, INFINITE) > 0) {
+		struct timespec stamp;
+
+		n = evemu_read_batch(fd, batch, sizeof(batch) / sizeof(batch[0]),
+				     filter);
+		/* zero if the filter took them all */
+		if (n == 0 || n == -EAGAIN || n == -EINTR)
+			continue;
+		if (n < 0)
+			return n;
+
+		/* the oldest event of the batch waited longest */
+		stamp.tv_sec = batch[0].time.tv_sec;
+		stamp.tv_nsec = batch[0].time.tv_usec * 1000;
+		rt_latency_since(&stamp, &latency);
+
+		for (i = 0; i < n; i++) {
+			struct input_event *ev = &batch[i];
+			long time = ev->time.tv_sec * 1000000L + ev->time.tv_usec;
+
+			if (offset < 0)
+				offset = time;
+			time -= offset;
+			ev->time.tv_sec = time / 1000000;
+			ev->time.tv_usec = time % 1000000;
+			evemu_write_event(fp, ev);
+		}
+		fflush(fp);
+	}
+
+	return 0;
+}
+
+static int flight_mode(int argc, char *argv[], struct flight_config *config)
+{
+	char *device = NULL;
+	int ret;
+
+	if (optind < argc)
+		return flight_record(argv + optind, argc - optind, config);
+
+	device = find_event_devices(true);
+	if (!device) {
+		usage();
+		return -1;
+	}
+	ret = flight_record(&device, 1, config);
+	free(device);
+	return ret;
+}
+
+static int write_segment_header(FILE *fp, void *data)
+{
+	if (evemu_write(data, fp) < 0)
+		return -1;
+	fprintf(fp,  "################################\n");
+	fprintf(fp,  "#      Waiting for events      #\n");
+	fprintf(fp,  "################################\n");
+	return 0;
+}
+
+/* common to all ways of recording events from a device */
+static int prepare_record(int fd)
+{
+	int ret = -1;
+#ifdef EVIOCSCLOCKID
+	int clockid = CLOCK_MONOTONIC;
+
+	ret = ioctl(fd, EVIOCSCLOCKID, &clockid);
+#else
+	errno = ENOTTY;
+#endif
+	/* the latency is measured on CLOCK_MONOTONIC */
+	if (ret < 0 && rt.latency) {
+		fprintf(stderr, "error: could not set the device to CLOCK_MONOTONIC: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	if (ioctl(fd, EVIOCGRAB, (void*)1) < 0) {
+		fprintf(stderr, "error: this device is grabbed and I cannot record events\n");
+		fprintf(stderr, "see the evemu-record man page for more information\n");
+		return -1;
+	} else
+		ioctl(fd, EVIOCGRAB, (void*)0);
+
+	return 0;
+}
+
+static int record_rotating(int fd, struct rotation *rotate)
+{
+	struct evemu_device *dev;
+	int ret;
+
+	dev = evemu_new(NULL);
+	if (!dev)
+		return -ENOMEM;
+	ret = evemu_extract(dev, fd);
+	if (ret)
+		goto out;
+
+	rotate->write_header = write_segment_header;
+	rotate->data = dev;
+	ret = rotation_record(rotate, &fd, 1);
+out:
+	evemu_delete(dev);
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	enum mode mode = EVEMU_RECORD;
@@ -94,16 +265,106 @@ int main(int argc, char *argv[])
 	struct sigaction act;
 	char *prgm_name = program_invocation_short_name;
 	char *device;
+	struct flight_config flight = {
+		.seconds = 0,
+		.rate = 2000,
+		.fifo = NULL,
+		.prefix = "evemu-flight",
+	};
+	struct rotation rotate;
+	int stats = 0;
+	int ret = 0;
+
+	memset(&rotate, 0, sizeof(rotate));
 
 	if (prgm_name && (strcmp(prgm_name, "evemu-describe") == 0 ||
 			/* when run directly from the sources (not installed) */
 			strcmp(prgm_name, "lt-evemu-describe") == 0))
 		mode = EVEMU_DESCRIBE;
 
+	while (mode == EVEMU_RECORD) {
+		int option_index = 0;
+		int c;
+
+		c = getopt_long(argc, argv, "", opts, &option_index);
+		if (c == -1) /* we only do long options */
+			break;
+
+		switch (c) {
+			case 'f':
+				flight.seconds = atoi(optarg);
+				break;
+			case 'r':
+				flight.rate = atoi(optarg);
+				break;
+			case 'F':
+				flight.fifo = optarg;
+				break;
+			case 'p':
+				flight.prefix = optarg;
+				break;
+			case 's':
+				rotate.max_bytes = atol(optarg) * 1024 * 1024;
+				break;
+			case 't':
+				rotate.max_usec = atol(optarg) * 60 * 1000000L;
+				break;
+			case 'P':
+				if (rt_parse_priority(optarg, &rt.priority)) {
+					fprintf(stderr, "error: invalid priority '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			case 'm':
+				rt.lock_memory = 1;
+				break;
+			case 'c':
+				rt.cpus = optarg;
+				break;
+			case 'l':
+				rt.latency = 1;
+				break;
+			case 'S':
+				stats = 1;
+				break;
+			case 'd':
+			case 'o':
+				if (filter_option(&filter, optarg, c == 'o') < 0) {
+					fprintf(stderr, "error: invalid event '%s'\n", optarg);
+					return -1;
+				}
+				break;
+			default:
+				usage();
+				return -1;
+		}
+	}
+
+	if (rt_apply(&rt))
+		return -1;
+
+	/* in flight mode SIGUSR1 means dump */
+	if (stats && counters_report(flight.seconds == 0))
+		fprintf(stderr, "error: could not set up statistics\n");
+
+	flight.filter = filter;
+	rotate.filter = filter;
+
+	if (flight.seconds > 0) {
+		if (flight_mode(argc, argv, &flight)) {
+			fprintf(stderr, "error: flight recording failed\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	argc -= optind - 1;
+	argv += optind - 1;
+
 	device = (argc < 2) ? find_event_devices(true) : strdup(argv[1]);
 
 	if (device == NULL) {
-		fprintf(stderr, "Usage: %s <device> [output file]\n", argv[0]);
+		usage();
 		return -1;
 	}
 	fd = open(device, O_RDONLY | O_NONBLOCK);
@@ -124,6 +385,23 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	output = stdout;
+	if (mode == EVEMU_RECORD && prepare_record(fd)) {
+		ret = -1;
+		goto out;
+	}
+
+	if (rotate.max_bytes > 0 || rotate.max_usec > 0) {
+		if (argc < 3) {
+			usage();
+			goto out;
+		}
+		rotate.prefix = argv[2];
+		if (record_rotating(fd, &rotate))
+			fprintf(stderr, "error: could not record to %s\n", argv[2]);
+		goto out;
+	}
+
 	if (argc < 3)
 		output = stdout;
 	else {
@@ -139,30 +417,24 @@ int main(int argc, char *argv[])
 	}
 
 	if (mode == EVEMU_RECORD) {
-#ifdef EVIOCSCLOCKID
-		int clockid = CLOCK_MONOTONIC;
-		ioctl(fd, EVIOCSCLOCKID, &clockid);
-#endif
-		if (ioctl(fd, EVIOCGRAB, (void*)1) < 0) {
-			fprintf(stderr, "error: this device is grabbed and I cannot record events\n");
-			fprintf(stderr, "see the evemu-record man page for more information\n");
-			return -1;
-		} else
-			ioctl(fd, EVIOCGRAB, (void*)0);
-
 		fprintf(output,  "################################\n");
 		fprintf(output,  "#      Waiting for events      #\n");
 		fprintf(output,  "################################\n");
-		if (evemu_record(output, fd, INFINITE))
+		if (rt.latency) {
+			if (record_measured(output, fd))
+				fprintf(stderr, "error: could not record events\n");
+			rt_latency_report("record drain", &latency);
+		} else if (evemu_record_filtered(output, fd, INFINITE, filter))
 			fprintf(stderr, "error: could not describe device\n");
 	}
 
 out:
+	evemu_filter_delete(filter);
 	free(device);
 	close(fd);
 	if (output != stdout) {
 		fclose(output);
 		output = stdout;
 	}
-	return 0;
+	return ret;
 }
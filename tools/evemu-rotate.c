@@ -0,0 +1,185 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include "evemu.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evemu-rotate.h"
+
+#define READ_BATCH 64
+
+static const char *basename_of(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
+
+static int segment_open(struct rotation *r)
+{
+	long pos;
+
+	snprintf(r->path, sizeof(r->path), "%s-%04d.event", r->prefix, r->segment);
+	r->fp = fopen(r->path, "w");
+	if (!r->fp) {
+		fprintf(stderr, "error: could not open %s\n", r->path);
+		return -errno;
+	}
+
+	/* a segment without its header is no segment, nor in the manifest */
+	if (r->write_header(r->fp, r->data) < 0) {
+		fprintf(stderr, "error: could not write %s\n", r->path);
+		fclose(r->fp);
+		r->fp = NULL;
+		unlink(r->path);
+		return -EIO;
+	}
+
+	pos = ftell(r->fp);
+	r->bytes = pos < 0 ? 0 : pos;
+	r->events = 0;
+	return 0;
+}
+
+static int segment_close(struct rotation *r)
+{
+	int ret = 0;
+
+	if (!r->fp)
+		return 0;
+
+	if (fclose(r->fp))
+		ret = -errno;
+	r->fp = NULL;
+
+	fprintf(r->manifest, "%s %ld.%06ld %ld.%06ld %ld %ld\n",
+		basename_of(r->path),
+		r->first / 1000000, r->first % 1000000,
+		r->last / 1000000, r->last % 1000000,
+		r->events, r->bytes);
+	fflush(r->manifest);
+
+	r->segment++;
+	return ret;
+}
+
+static int segment_full(const struct rotation *r)
+{
+	return (r->max_bytes > 0 && r->bytes >= r->max_bytes) ||
+	       (r->max_usec > 0 && r->last - r->first >= r->max_usec);
+}
+
+int rotation_record(struct rotation *r, int *fds, int count)
+{
+	struct pollfd *pfds;
+	struct input_event batch[READ_BATCH];
+	unsigned long open_frames = 0;	/* one bit per device inside a frame */
+	char path[PATH_MAX];
+	long offset = -1;
+	int ret = 0;
+	int i, j;
+
+	if (count < 1 || count > (int)(8 * sizeof(open_frames)))
+		return -EINVAL;
+
+	snprintf(path, sizeof(path), "%s.manifest", r->prefix);
+	r->manifest = fopen(path, "w");
+	if (!r->manifest) {
+		fprintf(stderr, "error: could not open %s\n", path);
+		return -errno;
+	}
+	fprintf(r->manifest, "# segment first last events bytes\n");
+	fflush(r->manifest);
+
+	pfds = calloc(count, sizeof(*pfds));
+	if (!pfds) {
+		fclose(r->manifest);
+		return -ENOMEM;
+	}
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		if (r->filter)
+			evemu_filter_apply(r->filter, fds[i]);
+	}
+
+	while (ret == 0 && poll(pfds, count, -1) > 0) {
+		for (i = 0; i < count && ret == 0; i++) {
+			int n;
+
+			if (!(pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+				continue;
+
+			n = evemu_read_batch(fds[i], batch, READ_BATCH, r->filter);
+			if (n == -EAGAIN || n == -EINTR)
+				continue;
+			if (n < 0) {
+				ret = n;
+				break;
+			}
+
+			for (j = 0; j < n; j++) {
+				struct input_event *ev = &batch[j];
+				long time = ev->time.tv_sec * 1000000L + ev->time.tv_usec;
+
+				if (offset < 0)
+					offset = time;
+				time -= offset;
+				ev->time.tv_sec = time / 1000000;
+				ev->time.tv_usec = time % 1000000;
+
+				if (!r->fp && (ret = segment_open(r)) < 0)
+					break;
+
+				/* devices are read in turns, keep the full range */
+				if (r->events++ == 0 || time < r->first)
+					r->first = time;
+				if (r->events == 1 || time > r->last)
+					r->last = time;
+				if (r->with_id)
+					r->bytes += evemu_write_event_with_id(r->fp, ev, i);
+				else
+					r->bytes += evemu_write_event(r->fp, ev);
+
+				if (ev->type == EV_SYN && ev->code == SYN_REPORT)
+					open_frames &= ~(1UL << i);
+				else
+					open_frames |= 1UL << i;
+
+				if (!open_frames && segment_full(r))
+					ret = segment_close(r);
+			}
+		}
+
+		if (r->fp)
+			fflush(r->fp);
+	}
+
+	i = segment_close(r);
+	if (ret == 0)
+		ret = i;
+	fclose(r->manifest);
+	free(pfds);
+	return ret;
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_ROTATE_H
+#define EVEMU_ROTATE_H
+
+#include <limits.h>
+#include <stdio.h>
+
+struct evemu_filter;
+
+struct rotation {
+	const char *prefix;	/* segments are <prefix>-NNNN.event */
+	long max_bytes;		/* 0 for no size limit */
+	long max_usec;		/* 0 for no time limit */
+	int with_id;		/* write "E: <id> ..." events as ev-record does */
+	const struct evemu_filter *filter;	/* events to keep, NULL for all */
+
+	/* writes the device sections that start every segment */
+	int (*write_header)(FILE *fp, void *data);
+	void *data;
+
+	/* state of the open segment */
+	FILE *fp;
+	FILE *manifest;
+	int segment;
+	long bytes;
+	long events;
+	long first, last;	/* usec, relative to the first recorded event */
+	char path[PATH_MAX];
+};
+
+/**
+ * rotation_record() - record events into rotating segments
+ * @r: rotation settings, the state fields must be zeroed
+ * @fds: devices to read from
+ * @count: number of devices
+ *
+ * Works like evemu_record_all(), but starts a new self-contained segment
+ * whenever the open one reaches r->max_bytes or spans r->max_usec. A
+ * segment only ends where no device is inside a frame. Each closed segment
+ * is appended to <prefix>.manifest with its time range, event count and
+ * size. Recording stops when poll() is interrupted by a signal.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int rotation_record(struct rotation *r, int *fds, int count);
+
+#endif
@@ -0,0 +1,170 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "evemu-rt.h"
+
+/* stack the hot loops may touch, faulted in while locking memory */
+#define PREFAULT_STACK (256 * 1024)
+
+static int parse_cpus(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+
+	CPU_ZERO(set);
+	while (*p) {
+		char *end;
+		long first, last;
+
+		first = strtol(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return -EINVAL;
+	}
+
+	return CPU_COUNT(set) ? 0 : -EINVAL;
+}
+
+static void prefault_stack(void)
+{
+	volatile char stack[PREFAULT_STACK];
+
+	memset((char *)stack, 0, sizeof(stack));
+}
+
+int rt_parse_priority(const char *arg, int *priority)
+{
+	char *end;
+	long prio;
+
+	errno = 0;
+	prio = strtol(arg, &end, 10);
+	if (errno || end == arg || *end ||
+	    prio < sched_get_priority_min(SCHED_FIFO) ||
+	    prio > sched_get_priority_max(SCHED_FIFO))
+		return -EINVAL;
+
+	*priority = prio;
+	return 0;
+}
+
+int rt_apply(const struct rt_options *rt)
+{
+	if (rt->cpus) {
+		cpu_set_t set;
+
+		if (parse_cpus(rt->cpus, &set) < 0) {
+			fprintf(stderr, "error: invalid CPU list '%s'\n", rt->cpus);
+			return -EINVAL;
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+			fprintf(stderr, "error: could not pin to CPUs %s: %s\n",
+				rt->cpus, strerror(errno));
+			return -errno;
+		}
+	}
+
+	if (rt->lock_memory) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			fprintf(stderr, "error: could not lock memory: %s\n",
+				strerror(errno));
+			return -errno;
+		}
+		prefault_stack();
+	}
+
+	if (rt->priority > 0) {
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = rt->priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+			fprintf(stderr, "error: could not set SCHED_FIFO priority %d: %s\n",
+				rt->priority, strerror(errno));
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+static long elapsed_ns(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000000L +
+	       (now.tv_nsec - since->tv_nsec);
+}
+
+void rt_sleep_until(const struct timespec *target, struct histogram *latency)
+{
+	long late;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, target, NULL) == EINTR)
+		;
+
+	if (!latency)
+		return;
+	late = elapsed_ns(target);
+	histogram_add(latency, late > 0 ? late : 0);
+}
+
+void rt_latency_since(const struct timespec *since, struct histogram *latency)
+{
+	long late = elapsed_ns(since);
+
+	histogram_add(latency, late > 0 ? late : 0);
+}
+
+void rt_latency_report(const char *what, const struct histogram *latency)
+{
+	fprintf(stderr, "%s latency over %lu wakeups (usec): "
+		"min %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+		what, (unsigned long)latency->count,
+		latency->min / 1000.0,
+		histogram_percentile(latency, 50) / 1000.0,
+		histogram_percentile(latency, 99) / 1000.0,
+		histogram_percentile(latency, 99.9) / 1000.0,
+		latency->max / 1000.0);
+}
@@ -0,0 +1,74 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+
+#ifndef EVEMU_RT_H
+#define EVEMU_RT_H
+
+#include <time.h>
+
+#include "evemu-histogram.h"
+
+struct rt_options {
+	int priority;		/* SCHED_FIFO priority, 0 keeps the policy */
+	int lock_memory;	/* mlockall() current and future pages */
+	const char *cpus;	/* CPU list like "2,4-5", or NULL */
+	int latency;		/* measure and report wakeup latency */
+};
+
+/**
+ * rt_parse_priority() - parse a SCHED_FIFO priority
+ * @arg: the priority as given on the command line
+ * @priority: set to the priority if it is valid
+ *
+ * Returns zero if @arg is a number in the range of SCHED_FIFO priorities,
+ * -EINVAL otherwise.
+ */
+int rt_parse_priority(const char *arg, int *priority);
+
+/**
+ * rt_apply() - move the calling process to the requested scheduling
+ * @rt: the options to apply
+ *
+ * Pins to the CPU list, locks and prefaults memory, including some stack
+ * for the hot loop, and switches to SCHED_FIFO, in that order. Do this
+ * after allocating the event buffers so they are locked too.
+ *
+ * Returns zero if successful, negative error otherwise.
+ */
+int rt_apply(const struct rt_options *rt);
+
+/**
+ * rt_sleep_until() - sleep until an absolute CLOCK_MONOTONIC time
+ * @target: the time to wake up
+ * @latency: if not NULL, counts how late the wakeup was, in ns
+ */
+void rt_sleep_until(const struct timespec *target, struct histogram *latency);
+
+/**
+ * rt_latency_since() - count the ns elapsed since a CLOCK_MONOTONIC time
+ */
+void rt_latency_since(const struct timespec *since, struct histogram *latency);
+
+/**
+ * rt_latency_report() - print a latency histogram to stderr
+ * @what: name of the measured wakeups
+ */
+void rt_latency_report(const char *what, const struct histogram *latency);
+
+#endif
@@ -0,0 +1,314 @@
+/*****************************************************************************
+ *
+ * evemu - Kernel device emulation
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ ****************************************************************************/
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+
+#include "evemu-histogram.h"
+
+/* ev-record numbers its devices from 0, one more than MAX_DEVICES */
+#define MAX_STATS_DEVICES 16
+
+#define READ_BUFFER_SIZE (1 << 20)
+
+struct code_range {
+	uint64_t count;
+	int32_t min, max;
+};
+
+struct device_stats {
+	uint64_t events;
+	uint64_t frames;
+	uint64_t dropped;
+	uint64_t frame_events;	/* events in the frame being read */
+	long first, last;	/* usec */
+	long last_frame;	/* usec, -1 before the first frame */
+	struct histogram intervals;
+	struct histogram frame_sizes;
+	struct code_range codes[EV_CNT][KEY_CNT];
+};
+
+static struct device_stats *devices[MAX_STATS_DEVICES];
+static uint64_t ignored;
+
+static const char *parse_uint(const char *p, const char *end, unsigned long *value)
+{
+	const char *start = p;
+
+	*value = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		*value = *value * 10 + (*p++ - '0');
+	return p == start ? NULL : p;
+}
+
+static const char *parse_hex(const char *p, const char *end, unsigned long *value)
+{
+	static const signed char hex[256] = {
+		['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+		['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+		['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+		['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+	};
+	const char *start = p;
+
+	*value = 0;
+	while (p < end && hex[(unsigned char)*p])
+		*value = *value * 16 + hex[(unsigned char)*p++] - 1;
+	return p == start ? NULL : p;
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+/*
+ * Parses both "E: <sec>.<usec> <type> <code> <value>" as written by
+ * evemu-record and "E: <id> <sec>.<usec> ..." as written by ev-record.
+ */
+static int parse_event(const char *p, const char *end, unsigned long *id,
+		       long *time, struct input_event *ev)
+{
+	unsigned long a, usec, type, code, value;
+	int negative = 0;
+
+	p = skip_blanks(p + 2, end);
+	if (!(p = parse_uint(p, end, &a)))
+		return -1;
+
+	*id = 0;
+	if (p < end && *p != '.') {
+		*id = a;
+		p = skip_blanks(p, end);
+		if (!(p = parse_uint(p, end, &a)))
+			return -1;
+	}
+	if (p >= end || *p++ != '.' || !(p = parse_uint(p, end, &usec)))
+		return -1;
+
+	p = skip_blanks(p, end);
+	if (!(p = parse_hex(p, end, &type)))
+		return -1;
+	p = skip_blanks(p, end);
+	if (!(p = parse_hex(p, end, &code)))
+		return -1;
+	p = skip_blanks(p, end);
+	if (p < end && *p == '-') {
+		negative = 1;
+		p++;
+	}
+	if (!parse_uint(p, end, &value))
+		return -1;
+
+	*time = a * 1000000 + usec;
+	ev->type = type;
+	ev->code = code;
+	ev->value = negative ? -(long)value : (long)value;
+	return 0;
+}
+
+static struct device_stats *get_device(unsigned long id)
+{
+	struct device_stats *d;
+
+	if (id >= MAX_STATS_DEVICES)
+		return NULL;
+
+	d = devices[id];
+	if (!d) {
+		d = calloc(1, sizeof(*d));
+		if (!d)
+			return NULL;
+		histogram_init(&d->intervals);
+		histogram_init(&d->frame_sizes);
+		d->last_frame = -1;
+		devices[id] = d;
+	}
+	return d;
+}
+
+static void account(struct device_stats *d, long time, const struct input_event *ev)
+{
+	if (d->events == 0)
+		d->first = time;
+	d->last = time;
+	d->events++;
+	d->frame_events++;
+
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		if (d->last_frame >= 0 && time >= d->last_frame)
+			histogram_add(&d->intervals, time - d->last_frame);
+		d->last_frame = time;
+		histogram_add(&d->frame_sizes, d->frame_events);
+		d->frame_events = 0;
+		d->frames++;
+	} else if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+		d->dropped++;
+	}
+
+	if (ev->type < EV_CNT && ev->code < KEY_CNT) {
+		struct code_range *r = &d->codes[ev->type][ev->code];
+
+		if (r->count == 0 || ev->value < r->min)
+			r->min = ev->value;
+		if (r->count == 0 || ev->value > r->max)
+			r->max = ev->value;
+		r->count++;
+	}
+}
+
+static void process_line(const char *line, const char *end)
+{
+	struct input_event ev;
+	struct device_stats *d;
+	unsigned long id;
+	long time;
+
+	if (end - line < 2 || line[0] != 'E' || line[1] != ':')
+		return;
+
+	if (parse_event(line, end, &id, &time, &ev) < 0 ||
+	    !(d = get_device(id))) {
+		ignored++;
+		return;
+	}
+
+	account(d, time, &ev);
+}
+
+/* Reads in large blocks and splits lines in place, no per-line copies */
+static void scan(FILE *fp)
+{
+	static char buf[READ_BUFFER_SIZE];
+	size_t len = 0, n;
+
+	while ((n = fread(buf + len, 1, sizeof(buf) - len, fp)) > 0) {
+		char *line = buf, *nl;
+
+		len += n;
+		while ((nl = memchr(line, '\n', buf + len - line))) {
+			process_line(line, nl);
+			line = nl + 1;
+		}
+
+		len = buf + len - line;
+		if (len == sizeof(buf)) /* no newline in a full buffer */
+			len = 0;
+		memmove(buf, line, len);
+	}
+
+	if (len > 0)
+		process_line(buf, buf + len);
+}
+
+static void print_histogram(const char *name, const struct histogram *h,
+			    const char *unit)
+{
+	printf("%-16s min %lu  p50 %lu  p90 %lu  p99 %lu  p99.9 %lu  max %lu  mean %.1f %s\n",
+	       name,
+	       (unsigned long)h->min,
+	       (unsigned long)histogram_percentile(h, 50),
+	       (unsigned long)histogram_percentile(h, 90),
+	       (unsigned long)histogram_percentile(h, 99),
+	       (unsigned long)histogram_percentile(h, 99.9),
+	       (unsigned long)h->max,
+	       h->count ? (double)h->sum / h->count : 0.0,
+	       unit);
+}
+
+static void print_device(unsigned long id, const struct device_stats *d)
+{
+	double duration = (d->last - d->first) / 1000000.0;
+	unsigned int type, code;
+	uint64_t median;
+
+	printf("# device %lu\n", id);
+	printf("%-16s %lu\n", "events:", (unsigned long)d->events);
+	printf("%-16s %lu\n", "frames:", (unsigned long)d->frames);
+	printf("%-16s %lu\n", "SYN_DROPPED:", (unsigned long)d->dropped);
+	printf("%-16s %.6f s\n", "duration:", duration);
+	if (duration > 0) {
+		printf("%-16s %.1f /s\n", "event rate:", d->events / duration);
+		printf("%-16s %.1f /s\n", "frame rate:", d->frames / duration);
+	}
+	print_histogram("events/frame:", &d->frame_sizes, "");
+	print_histogram("frame interval:", &d->intervals, "usec");
+
+	median = histogram_percentile(&d->intervals, 50);
+	if (median > 0)
+		printf("%-16s %.1f Hz\n", "median rate:", 1000000.0 / median);
+
+	printf("%-16s\n", "codes:");
+	for (type = 0; type < EV_CNT; type++) {
+		for (code = 0; code < KEY_CNT; code++) {
+			const struct code_range *r = &d->codes[type][code];
+			const char *tname, *cname;
+
+			if (r->count == 0)
+				continue;
+
+			tname = libevdev_event_type_get_name(type);
+			cname = libevdev_event_code_get_name(type, code);
+			printf("  %-8s %-22s count %10lu  min %8d  max %8d\n",
+			       tname ? tname : "?", cname ? cname : "?",
+			       (unsigned long)r->count, r->min, r->max);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long id;
+	int i;
+
+	if (argc < 2) {
+		scan(stdin);
+	} else {
+		for (i = 1; i < argc; i++) {
+			FILE *fp = fopen(argv[i], "r");
+
+			if (!fp) {
+				fprintf(stderr, "error: could not open file %s\n", argv[i]);
+				return -1;
+			}
+			scan(fp);
+			fclose(fp);
+		}
+	}
+
+	for (id = 0; id < MAX_STATS_DEVICES; id++) {
+		if (devices[id]) {
+			print_device(id, devices[id]);
+			free(devices[id]);
+		}
+	}
+
+	if (ignored)
+		fprintf(stderr, "warning: ignored %lu malformed events\n",
+			(unsigned long)ignored);
+
+	return 0;
+}